@@ -15,6 +15,7 @@
 
 #include "application.h"
 #include "battery-test.h"
+#include "log-loader.h"
 #include "power-graphs.h"
 #include "test-runner.h"
 #include "util.h"
@@ -30,6 +31,7 @@ struct _GbbApplication {
     GbbEventPlayer *player;
 
     GFile *log_folder;
+    GbbLogLoader *log_loader;
 
     GbbPowerState *current_state;
     GbbPowerState *previous_state;
@@ -47,6 +49,7 @@ struct _GbbApplication {
 
     GtkWidget *log_view;
     GtkListStore *log_model;
+    GHashTable *log_rows; /* filename => GtkTreeIter in log_model */
 
     GtkWidget *test_graphs;
     GtkWidget *log_graphs;
@@ -85,6 +88,8 @@ gbb_application_finalize(GObject *object)
 
         g_clear_object (&application->logind);
     }
+
+    g_clear_object(&application->log_loader);
 }
 
 static void
@@ -392,29 +397,32 @@ remove_stop_shortcut(GbbApplication *application)
 }
 
 enum {
-    COLUMN_RUN,
+    COLUMN_RUN, /* NULL until the run is looked at */
     COLUMN_NAME,
     COLUMN_DURATION,
-    COLUMN_DATE
+    COLUMN_DATE,
+    COLUMN_FILENAME,
+    COLUMN_START_TIME
 };
 
 static char *
-make_duration_string(GbbTestRun *run)
+make_duration_string(GbbDurationType duration_type,
+                     double          duration)
 {
-    switch (gbb_test_run_get_duration_type(run)) {
+    switch (duration_type) {
     case GBB_DURATION_TIME:
-        return g_strdup_printf("%.0f Minutes", gbb_test_run_get_duration_time(run) / 60);
+        return g_strdup_printf("%.0f Minutes", duration / 60);
     case GBB_DURATION_PERCENT:
-        return g_strdup_printf("Until %.0f%% battery", gbb_test_run_get_duration_percent(run));
+        return g_strdup_printf("Until %.0f%% battery", duration);
     default:
         g_assert_not_reached();
     }
 }
 
 static char *
-make_date_string(GbbTestRun *run)
+make_date_string(gint64 start_time)
 {
-    GDateTime *start = g_date_time_new_from_unix_local(gbb_test_run_get_start_time(run));
+    GDateTime *start = g_date_time_new_from_unix_local(start_time);
     GDateTime *now = g_date_time_new_now_local();
 
     char *result;
@@ -436,48 +444,116 @@ make_date_string(GbbTestRun *run)
     return result;
 }
 
+/* run may be NULL, then it's loaded when selected; a log that is
+ * already in the list is updated */
 static void
-add_run_to_logs(GbbApplication *application,
-                GbbTestRun     *run)
+add_summary_to_logs(GbbApplication      *application,
+                    const GbbLogSummary *summary,
+                    GbbTestRun          *run)
 {
+    GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(application->log_view));
+    GtkTreeIter *existing = NULL;
     GtkTreeIter iter;
 
-    char *duration = make_duration_string(run);
-    char *date = make_date_string(run);
+    char *duration = make_duration_string(summary->duration_type, summary->duration);
+    char *date = make_date_string(summary->start_time);
+
+    if (summary->filename)
+        existing = g_hash_table_lookup(application->log_rows, summary->filename);
+
+    if (existing) {
+        iter = *existing;
+        gtk_list_store_set(application->log_model, &iter,
+                           COLUMN_RUN, run,
+                           COLUMN_DURATION, duration,
+                           COLUMN_DATE, date,
+                           COLUMN_NAME, summary->name,
+                           COLUMN_START_TIME, summary->start_time,
+                           -1);
+
+        /* Show what's in the log now */
+        if (gtk_tree_selection_iter_is_selected(selection, &iter))
+            g_signal_emit_by_name(selection, "changed");
+    } else {
+        gtk_list_store_insert_with_values(application->log_model, &iter, -1,
+                                          COLUMN_RUN, run,
+                                          COLUMN_DURATION, duration,
+                                          COLUMN_DATE, date,
+                                          COLUMN_NAME, summary->name,
+                                          COLUMN_FILENAME, summary->filename,
+                                          COLUMN_START_TIME, summary->start_time,
+                                          -1);
+        if (summary->filename)
+            g_hash_table_insert(application->log_rows, g_strdup(summary->filename),
+                                gtk_tree_iter_copy(&iter));
+    }
 
-    gtk_list_store_append(application->log_model, &iter);
-    gtk_list_store_set(application->log_model, &iter,
-                       COLUMN_RUN, run,
-                       COLUMN_DURATION, duration,
-                       COLUMN_DATE, date,
-                       COLUMN_NAME, gbb_test_run_get_name(run),
-                       -1);
     g_free(duration);
     g_free(date);
 
-    GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(application->log_view));
     if (!gtk_tree_selection_get_selected(selection, NULL, NULL))
         gtk_tree_selection_select_iter(selection, &iter);
 }
 
 static void
-write_run_to_disk(GbbApplication *application,
-                  GbbTestRun     *run)
+add_run_to_logs(GbbApplication *application,
+                GbbTestRun     *run)
 {
-    GError *error = NULL;
+    GbbLogSummary *summary = gbb_log_summary_new_for_run(run);
+    add_summary_to_logs(application, summary, run);
+    gbb_log_summary_free(summary);
+}
 
-    g_debug("Writing %s to disk", gbb_test_run_get_name(application->run));
+static gboolean
+ensure_log_folder(GbbApplication *application)
+{
+    GError *error = NULL;
 
     if (!g_file_query_exists(application->log_folder, NULL)) {
         if (!g_file_make_directory_with_parents(application->log_folder, NULL, &error)) {
             g_warning("Cannot create log directory: %s\n", error->message);
             g_clear_error(&error);
-            return;
+            return FALSE;
         }
     }
 
+    return TRUE;
+}
+
+static void
+start_run_journal(GbbApplication *application,
+                  GbbTestRun     *run)
+{
+    GError *error = NULL;
+
+    if (!ensure_log_folder(application))
+        return;
+
+    /* Next to where the log will go; 'gbb recover' turns it into
+     * the log if we go down before the end of the run */
+    char *path = gbb_test_run_get_default_path(run, application->log_folder);
+    char *journal = g_strconcat(path, ".journal", NULL);
+    if (!gbb_test_run_start_journal(run, journal, &error)) {
+        g_warning("Can't start journal: %s\n", error->message);
+        g_clear_error(&error);
+    }
+    g_free(journal);
+    g_free(path);
+}
+
+static void
+write_run_to_disk(GbbApplication *application,
+                  GbbTestRun     *run)
+{
+    GError *error = NULL;
+
+    g_debug("Writing %s to disk", gbb_test_run_get_name(application->run));
+
+    if (!ensure_log_folder(application))
+        return;
+
     char *path = gbb_test_run_get_default_path(run, application->log_folder);
-    if (!gbb_test_run_write_to_file(application->run, path, &error)) {
+    if (!gbb_test_run_write_to_file(application->run, path, GBB_TEST_RUN_WRITE_NONE, &error)) {
         g_warning("Can't write test run to disk: %s\n", error->message);
         g_clear_error(&error);
     }
@@ -568,11 +644,11 @@ on_delete_button_clicked(GtkWidget      *button,
 
     GtkTreeSelection *selection = gtk_tree_view_get_selection(GTK_TREE_VIEW(application->log_view));
     if (gtk_tree_selection_get_selected(selection, &model, &iter)) {
-        GbbTestRun *run;
+        char *filename;
         const char *name;
         const char *date;
         gtk_tree_model_get(model, &iter,
-                           COLUMN_RUN, &run,
+                           COLUMN_FILENAME, &filename,
                            COLUMN_NAME, &name,
                            COLUMN_DATE, &date,
                            -1);
@@ -595,11 +671,11 @@ on_delete_button_clicked(GtkWidget      *button,
 
         int response = gtk_dialog_run(GTK_DIALOG(dialog));
         if (response == GTK_RESPONSE_OK) {
-            const char *filename = gbb_test_run_get_filename(run);
             GFile *file = g_file_new_for_path(filename);
             GError *error = NULL;
 
             if (g_file_delete(file, NULL, &error)) {
+                g_hash_table_remove(application->log_rows, filename);
                 if (gtk_list_store_remove(application->log_model, &iter))
                     gtk_tree_selection_select_iter(selection, &iter);
             } else {
@@ -609,6 +685,7 @@ on_delete_button_clicked(GtkWidget      *button,
         }
 
         gtk_widget_destroy(dialog);
+        g_free(filename);
     }
 }
 
@@ -631,7 +708,11 @@ fill_log_from_run(GbbApplication *application,
                   GbbTestRun     *run)
 {
     set_label(application, "test-log", "%s", gbb_test_run_get_name(run));
-    char *duration = make_duration_string(run);
+    GbbDurationType duration_type = gbb_test_run_get_duration_type(run);
+    char *duration = make_duration_string(duration_type,
+                                          duration_type == GBB_DURATION_TIME ?
+                                          gbb_test_run_get_duration_time(run) :
+                                          gbb_test_run_get_duration_percent(run));
     set_label(application, "duration-log", "%s", duration);
     g_free(duration);
     set_label(application, "backlight-log", "%d%%",
@@ -676,73 +757,61 @@ fill_log_from_run(GbbApplication *application,
 }
 
 static int
-compare_runs(gconstpointer a,
-             gconstpointer b)
+compare_runs(GtkTreeModel *model,
+             GtkTreeIter  *a,
+             GtkTreeIter  *b,
+             gpointer      data)
 {
-    gint64 time_a = gbb_test_run_get_start_time((GbbTestRun *)a);
-    gint64 time_b = gbb_test_run_get_start_time((GbbTestRun *)b);
+    gint64 time_a, time_b;
+
+    gtk_tree_model_get(model, a, COLUMN_START_TIME, &time_a, -1);
+    gtk_tree_model_get(model, b, COLUMN_START_TIME, &time_b, -1);
 
     return time_a < time_b ? -1 : (time_a == time_b ? 0 : 1);
 }
 
 static void
-read_logs(GbbApplication *application)
+on_logs_loaded(GbbLogLoader   *loader,
+               GPtrArray      *summaries,
+               GbbApplication *application)
 {
-    GError *error = NULL;
-    GFileEnumerator *enumerator;
-    GList *runs = NULL;
-
-    enumerator = g_file_enumerate_children (application->log_folder,
-                                            "standard::name",
-                                            G_FILE_QUERY_INFO_NONE,
-                                            NULL, &error);
-    if (!enumerator)
-        goto out;
-
-    while (error == NULL) {
-        GFileInfo *info = g_file_enumerator_next_file (enumerator, NULL, &error);
-        GFile *child = NULL;
-        if (error != NULL)
-            goto out;
-        else if (!info)
-            break;
-
-        const char *name = g_file_info_get_name (info);
-        if (!g_str_has_suffix(name, ".json"))
-            goto next;
-
-        child = g_file_enumerator_get_child (enumerator, info);
-        char *child_path = g_file_get_path(child);
-        GbbTestRun *run = gbb_test_run_new_from_file(child_path, &error);
-        if (run) {
-            runs = g_list_prepend(runs, run);
-        } else {
-            g_warning("Can't read test log '%s': %s", child_path, error->message);
-            g_clear_error(&error);
-        }
-
-    next:
-        g_clear_object (&child);
-        g_clear_object (&info);
-    }
-
-out:
-    if (error != NULL) {
-        g_warning("Error reading logs: %s", error->message);
-        g_clear_error(&error);
-    }
+    guint i;
 
-    g_clear_object (&enumerator);
+    for (i = 0; i < summaries->len; i++)
+        add_summary_to_logs(application, g_ptr_array_index(summaries, i), NULL);
+}
 
-    runs = g_list_sort(runs, compare_runs);
+static void
+on_log_removed(GbbLogLoader   *loader,
+               const char     *filename,
+               GbbApplication *application)
+{
+    GtkTreeIter *iter = g_hash_table_lookup(application->log_rows, filename);
 
-    GList *l;
-    for (l = runs; l; l = l->next) {
-        add_run_to_logs(application, l->data);
-        g_object_unref(l->data);
+    if (iter) {
+        gtk_list_store_remove(application->log_model, iter);
+        g_hash_table_remove(application->log_rows, filename);
     }
+}
 
-    g_list_free(runs);
+static void
+read_logs(GbbApplication *application)
+{
+    char *index_path = g_build_filename(g_get_user_cache_dir(), PACKAGE_NAME, "log-index", NULL);
+    application->log_loader = gbb_log_loader_new(application->log_folder, index_path);
+    g_free(index_path);
+
+    /* The list fills in as logs are read, kept sorted by the model */
+    gtk_tree_sortable_set_sort_func(GTK_TREE_SORTABLE(application->log_model), COLUMN_START_TIME,
+                                    compare_runs, NULL, NULL);
+    gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(application->log_model), COLUMN_START_TIME,
+                                         GTK_SORT_ASCENDING);
+
+    g_signal_connect(application->log_loader, "loaded",
+                     G_CALLBACK(on_logs_loaded), application);
+    g_signal_connect(application->log_loader, "removed",
+                     G_CALLBACK(on_log_removed), application);
+    gbb_log_loader_start(application->log_loader);
 }
 
 static void
@@ -756,8 +825,28 @@ on_log_selection_changed (GtkTreeSelection *selection,
 
     if (have_selected) {
         GbbTestRun *run;
-        gtk_tree_model_get(model, &iter, 0, &run, -1);
-        fill_log_from_run(application, run);
+        gtk_tree_model_get(model, &iter, COLUMN_RUN, &run, -1);
+
+        /* Only the summary was read when the list was filled */
+        if (run == NULL) {
+            GError *error = NULL;
+            char *filename;
+
+            gtk_tree_model_get(model, &iter, COLUMN_FILENAME, &filename, -1);
+            run = gbb_test_run_new_from_file(filename, GBB_TEST_RUN_READ_NONE, &error);
+            if (run) {
+                gtk_list_store_set(application->log_model, &iter, COLUMN_RUN, run, -1);
+            } else {
+                g_warning("Can't read test log '%s': %s", filename, error->message);
+                g_clear_error(&error);
+            }
+            g_free(filename);
+        }
+
+        if (run) {
+            fill_log_from_run(application, run);
+            g_object_unref(run);
+        }
     }
 
     gtk_widget_set_sensitive(application->delete_button, have_selected);
@@ -848,6 +937,8 @@ gbb_application_activate (GApplication *app)
     gtk_tree_view_append_column(GTK_TREE_VIEW(application->log_view), column);
 
     application->log_model = GTK_LIST_STORE(gtk_builder_get_object(application->builder, "log-model"));
+    application->log_rows = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                                  g_free, (GDestroyNotify)gtk_tree_iter_free);
 
     read_logs(application);
 
@@ -886,12 +977,18 @@ on_runner_phase_changed(GbbTestRunner  *runner,
 
     GbbTestPhase phase = gbb_test_runner_get_phase(runner);
 
+    if (phase == GBB_TEST_PHASE_RUNNING)
+        start_run_journal(application, application->run);
+
     if (phase == GBB_TEST_PHASE_STOPPED) {
         const GbbPowerState *start_state = gbb_test_run_get_start_state(application->run);
         const GbbPowerState *last_state = gbb_test_run_get_last_state(application->run);
         if (last_state != start_state) {
             write_run_to_disk(application, application->run);
             add_run_to_logs(application, application->run);
+        } else {
+            /* Nothing worth keeping */
+            gbb_test_run_discard_journal(application->run);
         }
 
         application->test = NULL;
@@ -23,10 +23,49 @@
 #include "event-recorder.h"
 #include "power-monitor.h"
 #include "power-supply.h"
+#include "simulated-battery.h"
 #include "system-info.h"
 #include "test-runner.h"
+#include "trace-source.h"
 #include "xinput-wait.h"
 #include "util.h"
+#include "util-clock.h"
+
+static gboolean convert_binary;
+static gboolean convert_compact;
+static GOptionEntry convert_options[] =
+{
+    { "binary", 'b', 0, G_OPTION_ARG_NONE, &convert_binary, "Write the compact binary format" },
+    { "compact", 0, 0, G_OPTION_ARG_NONE, &convert_compact, "Write JSON without indentation" },
+    { NULL }
+};
+
+static int
+convert(int argc, char **argv)
+{
+    GError *error = NULL;
+    GbbTestRunWriteFlags flags = GBB_TEST_RUN_WRITE_NONE;
+
+    if (convert_binary && convert_compact)
+        die("--binary and --compact can't be used together");
+
+    /* Either format is read */
+    GbbTestRun *run = gbb_test_run_new_from_file(argv[1], GBB_TEST_RUN_READ_NONE, &error);
+    if (run == NULL)
+        die("Can't read test run: %s", error->message);
+
+    if (convert_binary)
+        flags |= GBB_TEST_RUN_WRITE_BINARY;
+    if (convert_compact)
+        flags |= GBB_TEST_RUN_WRITE_COMPACT;
+
+    if (!gbb_test_run_write_to_file(run, argv[2], flags, &error))
+        die("Can't write test run: %s", error->message);
+
+    g_object_unref(run);
+
+    return 0;
+}
 
 static gboolean info_usejson = FALSE;
 static GOptionEntry info_options[] =
@@ -278,6 +317,14 @@ on_power_monitor_changed(GbbPowerMonitor *monitor,
     g_print("%s", time_str);
     g_print("Energy: %.2f WH (%.2f%%)\n", state->energy_now, gbb_power_state_get_percent(state));
 
+    int i;
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++) {
+        if (state->rapl_energy[i] >= 0) {
+            g_print("%s", time_str);
+            g_print("RAPL %s: %.2f J\n", gbb_rapl_domain_get_name(i), state->rapl_energy[i]);
+        }
+    }
+
     if (runner != NULL) {
         GbbTestRun *run = gbb_test_runner_get_run(runner);
         const GbbPowerState *tmp = gbb_test_run_get_start_state(run);
@@ -305,6 +352,12 @@ on_power_monitor_changed(GbbPowerMonitor *monitor,
         g_print("%s", time_str);
         g_print("Average current: %.2f A\n", statistics->current);
     }
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++) {
+        if (statistics->rapl_power[i] >= 0) {
+            g_print("%s", time_str);
+            g_print("Average RAPL %s power: %.2f W\n", gbb_rapl_domain_get_name(i), statistics->rapl_power[i]);
+        }
+    }
     if (statistics->battery_life >= 0) {
         int h, m, s;
         break_time(statistics->battery_life, &h, &m, &s);
@@ -324,31 +377,87 @@ on_power_monitor_changed(GbbPowerMonitor *monitor,
 
 }
 
+static char *monitor_replay;
+static gboolean monitor_fast;
+static GMainLoop *monitor_loop;
+static guint monitor_n_changes;
+static gint64 monitor_start_time;
+
 static GOptionEntry monitor_options[] =
 {
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &monitor_replay, "Replay the log of a saved test run", "FILENAME" },
+    { "fast", 0, 0, G_OPTION_ARG_NONE, &monitor_fast, "Replay in virtual time rather than in real time" },
     { NULL }
 };
 
+static void
+monitor_on_changed(GbbPowerMonitor *monitor,
+                   gpointer         data)
+{
+    monitor_n_changes++;
+}
+
+static void
+monitor_on_replay_finished(GbbTraceSource  *trace,
+                           GbbPowerMonitor *monitor)
+{
+    /* Don't wait for the next scheduled read to see the last entry */
+    gbb_power_monitor_update(monitor);
+
+    fprintf(stderr, "Replayed %u log entries (%.0f s) as %u changes in %.2f s\n",
+            gbb_trace_source_get_length(trace),
+            gbb_trace_source_get_duration(trace),
+            monitor_n_changes,
+            (g_get_monotonic_time() - monitor_start_time) / 1000000.);
+    g_main_loop_quit(monitor_loop);
+}
+
 static int
 monitor(int argc, char **argv)
 {
     GbbPowerMonitor *monitor;
-    GMainLoop *loop;
     char time_str[256] = { 0 };
     time_t now;
 
-    time (&now);
-    strftime (time_str, sizeof (time_str), "%Y-%m-%d %H:%M:%S ", localtime (&now));
+    if (monitor_fast && monitor_replay == NULL)
+        die("--fast can only be used with --replay");
+
+    monitor_loop = g_main_loop_new (NULL, FALSE);
+    monitor_start_time = g_get_monotonic_time();
+
+    if (monitor_replay) {
+        GError *error = NULL;
+        GList *sources;
+
+        if (monitor_fast)
+            gbb_clock_set_virtual();
 
-    g_print ("%s", time_str);
-    g_print("Monitoring power events. Press Ctrl+C to cancel\n");
-    monitor = gbb_power_monitor_new();
+        GbbTraceSource *trace = gbb_trace_source_new_from_file(monitor_replay, &error);
+        if (trace == NULL)
+            die("%s", error->message);
 
+        sources = g_list_prepend(NULL, trace);
+        monitor = gbb_power_monitor_new_for_sources(sources);
+        g_list_free(sources);
+
+        g_signal_connect(trace, "finished",
+                         G_CALLBACK(monitor_on_replay_finished), monitor);
+        g_object_unref(trace);
+    } else {
+        time (&now);
+        strftime (time_str, sizeof (time_str), "%Y-%m-%d %H:%M:%S ", localtime (&now));
+
+        g_print ("%s", time_str);
+        g_print("Monitoring power events. Press Ctrl+C to cancel\n");
+        monitor = gbb_power_monitor_new();
+    }
+
+    g_signal_connect(monitor, "changed",
+                     G_CALLBACK(monitor_on_changed), NULL);
     g_signal_connect(monitor, "changed",
                      G_CALLBACK(on_power_monitor_changed), NULL);
 
-    loop = g_main_loop_new (NULL, FALSE);
-    g_main_loop_run (loop);
+    g_main_loop_run (monitor_loop);
 
     return 0;
 }
@@ -443,19 +552,78 @@ record(int argc, char **argv)
     return 0;
 }
 
+static char *recover_output;
+static gboolean recover_compact;
+
+static GOptionEntry recover_options[] =
+{
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &recover_output, "Output filename", "FILENAME" },
+    { "compact", 0, 0, G_OPTION_ARG_NONE, &recover_compact, "Write the output without indentation" },
+    { NULL }
+};
+
+static int
+recover(int argc, char **argv)
+{
+    const char *journal = argv[1];
+    GError *error = NULL;
+
+    if (recover_output == NULL) {
+        if (!g_str_has_suffix(journal, ".journal"))
+            die("--output must be given for a journal not named <output>.journal");
+        recover_output = g_strndup(journal, strlen(journal) - strlen(".journal"));
+    }
+
+    GbbTestRun *run = gbb_test_run_new_from_journal(journal, &error);
+    if (run == NULL)
+        die("%s", error->message);
+
+    if (!gbb_test_run_write_to_file(run, recover_output,
+                                    recover_compact ? GBB_TEST_RUN_WRITE_COMPACT : GBB_TEST_RUN_WRITE_NONE,
+                                    &error))
+        die("Can't write test run to disk: %s", error->message);
+
+    fprintf(stderr, "Recovered %u samples to %s\n",
+            gbb_power_history_get_length(gbb_test_run_get_history(run)),
+            recover_output);
+
+    g_object_unref(run);
+
+    return 0;
+}
+
 static char *test_duration;
 static int test_min_battery = -42;
 static int test_screen_brightness = 50;
 static char *test_output;
+static gboolean test_compact;
 static gboolean test_verbose;
+static gboolean test_simulate;
+static char *test_simulate_model;
+static char *test_replay;
+static gint64 test_start_time;
+
+static gboolean
+parse_simulate(const char *option_name,
+               const char *value,
+               gpointer    data,
+               GError    **error)
+{
+    test_simulate = TRUE;
+    test_simulate_model = g_strdup(value);
+    return TRUE;
+}
 
 static GOptionEntry test_options[] =
 {
     { "duration", 'd', 0, G_OPTION_ARG_STRING, &test_duration, "Duration (1h, 10m, etc.)", "DURATION" },
-    { "min-battery", 'm', 0, G_OPTION_ARG_INT, &test_duration, "", "PERCENT" },
+    { "min-battery", 'm', 0, G_OPTION_ARG_INT, &test_min_battery, "Stop when the battery gets below this (0-100)", "PERCENT" },
     { "screen-brightness", 0, 0, G_OPTION_ARG_INT, &test_screen_brightness, "screen backlight brightness (0-100)", "PERCENT" },
     { "output", 'o', 0, G_OPTION_ARG_FILENAME, &test_output, "Output filename", "FILENAME" },
+    { "compact", 0, 0, G_OPTION_ARG_NONE, &test_compact, "Write the output without indentation" },
     { "verbose", 'v', 0, G_OPTION_ARG_NONE, &test_verbose, "Show verbose statistics" },
+    { "simulate", 0, G_OPTION_FLAG_OPTIONAL_ARG, G_OPTION_ARG_CALLBACK, parse_simulate, "Run against a simulated battery in virtual time", "MODEL" },
+    { "replay", 0, 0, G_OPTION_ARG_FILENAME, &test_replay, "Run against the log of a saved test run in virtual time", "FILENAME" },
     { NULL }
 };
 
@@ -490,16 +658,68 @@ on_runner_phase_changed(GbbTestRunner *runner,
                         GMainLoop     *loop)
 {
     switch (gbb_test_runner_get_phase(runner)) {
-    case GBB_TEST_PHASE_RUNNING:
+    case GBB_TEST_PHASE_RUNNING: {
+        GError *error = NULL;
+
         if (test_output == NULL)
             test_output = make_default_filename(runner);
         fprintf(stderr, "Running; will write output to %s\n", test_output);
 
+        /* Until then, samples go to a journal that 'gbb recover' can
+         * turn into the output if we don't make it to the end */
+        char *journal = g_strconcat(test_output, ".journal", NULL);
+        if (!gbb_test_run_start_journal(gbb_test_runner_get_run(runner), journal, &error)) {
+            g_warning("%s", error->message);
+            g_clear_error(&error);
+        }
+        g_free(journal);
+
         break;
+    }
     case GBB_TEST_PHASE_STOPPED: {
         GbbTestRun *run = gbb_test_runner_get_run(runner);
+        const GbbMonitorOverhead *overhead = gbb_test_run_get_monitor_overhead(run);
         GError *error = NULL;
-        if (!gbb_test_run_write_to_file(run, test_output, &error))
+
+        if (overhead != NULL && overhead->n_wakeups > 0 && overhead->elapsed > 0) {
+            fprintf(stderr,
+                    "Monitor overhead: %.2f wakeups/s, %.1f us CPU per wakeup, %.1f syscalls per read\n",
+                    overhead->n_wakeups / overhead->elapsed,
+                    1e6 * overhead->cpu_time / overhead->n_wakeups,
+                    overhead->n_reads > 0 ? (double) overhead->n_syscalls / overhead->n_reads : 0.);
+            fprintf(stderr,
+                    "Process CPU time: %.2f s over %.0f s, %" G_GINT64_FORMAT " context switches\n",
+                    overhead->process_cpu_time, overhead->elapsed,
+                    overhead->n_context_switches);
+        }
+
+        const GbbReplayTiming *timing = gbb_test_run_get_replay_timing(run);
+        if (timing != NULL && timing->n_events > 0) {
+            fprintf(stderr,
+                    "Replay lateness: p50 %.2f ms, p99 %.2f ms, max %.2f ms, %u of %u events over %d ms\n",
+                    gbb_replay_timing_get_percentile(timing, 50) / 1000.,
+                    gbb_replay_timing_get_percentile(timing, 99) / 1000.,
+                    timing->max_lateness / 1000.,
+                    timing->n_late, timing->n_events,
+                    GBB_REPLAY_LATE_THRESHOLD_US / 1000);
+            if (timing->n_iterations > 0)
+                fprintf(stderr,
+                        "Replay drift: %.2f ms mean, %.2f ms max over %u iterations\n",
+                        timing->total_drift / 1000. / timing->n_iterations,
+                        timing->max_drift / 1000.,
+                        timing->n_iterations);
+        }
+
+        if (gbb_clock_is_virtual() && gbb_test_run_get_start_state(run) != NULL) {
+            fprintf(stderr, "Simulated %.0f s in %.2f s\n",
+                    (gbb_test_run_get_last_state(run)->time_us -
+                     gbb_test_run_get_start_state(run)->time_us) / 1000000.,
+                    (g_get_monotonic_time() - test_start_time) / 1000000.);
+        }
+
+        if (!gbb_test_run_write_to_file(run, test_output,
+                                        test_compact ? GBB_TEST_RUN_WRITE_COMPACT : GBB_TEST_RUN_WRITE_NONE,
+                                        &error))
             die("Can't write test run to disk: %s", error->message);
         g_main_loop_quit(loop);
         break;
@@ -589,6 +809,15 @@ on_sigint(gpointer data)
     return TRUE;
 }
 
+static void
+test_on_replay_finished(GbbTraceSource *trace,
+                        GbbTestRunner  *runner)
+{
+    /* Nothing more will happen to the battery */
+    gbb_power_monitor_update(gbb_test_runner_get_power_monitor(runner));
+    gbb_test_runner_stop(runner);
+}
+
 static int
 test(int argc, char **argv)
 {
@@ -598,6 +827,8 @@ test(int argc, char **argv)
         die("--min-battery argument must be between 0 and 100");
     if (test_screen_brightness < 0 || test_screen_brightness > 100)
         die("--screen-brightness argument must be between 0 and 100");
+    if (test_simulate && test_replay != NULL)
+        die("Only one of --simulate and --replay can be specified");
 
     const char *test_id = argv[1];
     GbbBatteryTest *test = gbb_battery_test_get_for_id(test_id);
@@ -610,6 +841,7 @@ test(int argc, char **argv)
     GbbTestRun *run = gbb_test_run_new(test);
 
     if (test_min_battery != -42) {
+        gbb_test_run_set_duration_percent(run, test_min_battery);
     } else if (test_duration != NULL) {
         int seconds = parse_duration(test_duration);
         gbb_test_run_set_duration_time(run, seconds);
@@ -619,7 +851,37 @@ test(int argc, char **argv)
 
     gbb_test_run_set_screen_brightness(run, test_screen_brightness);
 
-    GbbTestRunner *runner = gbb_test_runner_new();
+    GbbTestRunner *runner;
+    test_start_time = g_get_monotonic_time();
+
+    if (test_simulate) {
+        GError *error = NULL;
+
+        /* Before creating the battery, it starts discharging at once */
+        gbb_clock_set_virtual();
+
+        GbbSimulatedBattery *battery = gbb_simulated_battery_new(test_simulate_model, &error);
+        if (battery == NULL)
+            die("%s", error->message);
+
+        runner = gbb_test_runner_new_simulated(GBB_POWER_SOURCE(battery));
+        g_object_unref(battery);
+    } else if (test_replay) {
+        GError *error = NULL;
+
+        gbb_clock_set_virtual();
+
+        GbbTraceSource *trace = gbb_trace_source_new_from_file(test_replay, &error);
+        if (trace == NULL)
+            die("%s", error->message);
+
+        runner = gbb_test_runner_new_simulated(GBB_POWER_SOURCE(trace));
+        g_signal_connect(trace, "finished",
+                         G_CALLBACK(test_on_replay_finished), runner);
+        g_object_unref(trace);
+    } else {
+        runner = gbb_test_runner_new();
+    }
     gbb_test_runner_set_run(runner, run);
 
     GbbEventPlayer *player = gbb_test_runner_get_event_player(runner);
@@ -659,11 +921,13 @@ typedef struct {
 } Subcommand;
 
 Subcommand subcommands[] = {
+    { "convert",      convert_options, NULL, convert, 2, 2, "INPUT OUTPUT" },
     { "info",         info_options, NULL, info, 0, 0},
     { "monitor",      monitor_options, NULL, monitor, 0, 0 },
     { "play",         play_options, NULL, play, 1, 1, "FILENAME" },
     { "play-local",   play_options, NULL, play_local, 1, 1, "FILENAME" },
     { "record",       record_options, NULL, record, 0, 0 },
+    { "recover",      recover_options, NULL, recover, 1, 1, "JOURNAL" },
     { "test",         test_options, test_prepare_context, test, 1, 1, "TEST_ID" },
     { NULL }
 };
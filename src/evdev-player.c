@@ -4,9 +4,13 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
+#include <sys/timerfd.h>
 
 #include <gio/gio.h>
-#include <gio/gunixinputstream.h>
 
 #include <libevdev/libevdev.h>
 #include <libevdev/libevdev-uinput.h>
@@ -17,7 +21,23 @@
 
 typedef struct _GbbEvdevPlayerClass GbbEvdevPlayerClass;
 
-static void queue_event(GbbEvdevPlayer *player);
+/* Timer slack requested for the replay thread; the default of 50us
+ * would let the kernel coalesce our wakeups with unrelated ones */
+#define REPLAY_TIMER_SLACK_NS 1000
+
+typedef enum {
+    DEVICE_KEYBOARD,
+    DEVICE_MOUSE
+} Device;
+
+/* A logged event decoded into the input events that are written to
+ * uinput for it, so that playing it back is a single write() */
+typedef struct {
+    guint time;
+    Device device;
+    guint n_events;
+    struct input_event events[3];
+} EvdevFrame;
 
 struct _GbbEvdevPlayer {
     GbbEventPlayer parent;
@@ -28,13 +48,34 @@ struct _GbbEvdevPlayer {
     struct libevdev_uinput *uidev_keyboard;
     int uinput_fd_mouse;
     struct libevdev_uinput *uidev_mouse;
-    GDataInputStream *input;
 
     guint ready_timeout;
     gboolean ready;
 
-    GbbEvent *next_event;
-    guint next_event_timeout;
+    /* Decoded logs by name, and the one being played */
+    GHashTable *logs;
+    GArray *frames;
+
+    /* Playback runs in its own thread, sleeping on timer_fd until the
+     * absolute deadline of each frame; wake_fd interrupts it */
+    GThread *thread;
+    int timer_fd;
+    int wake_fd;
+    gint stopping;
+    guint loops;
+
+    /* Updated by the replay thread as it goes */
+    gint iteration;
+    gint position;
+
+    /* Made ready by the replay thread to hand pending iterations and
+     * the end of playback to the context that started playback */
+    GSource *notify_source;
+    gint pending_iterations;
+    gint done;
+
+    /* Written only by the replay thread, read once it has been joined */
+    GbbReplayTiming timing;
 };
 
 struct _GbbEvdevPlayerClass {
@@ -46,86 +87,230 @@ struct _GbbEvdevPlayerClass {
 G_DEFINE_TYPE(GbbEvdevPlayer, gbb_evdev_player, GBB_TYPE_EVENT_PLAYER)
 
 static void
-write_event(const struct libevdev_uinput *uinput_dev,
-            unsigned int type,
-            unsigned int code,
-            int value)
+frame_add(EvdevFrame  *frame,
+          unsigned int type,
+          unsigned int code,
+          int          value)
 {
-    int rc = libevdev_uinput_write_event(uinput_dev, type, code, value);
-    if (rc != 0)
-        die("Can't write event (%u %u %i): %s", type, code, value, strerror(-rc));
+    struct input_event *ev = &frame->events[frame->n_events++];
+
+    memset(ev, 0, sizeof(*ev));
+    ev->type = type;
+    ev->code = code;
+    ev->value = value;
 }
 
+static void
+decode_event(const GbbEvent *event,
+             EvdevFrame     *frame)
+{
+    int button = event->detail == 1 ? BTN_LEFT : (event->detail == 2 ? BTN_MIDDLE : BTN_RIGHT);
+
+    frame->time = event->time;
+    frame->device = DEVICE_MOUSE;
+    frame->n_events = 0;
+
+    switch (event->type) {
+    case GBB_EVENT_KEY_PRESS:
+        frame->device = DEVICE_KEYBOARD;
+        frame_add(frame, EV_KEY, event->detail, 1);
+        break;
+    case GBB_EVENT_KEY_RELEASE:
+        frame->device = DEVICE_KEYBOARD;
+        frame_add(frame, EV_KEY, event->detail, 0);
+        break;
+    case GBB_EVENT_BUTTON_PRESS:
+        frame_add(frame, EV_KEY, button, 1);
+        break;
+    case GBB_EVENT_BUTTON_RELEASE:
+        frame_add(frame, EV_KEY, button, 0);
+        break;
+    case GBB_EVENT_WHEEL:
+        frame_add(frame, EV_REL, REL_WHEEL, event->detail);
+        break;
+    case GBB_EVENT_MOTION_NOTIFY:
+        frame_add(frame, EV_ABS, ABS_X, event->x_root);
+        frame_add(frame, EV_ABS, ABS_Y, event->y_root);
+        break;
+    case GBB_EVENT_UNKNOWN:
+        /* Kept as an empty frame so the timing of the log is unchanged */
+        return;
+    }
+
+    frame_add(frame, EV_SYN, SYN_REPORT, 0);
+}
+
+static void
+write_frame(GbbEvdevPlayer   *player,
+            const EvdevFrame *frame)
+{
+    int fd = frame->device == DEVICE_KEYBOARD ? player->uinput_fd_keyboard : player->uinput_fd_mouse;
+    size_t size = frame->n_events * sizeof(struct input_event);
+    ssize_t written;
+
+    if (size == 0)
+        return;
+
+    do {
+        written = write(fd, frame->events, size);
+    } while (written < 0 && errno == EINTR);
+
+    if (written < 0)
+        die_errno("Can't write events");
+    else if ((size_t)written != size)
+        die("Short write of events (%zd of %zu bytes)", written, size);
+}
+
+typedef struct {
+    GSource source;
+    GbbEvdevPlayer *player;
+} NotifySource;
+
 static gboolean
-next_event_timeout(void *data)
+replay_notify_dispatch(GSource    *source,
+                       GSourceFunc callback,
+                       gpointer    user_data)
 {
-    GbbEvdevPlayer *player = data;
-    GbbEvent *event = player->next_event;
+    GbbEvdevPlayer *player = ((NotifySource *)source)->player;
+    guint iterations;
 
-    player->next_event = NULL;
-    player->next_event_timeout = 0;
+    /* Reset first, so anything the thread does from here on makes
+     * the source ready again */
+    g_source_set_ready_time(source, -1);
 
-    if (!event) {
+    iterations = g_atomic_int_and(&player->pending_iterations, 0);
+    while (iterations-- > 0) {
+        gbb_event_player_iteration(GBB_EVENT_PLAYER(player));
+
+        /* A handler stopped (and maybe restarted) playback */
+        if (player->notify_source != source)
+            return G_SOURCE_REMOVE;
+    }
+
+    if (g_atomic_int_get(&player->done))
         gbb_event_player_stop(GBB_EVENT_PLAYER(player));
+
+    return player->notify_source == source ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static GSourceFuncs replay_notify_funcs = {
+    NULL, NULL, replay_notify_dispatch, NULL
+};
+
+/* Sleeps until the monotonic time @deadline (microseconds, the
+ * same clock as g_get_monotonic_time()); FALSE if woken up to stop */
+static gboolean
+replay_wait(GbbEvdevPlayer *player,
+            gint64          deadline)
+{
+    struct itimerspec spec = { { 0, 0 }, { 0, 0 } };
+    struct pollfd fds[2];
+    guint64 expirations;
+    int rc;
+
+    spec.it_value.tv_sec = deadline / G_USEC_PER_SEC;
+    spec.it_value.tv_nsec = (deadline % G_USEC_PER_SEC) * 1000;
+    if (timerfd_settime(player->timer_fd, TFD_TIMER_ABSTIME, &spec, NULL) < 0)
+        die_errno("Can't arm replay timer");
+
+    fds[0].fd = player->timer_fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = player->wake_fd;
+    fds[1].events = POLLIN;
+
+    do {
+        rc = poll(fds, 2, -1);
+    } while (rc < 0 && errno == EINTR);
+
+    if (rc < 0)
+        die_errno("Can't wait for replay timer");
+
+    if (fds[1].revents)
         return FALSE;
-    }
 
-    if (strcmp (event->name, "KeyPress") == 0) {
-        write_event(player->uidev_keyboard, EV_KEY, event->detail, 1);
-        write_event(player->uidev_keyboard, EV_SYN, SYN_REPORT, 0);
-    } else if (strcmp (event->name, "KeyRelease") == 0) {
-        write_event(player->uidev_keyboard, EV_KEY, event->detail, 0);
-        write_event(player->uidev_keyboard, EV_SYN, SYN_REPORT, 0);
-    } else if (strcmp (event->name, "ButtonPress") == 0) {
-        int button = event->detail == 1 ? BTN_LEFT : (event->detail == 2 ? BTN_MIDDLE : BTN_RIGHT);
-
-        write_event(player->uidev_mouse, EV_KEY, button, 1);
-        write_event(player->uidev_mouse, EV_SYN, SYN_REPORT, 0);
-    } else if (strcmp (event->name, "ButtonRelease") == 0) {
-        int button = event->detail == 1 ? BTN_LEFT : (event->detail == 2 ? BTN_MIDDLE : BTN_RIGHT);
-
-        write_event(player->uidev_mouse, EV_KEY, button, 0);
-        write_event(player->uidev_mouse, EV_SYN, SYN_REPORT, 0);
-    } else if (strcmp (event->name, "Wheel") == 0) {
-        write_event(player->uidev_mouse, EV_REL, REL_WHEEL, event->detail);
-        write_event(player->uidev_mouse, EV_SYN, SYN_REPORT, 0);
-    } else if (strcmp (event->name, "MotionNotify") == 0) {
-        write_event(player->uidev_mouse, EV_ABS, ABS_X, event->x_root);
-        write_event(player->uidev_mouse, EV_ABS, ABS_Y, event->y_root);
-        write_event(player->uidev_mouse, EV_SYN, SYN_REPORT, 0);
-    }
+    if (read(player->timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+        die_errno("Can't read replay timer");
+
+    return TRUE;
+}
+
+static gpointer
+replay_thread(gpointer data)
+{
+    GbbEvdevPlayer *player = data;
+    gint64 iteration_start = player->start_time;
+    guint duration;
+    guint i;
+
+    prctl(PR_SET_TIMERSLACK, REPLAY_TIMER_SLACK_NS, 0, 0, 0);
+
+    duration = g_array_index(player->frames, EvdevFrame, player->frames->len - 1).time;
+
+    while (TRUE) {
+        gint64 lateness = 0;
+
+        for (i = 0; i < player->frames->len; i++) {
+            const EvdevFrame *frame = &g_array_index(player->frames, EvdevFrame, i);
+            gint64 deadline = iteration_start + 1000 * (gint64)frame->time;
+
+            if (deadline > g_get_monotonic_time() && !replay_wait(player, deadline))
+                return NULL;
+            if (g_atomic_int_get(&player->stopping))
+                return NULL;
+
+            lateness = g_get_monotonic_time() - deadline;
+            write_frame(player, frame);
+            g_atomic_int_set(&player->position, i + 1);
+
+            gbb_replay_timing_add_event(&player->timing, lateness);
+        }
+
+        gbb_replay_timing_add_iteration(&player->timing, lateness);
+
+        g_atomic_int_inc(&player->iteration);
+        if (player->loops != 0 && (guint)g_atomic_int_get(&player->iteration) >= player->loops)
+            break;
 
-    gbb_event_free(event);
+        g_atomic_int_set(&player->position, 0);
+        g_atomic_int_inc(&player->pending_iterations);
+        g_source_set_ready_time(player->notify_source, 0);
 
-    queue_event(player);
+        /* Wrap to where this iteration was scheduled to end, not to
+         * when it did, so that lateness doesn't carry over */
+        iteration_start += 1000 * (gint64)MAX(duration, 1);
+    }
+
+    /* Joining the thread and emitting ::finished happens back
+     * in the context that started playback */
+    g_atomic_int_set(&player->done, TRUE);
+    g_source_set_ready_time(player->notify_source, 0);
 
-    return FALSE;
+    return NULL;
 }
 
 static void
-queue_event(GbbEvdevPlayer *player)
+replay_thread_stop(GbbEvdevPlayer *player)
 {
-    GError *error = NULL;
+    guint64 value = 1;
 
-    g_return_if_fail(player->next_event == NULL);
+    if (!player->thread)
+        return;
 
-    player->next_event = gbb_event_read(player->input,
-                                        NULL, &error);
-    if (error)
-        die("Error reading event log: %s\n", error->message);
+    g_atomic_int_set(&player->stopping, TRUE);
+    if (write(player->wake_fd, &value, sizeof(value)) < 0)
+        die_errno("Can't wake replay thread");
 
-    gint64 remaining;
-    if (player->next_event) {
-        gint64 now = g_get_monotonic_time();
-        gint64 next_event_time = player->start_time + 1000 * player->next_event->time;
-        remaining = (next_event_time - now) / 1000;
-    } else {
-        remaining = 0;
-    }
+    g_thread_join(player->thread);
+    player->thread = NULL;
 
-    player->next_event_timeout = g_timeout_add(remaining > 0 ? remaining : 0,
-                                               next_event_timeout,
-                                               player);
+    if (read(player->wake_fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+        die_errno("Can't read replay wakeup");
+    g_atomic_int_set(&player->stopping, FALSE);
+
+    g_source_destroy(player->notify_source);
+    g_clear_pointer(&player->notify_source, g_source_unref);
+
+    gbb_event_player_add_replay_timing(GBB_EVENT_PLAYER(player), &player->timing);
 }
 
 static void
@@ -133,16 +318,23 @@ gbb_evdev_player_finalize(GObject *object)
 {
     GbbEvdevPlayer *player = GBB_EVDEV_PLAYER(object);
 
-    if (player->uinput_fd_keyboard >= 0)
-        close(player->uinput_fd_keyboard);
+    replay_thread_stop(player);
+    if (player->timer_fd >= 0)
+        close(player->timer_fd);
+    if (player->wake_fd >= 0)
+        close(player->wake_fd);
+
     if (player->uidev_keyboard)
         libevdev_uinput_destroy(player->uidev_keyboard);
-    if (player->uinput_fd_mouse >= 0)
+    if (player->uinput_fd_keyboard >= 0)
         close(player->uinput_fd_keyboard);
     if (player->uidev_mouse)
         libevdev_uinput_destroy(player->uidev_mouse);
+    if (player->uinput_fd_mouse >= 0)
+        close(player->uinput_fd_mouse);
 
-    g_clear_object(&player->input);
+    g_clear_pointer(&player->frames, g_array_unref);
+    g_hash_table_destroy(player->logs);
 
     if (player->ready_timeout) {
         g_source_remove(player->ready_timeout);
@@ -154,37 +346,112 @@ gbb_evdev_player_finalize(GObject *object)
 
 
 static void
-gbb_evdev_player_play_fd(GbbEventPlayer *event_player,
+gbb_evdev_player_load_fd(GbbEventPlayer *event_player,
+                         const char     *name,
                          int             fd)
 {
     GbbEvdevPlayer *player = GBB_EVDEV_PLAYER(event_player);
-    GInputStream *input_raw;
+    GError *error = NULL;
+    GbbEventLog *log;
+    GbbEvent event;
+    GArray *frames;
 
-    input_raw = g_unix_input_stream_new (fd, TRUE);
-    player->input = g_data_input_stream_new (input_raw);
-    g_object_unref(input_raw);
+    log = gbb_event_log_new_from_fd(fd, &error);
+    if (!log)
+        die("Error reading event log: %s\n", error->message);
 
-    player->start_time = g_get_monotonic_time ();
-    queue_event(player);
+    /* Decode the whole log up front so nothing is parsed while playing */
+    frames = g_array_new(FALSE, FALSE, sizeof(EvdevFrame));
+    while (gbb_event_log_next(log, &event, &error)) {
+        EvdevFrame frame;
+
+        decode_event(&event, &frame);
+        g_array_append_val(frames, frame);
+    }
+    gbb_event_log_free(log);
+
+    if (error)
+        die("Error reading event log: %s\n", error->message);
+
+    g_hash_table_replace(player->logs, g_strdup(name), frames);
+}
+
+gboolean
+gbb_evdev_player_has_log(GbbEvdevPlayer *player,
+                         const char     *name)
+{
+    return g_hash_table_contains(player->logs, name);
 }
 
 static void
-gbb_evdev_player_stop(GbbEventPlayer *event_player)
+gbb_evdev_player_start(GbbEventPlayer *event_player,
+                       const char     *name,
+                       guint           loops)
 {
     GbbEvdevPlayer *player = GBB_EVDEV_PLAYER(event_player);
-    GError *error = NULL;
+    GArray *frames = g_hash_table_lookup(player->logs, name);
 
-    g_clear_pointer(&player->next_event, gbb_event_free);
+    if (player->thread != NULL) {
+        g_critical("Player is already playing");
+        return;
+    }
 
-    if (player->next_event_timeout) {
-        g_source_remove(player->next_event_timeout);
-        player->next_event_timeout = 0;
+    if (frames == NULL) {
+        g_critical("No event log '%s' has been loaded", name);
+        return;
     }
 
-    if (!g_input_stream_close(G_INPUT_STREAM(player->input), NULL, &error))
-        die("Error closing input: %s\n", error->message);
+    if (player->timer_fd < 0) {
+        player->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (player->timer_fd < 0)
+            die_errno("Can't create replay timer");
+    }
+    if (player->wake_fd < 0) {
+        player->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (player->wake_fd < 0)
+            die_errno("Can't create replay wakeup");
+    }
+
+    if (frames->len == 0) {
+        /* Nothing to play, let alone loop over */
+        gbb_event_player_finished(GBB_EVENT_PLAYER(player));
+        return;
+    }
+
+    player->frames = g_array_ref(frames);
+    player->loops = loops;
+    player->iteration = 0;
+    player->position = 0;
+    player->pending_iterations = 0;
+    player->done = FALSE;
+    gbb_replay_timing_reset(&player->timing);
+
+    player->notify_source = g_source_new(&replay_notify_funcs, sizeof(NotifySource));
+    ((NotifySource *)player->notify_source)->player = player;
+    g_source_attach(player->notify_source, g_main_context_get_thread_default());
+
+    player->start_time = g_get_monotonic_time ();
+    player->thread = g_thread_new("gbb-replay", replay_thread, player);
+}
+
+static void
+gbb_evdev_player_get_position(GbbEventPlayer *event_player,
+                              guint          *iteration,
+                              guint          *event)
+{
+    GbbEvdevPlayer *player = GBB_EVDEV_PLAYER(event_player);
+
+    *iteration = g_atomic_int_get(&player->iteration);
+    *event = g_atomic_int_get(&player->position);
+}
+
+static void
+gbb_evdev_player_stop(GbbEventPlayer *event_player)
+{
+    GbbEvdevPlayer *player = GBB_EVDEV_PLAYER(event_player);
 
-    g_clear_object(&player->input);
+    replay_thread_stop(player);
+    g_clear_pointer(&player->frames, g_array_unref);
 
     gbb_event_player_finished(GBB_EVENT_PLAYER(player));
 }
@@ -194,6 +461,10 @@ gbb_evdev_player_init(GbbEvdevPlayer *player)
 {
     player->uinput_fd_keyboard = -1;
     player->uinput_fd_mouse = -1;
+    player->timer_fd = -1;
+    player->wake_fd = -1;
+    player->logs = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                         g_free, (GDestroyNotify)g_array_unref);
 }
 
 static void
@@ -203,7 +474,9 @@ gbb_evdev_player_class_init(GbbEvdevPlayerClass *player_class)
     gobject_class->finalize = gbb_evdev_player_finalize;
 
     GbbEventPlayerClass *event_player_class = GBB_EVENT_PLAYER_CLASS (player_class);
-    event_player_class->play_fd = gbb_evdev_player_play_fd;
+    event_player_class->load_fd = gbb_evdev_player_load_fd;
+    event_player_class->start = gbb_evdev_player_start;
+    event_player_class->get_position = gbb_evdev_player_get_position;
     event_player_class->stop = gbb_evdev_player_stop;
 }
 
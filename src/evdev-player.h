@@ -15,6 +15,9 @@ typedef struct _GbbEvdevPlayer GbbEvdevPlayer;
 GbbEvdevPlayer *gbb_evdev_player_new(const char *name,
                                      GError    **error);
 
+gboolean gbb_evdev_player_has_log(GbbEvdevPlayer *player,
+                                  const char     *name);
+
 GType gbb_evdev_player_get_type(void);
 
 #endif /* __EVDEV_PLAYER_H__*/
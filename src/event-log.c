@@ -1,78 +1,411 @@
 /* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
 
+#include "config.h"
+
+#include <errno.h>
 #include <stdio.h>
-#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <gio/gunixinputstream.h>
+
 #include "event-log.h"
 
+/* Compiled logs are a header followed by an array of fixed size
+ * records; they are only ever read on the machine that wrote them,
+ * so everything is in host byte order. */
+#define COMPILED_MAGIC "GBBEVLOG"
+#define COMPILED_VERSION 1
+#define COMPILED_SUFFIX ".compiled"
+
+typedef struct {
+    char    magic[8];
+    guint32 version;
+    guint32 n_events;
+    guint32 duration;     /* ms */
+    guint32 devices;      /* GbbEventDevices */
+    gint64  source_mtime; /* us */
+    guint64 source_size;
+} CompiledHeader;
+
+typedef struct {
+    guint32 time;
+    guint32 type;
+    gint32  x_root;
+    gint32  y_root;
+    gint32  detail;
+} CompiledEvent;
+
+struct _GbbEventLog {
+    GBytes *bytes;
+    const char *data;
+    const char *end;
+
+    /* Set for compiled logs */
+    const CompiledHeader *header;
+    const CompiledEvent *events;
+    guint index;
+
+    const char *pos;
+    int line;
+};
+
+static const struct {
+    const char *name;
+    GbbEventType type;
+} event_types[] = {
+    { "KeyPress",      GBB_EVENT_KEY_PRESS },
+    { "KeyRelease",    GBB_EVENT_KEY_RELEASE },
+    { "ButtonPress",   GBB_EVENT_BUTTON_PRESS },
+    { "ButtonRelease", GBB_EVENT_BUTTON_RELEASE },
+    { "Wheel",         GBB_EVENT_WHEEL },
+    { "MotionNotify",  GBB_EVENT_MOTION_NOTIFY },
+};
+
+const char *
+gbb_event_type_to_string(GbbEventType type)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(event_types); i++)
+        if (event_types[i].type == type)
+            return event_types[i].name;
+
+    return "Unknown";
+}
+
+static GbbEventType
+event_type_from_token(const char *token,
+                      gsize       len)
+{
+    guint i;
+
+    for (i = 0; i < G_N_ELEMENTS(event_types); i++)
+        if (strlen(event_types[i].name) == len &&
+            memcmp(event_types[i].name, token, len) == 0)
+            return event_types[i].type;
+
+    return GBB_EVENT_UNKNOWN;
+}
+
+static GbbEventLog *
+event_log_new_from_bytes(GBytes *bytes)
+{
+    GbbEventLog *log = g_slice_new0(GbbEventLog);
+    gsize size;
+
+    log->bytes = bytes;
+    log->data = g_bytes_get_data(bytes, &size);
+    log->end = log->data + size;
+
+    if (size >= sizeof(CompiledHeader) &&
+        memcmp(log->data, COMPILED_MAGIC, sizeof(log->header->magic)) == 0) {
+        const CompiledHeader *header = (const CompiledHeader *)log->data;
+
+        /* Anything that doesn't look right is parsed as text and
+         * will produce an error there */
+        if (header->version == COMPILED_VERSION &&
+            size == sizeof(CompiledHeader) + (gsize)header->n_events * sizeof(CompiledEvent)) {
+            log->header = header;
+            log->events = (const CompiledEvent *)(log->data + sizeof(CompiledHeader));
+        }
+    }
+
+    gbb_event_log_rewind(log);
+
+    return log;
+}
+
+GbbEventLog *
+gbb_event_log_new_from_fd(int      fd,
+                          GError **error)
+{
+    GMappedFile *mapped;
+    GBytes *bytes;
+
+    mapped = g_mapped_file_new_from_fd(fd, FALSE, NULL);
+    if (mapped) {
+        bytes = g_mapped_file_get_bytes(mapped);
+        g_mapped_file_unref(mapped);
+        close(fd);
+    } else {
+        /* Not something we can map (a pipe, say); read it in */
+        GInputStream *input = g_unix_input_stream_new(fd, TRUE);
+        GOutputStream *output = g_memory_output_stream_new_resizable();
+        gssize size;
+
+        size = g_output_stream_splice(output, input,
+                                      G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                                      G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                                      NULL, error);
+        if (size >= 0)
+            bytes = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(output));
+        else
+            bytes = NULL;
+
+        g_object_unref(output);
+        g_object_unref(input);
+
+        if (bytes == NULL)
+            return NULL;
+    }
+
+    return event_log_new_from_bytes(bytes);
+}
+
+GbbEventLog *
+gbb_event_log_new_from_file(GFile         *file,
+                            GCancellable  *cancellable,
+                            GError       **error)
+{
+    char *path = g_file_get_path(file);
+    char *contents;
+    gsize length;
+
+    if (path) {
+        GMappedFile *mapped = g_mapped_file_new(path, FALSE, error);
+        g_free(path);
+        if (!mapped)
+            return NULL;
+
+        GBytes *bytes = g_mapped_file_get_bytes(mapped);
+        g_mapped_file_unref(mapped);
+
+        return event_log_new_from_bytes(bytes);
+    }
+
+    if (!g_file_load_contents(file, cancellable, &contents, &length, NULL, error))
+        return NULL;
+
+    return event_log_new_from_bytes(g_bytes_new_take(contents, length));
+}
+
 void
-gbb_event_free(GbbEvent *event)
+gbb_event_log_free(GbbEventLog *log)
+{
+    g_bytes_unref(log->bytes);
+    g_slice_free(GbbEventLog, log);
+}
+
+void
+gbb_event_log_rewind(GbbEventLog *log)
+{
+    log->pos = log->data;
+    log->line = 0;
+    log->index = 0;
+}
+
+static const char *
+skip_blanks(const char *p,
+            const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+
+    return p;
+}
+
+static gboolean
+parse_int(const char **p,
+          const char  *end,
+          gint64      *value)
 {
-    g_free(event->name);
-    g_slice_free(GbbEvent, event);
+    const char *q = skip_blanks(*p, end);
+    gboolean negative = FALSE;
+    gint64 v = 0;
+
+    if (q < end && (*q == '-' || *q == '+')) {
+        negative = *q == '-';
+        q++;
+    }
+
+    if (q == end || !g_ascii_isdigit(*q))
+        return FALSE;
+
+    while (q < end && g_ascii_isdigit(*q)) {
+        v = 10 * v + (*q - '0');
+        if (v > G_MAXINT)
+            return FALSE;
+        q++;
+    }
+
+    *value = negative ? -v : v;
+    *p = skip_blanks(q, end);
+
+    return TRUE;
 }
 
-GbbEvent *
-gbb_event_read (GDataInputStream *input_stream,
-                GCancellable     *cancellable,
-                GError          **error)
+/* Returns TRUE and fills event if there was an event on the line,
+ * FALSE on blank and comment lines and on error */
+static gboolean
+parse_line(const char  *line,
+           const char  *end,
+           GbbEvent    *event,
+           int          line_number,
+           GError     **error)
 {
-    GbbEvent *event = NULL;
-    gboolean have_error = FALSE;
+    const char *p = skip_blanks(line, end);
+    const char *name;
+    gint64 fields[4];
+    int i;
+
+    if (p == end)
+        return FALSE;
+
+    name = p;
+    while (p < end && *p != ',' && *p != ' ' && *p != '\t')
+        p++;
+    event->type = event_type_from_token(name, p - name);
+    p = skip_blanks(p, end);
+
+    for (i = 0; i < 4; i++) {
+        if (p == end || *p != ',')
+            goto bad_line;
+        p++;
+        if (!parse_int(&p, end, &fields[i]))
+            goto bad_line;
+    }
 
-    while (event == NULL && !have_error) {
+    if (p != end || fields[0] < 0)
+        goto bad_line;
+
+    event->time = fields[0];
+    event->x_root = fields[1];
+    event->y_root = fields[2];
+    event->detail = fields[3];
+
+    return TRUE;
+
+bad_line:
+    g_set_error(error,
+                G_IO_ERROR,
+                G_IO_ERROR_FAILED,
+                "Bad event on line %d: '%.*s'", line_number, (int)(end - line), line);
+    return FALSE;
+}
+
+gboolean
+gbb_event_log_next(GbbEventLog *log,
+                   GbbEvent    *event,
+                   GError     **error)
+{
+    if (log->header) {
+        const CompiledEvent *compiled;
+
+        if (log->index == log->header->n_events)
+            return FALSE;
+
+        compiled = &log->events[log->index++];
+        event->type = compiled->type;
+        event->time = compiled->time;
+        event->x_root = compiled->x_root;
+        event->y_root = compiled->y_root;
+        event->detail = compiled->detail;
+
+        return TRUE;
+    }
+
+    while (log->pos < log->end) {
+        const char *line = log->pos;
+        const char *newline = memchr(line, '\n', log->end - line);
+        const char *line_end = newline ? newline : log->end;
+        const char *hash = memchr(line, '#', line_end - line);
         GError *local_error = NULL;
-        char **fields = NULL;
 
-        char *line = g_data_input_stream_read_line (input_stream, NULL, NULL, &local_error);
+        log->pos = newline ? newline + 1 : log->end;
+        log->line++;
+
+        if (parse_line(line, hash ? hash : line_end, event, log->line, &local_error))
+            return TRUE;
+
         if (local_error) {
             g_propagate_error(error, local_error);
-            have_error = TRUE;
-            goto next;
+            return FALSE;
         }
+    }
 
-        if (!line)
-            return NULL;
+    return FALSE;
+}
 
-        char *hash = index(line, '#');
-        if (hash)
-            *hash = '\0';
-        g_strstrip(line);
-
-        fields = g_strsplit (line, ",", -1);
-
-        if (!*line)
-            goto next;
-        if (g_strv_length (fields) != 5) {
-            g_set_error(error,
-                        G_IO_ERROR,
-                        G_IO_ERROR_FAILED,
-                        "Bad field count in '%s'", line);
-            have_error = TRUE;
-            goto next;
-        }
+static gboolean
+event_log_scan(GbbEventLog     *log,
+               guint           *n_events,
+               int             *duration,
+               GbbEventDevices *devices,
+               GError         **error)
+{
+    GError *local_error = NULL;
+    GbbEvent event;
+
+    *n_events = 0;
+    *duration = 0;
+    *devices = 0;
 
-        event = g_slice_new(GbbEvent);
+    gbb_event_log_rewind(log);
 
-        event->name = g_strdup(fields[0]);
-        sscanf(fields[1], "%u", &event->time);
-        event->x_root = atoi(fields[2]);
-        event->y_root = atoi(fields[3]);
-        event->detail = atoi(fields[4]);
+    while (gbb_event_log_next(log, &event, &local_error)) {
+        *n_events += 1;
+        *duration = MAX(*duration, (int)event.time);
 
-    next:
-        if (fields)
-            g_strfreev(fields);
-        g_free(line);
+        switch (event.type) {
+        case GBB_EVENT_KEY_PRESS:
+        case GBB_EVENT_KEY_RELEASE:
+            *devices |= GBB_EVENT_DEVICE_KEYBOARD;
+            break;
+        case GBB_EVENT_BUTTON_PRESS:
+        case GBB_EVENT_BUTTON_RELEASE:
+        case GBB_EVENT_WHEEL:
+        case GBB_EVENT_MOTION_NOTIFY:
+            *devices |= GBB_EVENT_DEVICE_MOUSE;
+            break;
+        case GBB_EVENT_UNKNOWN:
+            break;
+        }
     }
 
-    if (have_error) {
-        if (event)
-            gbb_event_free(event);
-        return NULL;
-    } else {
-        return event;
+    gbb_event_log_rewind(log);
+
+    if (local_error) {
+        g_propagate_error(error, local_error);
+        return FALSE;
     }
+
+    return TRUE;
+}
+
+int
+gbb_event_log_get_duration(GbbEventLog *log,
+                           GError     **error)
+{
+    GbbEventDevices devices;
+    guint n_events;
+    int duration;
+
+    if (log->header)
+        return log->header->duration;
+
+    if (!event_log_scan(log, &n_events, &duration, &devices, error))
+        return -1;
+
+    return duration;
+}
+
+GbbEventDevices
+gbb_event_log_get_devices(GbbEventLog *log,
+                          GError     **error)
+{
+    GbbEventDevices devices;
+    guint n_events;
+    int duration;
+
+    if (log->header)
+        return log->header->devices;
+
+    if (!event_log_scan(log, &n_events, &duration, &devices, error))
+        return 0;
+
+    return devices;
 }
 
 int
@@ -80,30 +413,183 @@ gbb_event_log_duration (GFile        *event_log,
                         GCancellable *cancellable,
                         GError      **error)
 {
-    GFileInputStream *input_raw = g_file_read(event_log, cancellable, error);
-    GDataInputStream *input = g_data_input_stream_new (G_INPUT_STREAM (input_raw));
-    g_object_unref(input_raw);
-    int duration = 0;
+    GbbEventLog *log = NULL;
+    char *path = g_file_get_path(event_log);
+    int duration;
 
-    while (TRUE) {
-        GError *local_error = NULL;
-        GbbEvent *event = gbb_event_read(input, cancellable, &local_error);
-        if (local_error) {
-            g_propagate_error(error, local_error);
-            duration = -1;
+    /* The compiled log has the duration in its header */
+    if (path) {
+        char *compiled = gbb_event_log_compile(path, NULL);
+        if (compiled) {
+            GFile *compiled_file = g_file_new_for_path(compiled);
+            log = gbb_event_log_new_from_file(compiled_file, cancellable, NULL);
+            g_object_unref(compiled_file);
+            g_free(compiled);
         }
+        g_free(path);
+    }
 
-        if (!event)
-            break;
+    if (!log)
+        log = gbb_event_log_new_from_file(event_log, cancellable, error);
+    if (!log)
+        return -1;
+
+    duration = gbb_event_log_get_duration(log, error);
+    gbb_event_log_free(log);
 
-        duration = MAX(duration, event->time);
+    return duration;
+}
+
+/* ************************************************************************** */
+
+static char *
+compiled_cache_path(const char *filename)
+{
+    char *absolute;
+    char *checksum;
+    char *basename;
+    char *path;
 
-        gbb_event_free(event);
+    if (g_path_is_absolute(filename)) {
+        absolute = g_strdup(filename);
+    } else {
+        char *cwd = g_get_current_dir();
+        absolute = g_build_filename(cwd, filename, NULL);
+        g_free(cwd);
     }
 
-    g_input_stream_close(G_INPUT_STREAM(input), cancellable,
-                         !(error && *error) ? error : NULL);
-    g_object_unref(input);
+    checksum = g_compute_checksum_for_string(G_CHECKSUM_SHA1, absolute, -1);
+    basename = g_strconcat(checksum, COMPILED_SUFFIX, NULL);
+    path = g_build_filename(g_get_user_cache_dir(), PACKAGE_NAME, "event-logs", basename, NULL);
 
-    return duration;
+    g_free(basename);
+    g_free(checksum);
+    g_free(absolute);
+
+    return path;
+}
+
+static gboolean
+compiled_is_current(const char        *path,
+                    const struct stat *source)
+{
+    CompiledHeader header;
+    gboolean current = FALSE;
+    FILE *f;
+
+    f = fopen(path, "rb");
+    if (!f)
+        return FALSE;
+
+    if (fread(&header, sizeof(header), 1, f) == 1)
+        current = (memcmp(header.magic, COMPILED_MAGIC, sizeof(header.magic)) == 0 &&
+                   header.version == COMPILED_VERSION &&
+                   header.source_mtime == source->st_mtim.tv_sec * G_USEC_PER_SEC + source->st_mtim.tv_nsec / 1000 &&
+                   header.source_size == (guint64)source->st_size);
+
+    fclose(f);
+
+    return current;
+}
+
+static GByteArray *
+compile_log(const char        *filename,
+            const struct stat *source,
+            GError           **error)
+{
+    GFile *file = g_file_new_for_path(filename);
+    GbbEventLog *log = gbb_event_log_new_from_file(file, NULL, error);
+    CompiledHeader header = { { 0, }, };
+    GbbEventDevices devices;
+    GByteArray *compiled;
+    GbbEvent event;
+    guint n_events;
+    int duration;
+
+    g_object_unref(file);
+    if (!log)
+        return NULL;
+
+    if (log->header) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s is already compiled", filename);
+        gbb_event_log_free(log);
+        return NULL;
+    }
+
+    if (!event_log_scan(log, &n_events, &duration, &devices, error)) {
+        gbb_event_log_free(log);
+        return NULL;
+    }
+
+    memcpy(header.magic, COMPILED_MAGIC, sizeof(header.magic));
+    header.version = COMPILED_VERSION;
+    header.n_events = n_events;
+    header.duration = duration;
+    header.devices = devices;
+    header.source_mtime = source->st_mtim.tv_sec * G_USEC_PER_SEC + source->st_mtim.tv_nsec / 1000;
+    header.source_size = source->st_size;
+
+    compiled = g_byte_array_sized_new(sizeof(header) + n_events * sizeof(CompiledEvent));
+    g_byte_array_append(compiled, (const guint8 *)&header, sizeof(header));
+
+    while (gbb_event_log_next(log, &event, NULL)) {
+        CompiledEvent record;
+
+        record.time = event.time;
+        record.type = event.type;
+        record.x_root = event.x_root;
+        record.y_root = event.y_root;
+        record.detail = event.detail;
+
+        g_byte_array_append(compiled, (const guint8 *)&record, sizeof(record));
+    }
+
+    gbb_event_log_free(log);
+
+    return compiled;
+}
+
+char *
+gbb_event_log_compile(const char *filename,
+                      GError    **error)
+{
+    GByteArray *compiled;
+    struct stat source;
+    char *path;
+    char *dirname;
+    char *result = NULL;
+
+    if (stat(filename, &source) != 0) {
+        int errsv = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+                    "Can't stat %s: %s", filename, g_strerror(errsv));
+        return NULL;
+    }
+
+    /* Never next to the log: that's the source tree, or files the
+     * package manager doesn't know about */
+    path = compiled_cache_path(filename);
+    if (compiled_is_current(path, &source))
+        return path;
+
+    compiled = compile_log(filename, &source, error);
+    if (!compiled)
+        goto out;
+
+    dirname = g_path_get_dirname(path);
+    if (g_mkdir_with_parents(dirname, 0755) != 0) {
+        int errsv = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+                    "Can't create %s: %s", dirname, g_strerror(errsv));
+    } else if (g_file_set_contents(path, (const char *)compiled->data, compiled->len, error)) {
+        result = g_strdup(path);
+    }
+    g_free(dirname);
+    g_byte_array_unref(compiled);
+
+out:
+    g_free(path);
+
+    return result;
 }
@@ -3,22 +3,63 @@
 
 #include <gio/gio.h>
 
+typedef enum {
+    GBB_EVENT_UNKNOWN,
+    GBB_EVENT_KEY_PRESS,
+    GBB_EVENT_KEY_RELEASE,
+    GBB_EVENT_BUTTON_PRESS,
+    GBB_EVENT_BUTTON_RELEASE,
+    GBB_EVENT_WHEEL,
+    GBB_EVENT_MOTION_NOTIFY
+} GbbEventType;
+
 typedef struct {
-    char *name;
+    GbbEventType type;
     unsigned time;
     int x_root, y_root;
     int detail;
 } GbbEvent;
 
-void gbb_event_free(GbbEvent *event);
+typedef enum {
+    GBB_EVENT_DEVICE_KEYBOARD = 1 << 0,
+    GBB_EVENT_DEVICE_MOUSE    = 1 << 1
+} GbbEventDevices;
+
+const char  *gbb_event_type_to_string (GbbEventType type);
+
+/* An event log loaded into memory (mapped when possible); events are
+ * parsed in place as they are read, without allocating. Both the text
+ * format written by 'gbb record' and the compiled format written by
+ * gbb_event_log_compile() are accepted.
+ */
+typedef struct _GbbEventLog GbbEventLog;
+
+GbbEventLog *gbb_event_log_new_from_fd   (int            fd,
+                                          GError       **error);
+GbbEventLog *gbb_event_log_new_from_file (GFile         *file,
+                                          GCancellable  *cancellable,
+                                          GError       **error);
+void         gbb_event_log_free          (GbbEventLog   *log);
 
-GbbEvent *gbb_event_read (GDataInputStream *input_stream,
-                          GCancellable     *cancellable,
-                          GError          **error);
+gboolean     gbb_event_log_next          (GbbEventLog   *log,
+                                          GbbEvent      *event,
+                                          GError       **error);
+void         gbb_event_log_rewind        (GbbEventLog   *log);
+
+/* For compiled logs these come from the header, otherwise the whole
+ * log is scanned */
+int             gbb_event_log_get_duration  (GbbEventLog *log,
+                                             GError     **error);
+GbbEventDevices gbb_event_log_get_devices   (GbbEventLog *log,
+                                             GError     **error);
+
+/* Returns the path of an up-to-date compiled version of the text log
+ * at filename, writing it into the user's cache directory if needed. */
+char *gbb_event_log_compile (const char *filename,
+                             GError    **error);
 
 int gbb_event_log_duration (GFile        *event_log,
                             GCancellable *cancellable,
                             GError      **error);
 
 #endif /* __EVENT_H__ */
-
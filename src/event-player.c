@@ -10,11 +10,13 @@
 #include <libevdev/libevdev.h>
 #include <libevdev/libevdev-uinput.h>
 
+#include "event-log.h"
 #include "event-player.h"
 #include "util.h"
 
 enum {
     READY,
+    ITERATION,
     FINISHED,
     LAST_SIGNAL
 };
@@ -53,6 +55,13 @@ gbb_event_player_class_init(GbbEventPlayerClass *player_class)
                       0,
                       NULL, NULL, NULL,
                       G_TYPE_NONE, 0);
+    signals[ITERATION] =
+        g_signal_new ("iteration",
+                      GBB_TYPE_EVENT_PLAYER,
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL, NULL, NULL,
+                      G_TYPE_NONE, 0);
     signals[FINISHED] =
         g_signal_new ("finished",
                       GBB_TYPE_EVENT_PLAYER,
@@ -62,6 +71,18 @@ gbb_event_player_class_init(GbbEventPlayerClass *player_class)
                       G_TYPE_NONE, 0);
 }
 
+const GbbReplayTiming *
+gbb_event_player_get_replay_timing(GbbEventPlayer *player)
+{
+    return &player->timing;
+}
+
+void
+gbb_event_player_reset_replay_timing(GbbEventPlayer *player)
+{
+    gbb_replay_timing_reset(&player->timing);
+}
+
 gboolean
 gbb_event_player_is_ready(GbbEventPlayer *player)
 {
@@ -80,22 +101,88 @@ gbb_event_player_get_mouse_device_node(GbbEventPlayer *player)
     return player->mouse_device_node;
 }
 
+/* Logs are loaded under a name ahead of time, and then can be
+ * started any number of times without sending or parsing them again */
+void
+gbb_event_player_load_fd(GbbEventPlayer *player,
+                         const char     *name,
+                         int             fd)
+{
+    GBB_EVENT_PLAYER_GET_CLASS(player)->load_fd(player, name, fd);
+}
+
+/* Plays the log loaded as @name @loops times, or until stopped if
+ * @loops is 0. Each time the log wraps around to the beginning
+ * ::iteration is emitted, and ::finished at the end. */
+void
+gbb_event_player_start(GbbEventPlayer *player,
+                       const char     *name,
+                       guint           loops)
+{
+    GBB_EVENT_PLAYER_GET_CLASS(player)->start(player, name, loops);
+}
+
+/* Completed iterations, and events played within the current one */
+void
+gbb_event_player_get_position(GbbEventPlayer *player,
+                              guint          *iteration,
+                              guint          *event)
+{
+    GBB_EVENT_PLAYER_GET_CLASS(player)->get_position(player, iteration, event);
+}
+
 void
 gbb_event_player_play_fd(GbbEventPlayer *player,
                          int             fd)
 {
-    GBB_EVENT_PLAYER_GET_CLASS(player)->play_fd(player, fd);
+    gbb_event_player_load_fd(player, "", fd);
+    gbb_event_player_start(player, "", 1);
+}
+
+static int
+open_log(const char *filename)
+{
+    /* Play the compiled log when we can, so the player doesn't
+     * have to parse anything; the text is always a fallback */
+    char *compiled = gbb_event_log_compile(filename, NULL);
+    int fd = open(compiled ? compiled : filename, O_RDONLY);
+    if (fd == -1)
+        die_errno("Can't open '%s'", compiled ? compiled : filename);
+    g_free(compiled);
+
+    return fd;
+}
+
+void
+gbb_event_player_load_file(GbbEventPlayer *player,
+                           const char     *name,
+                           const char     *filename)
+{
+    gbb_event_player_load_fd(player, name, open_log(filename));
 }
 
 void
 gbb_event_player_play_file(GbbEventPlayer *player,
                            const char     *filename)
 {
-    int fd = open(filename, O_RDONLY);
-    if (fd == -1)
-        die_errno("Can't open '%s'", filename);
+    gbb_event_player_play_fd(player, open_log(filename));
+}
 
-    gbb_event_player_play_fd(player, fd);
+/* Like play_fd(), but when the log runs out it wraps around to the
+ * beginning without a gap, emitting ::iteration, until stopped */
+void
+gbb_event_player_loop_fd(GbbEventPlayer *player,
+                         int             fd)
+{
+    gbb_event_player_load_fd(player, "", fd);
+    gbb_event_player_start(player, "", 0);
+}
+
+void
+gbb_event_player_loop_file(GbbEventPlayer *player,
+                           const char     *filename)
+{
+    gbb_event_player_loop_fd(player, open_log(filename));
 }
 
 void
@@ -116,8 +203,152 @@ gbb_event_player_set_ready(GbbEventPlayer *player,
     g_signal_emit(player, signals[READY], 0);
 }
 
+void
+gbb_event_player_iteration(GbbEventPlayer *player)
+{
+    g_signal_emit(player, signals[ITERATION], 0);
+}
+
 void
 gbb_event_player_finished(GbbEventPlayer *player)
 {
     g_signal_emit(player, signals[FINISHED], 0);
 }
+
+void
+gbb_event_player_add_replay_timing(GbbEventPlayer        *player,
+                                   const GbbReplayTiming *timing)
+{
+    gbb_replay_timing_merge(&player->timing, timing);
+}
+
+void
+gbb_replay_timing_reset(GbbReplayTiming *timing)
+{
+    memset(timing, 0, sizeof(*timing));
+}
+
+guint
+gbb_replay_timing_value_bucket(gint64 lateness)
+{
+    guint exponent;
+
+    if (lateness < 16)
+        return lateness > 0 ? lateness : 0;
+
+    exponent = g_bit_storage(lateness) - 1;
+    if (exponent > 24)
+        return GBB_REPLAY_TIMING_N_BUCKETS - 1;
+
+    return 16 + (exponent - 4) * 8 + ((lateness >> (exponent - 3)) & 7);
+}
+
+/* The smallest lateness that falls into @bucket */
+gint64
+gbb_replay_timing_bucket_value(guint bucket)
+{
+    if (bucket < 16)
+        return bucket;
+
+    return (gint64)(8 + (bucket - 16) % 8) << (1 + (bucket - 16) / 8);
+}
+
+void
+gbb_replay_timing_add_event(GbbReplayTiming *timing,
+                            gint64           lateness)
+{
+    timing->buckets[gbb_replay_timing_value_bucket(lateness)]++;
+    timing->n_events++;
+    if (lateness > GBB_REPLAY_LATE_THRESHOLD_US)
+        timing->n_late++;
+    timing->max_lateness = MAX(timing->max_lateness, lateness);
+}
+
+void
+gbb_replay_timing_add_iteration(GbbReplayTiming *timing,
+                                gint64           drift)
+{
+    timing->n_iterations++;
+    timing->total_drift += drift;
+    timing->max_drift = MAX(timing->max_drift, drift);
+}
+
+void
+gbb_replay_timing_merge(GbbReplayTiming       *timing,
+                        const GbbReplayTiming *other)
+{
+    guint i;
+
+    for (i = 0; i < GBB_REPLAY_TIMING_N_BUCKETS; i++)
+        timing->buckets[i] += other->buckets[i];
+
+    timing->n_events += other->n_events;
+    timing->n_late += other->n_late;
+    timing->max_lateness = MAX(timing->max_lateness, other->max_lateness);
+    timing->n_iterations += other->n_iterations;
+    timing->total_drift += other->total_drift;
+    timing->max_drift = MAX(timing->max_drift, other->max_drift);
+}
+
+/* Accurate to the width of a bucket, 1/8th of the value */
+gint64
+gbb_replay_timing_get_percentile(const GbbReplayTiming *timing,
+                                 double                 percentile)
+{
+    guint64 rank;
+    guint64 seen = 0;
+    guint i;
+
+    if (timing->n_events == 0)
+        return 0;
+
+    rank = MAX(1, (guint64)(0.5 + timing->n_events * percentile / 100.));
+    for (i = 0; i < GBB_REPLAY_TIMING_N_BUCKETS; i++) {
+        seen += timing->buckets[i];
+        if (seen >= rank)
+            return MIN(gbb_replay_timing_bucket_value(i), timing->max_lateness);
+    }
+
+    return timing->max_lateness;
+}
+
+GVariant *
+gbb_replay_timing_to_variant(const GbbReplayTiming *timing)
+{
+    return g_variant_new("(uuxuxx@au)",
+                         timing->n_events,
+                         timing->n_late,
+                         timing->max_lateness,
+                         timing->n_iterations,
+                         timing->total_drift,
+                         timing->max_drift,
+                         g_variant_new_fixed_array(G_VARIANT_TYPE_UINT32,
+                                                   timing->buckets,
+                                                   GBB_REPLAY_TIMING_N_BUCKETS,
+                                                   sizeof(guint32)));
+}
+
+void
+gbb_replay_timing_from_variant(GbbReplayTiming *timing,
+                               GVariant        *variant)
+{
+    GVariant *buckets;
+    const guint32 *values;
+    gsize n_values;
+
+    gbb_replay_timing_reset(timing);
+
+    g_variant_get(variant, "(uuxuxx@au)",
+                  &timing->n_events,
+                  &timing->n_late,
+                  &timing->max_lateness,
+                  &timing->n_iterations,
+                  &timing->total_drift,
+                  &timing->max_drift,
+                  &buckets);
+
+    values = g_variant_get_fixed_array(buckets, &n_values, sizeof(guint32));
+    memcpy(timing->buckets, values,
+           MIN(n_values, GBB_REPLAY_TIMING_N_BUCKETS) * sizeof(guint32));
+    g_variant_unref(buckets);
+}
@@ -6,6 +6,26 @@
 typedef struct _GbbEventPlayer      GbbEventPlayer;
 typedef struct _GbbEventPlayerClass GbbEventPlayerClass;
 
+/* Events replayed later than this count as late */
+#define GBB_REPLAY_LATE_THRESHOLD_US 10000
+
+/* Lateness buckets: exact below 16us, then 8 per power of two up to ~16s */
+#define GBB_REPLAY_TIMING_N_BUCKETS (16 + 21 * 8)
+
+/* How late replayed events fired against their scheduled times,
+ * accumulated over the logs played since the last reset. Playing
+ * a log through to its end counts as one iteration, and the
+ * lateness of its last event is the drift for that iteration. */
+typedef struct {
+    guint32 buckets[GBB_REPLAY_TIMING_N_BUCKETS];
+    guint n_events;
+    guint n_late;
+    gint64 max_lateness;
+    guint n_iterations;
+    gint64 total_drift;
+    gint64 max_drift;
+} GbbReplayTiming;
+
 #define GBB_TYPE_EVENT_PLAYER         (gbb_event_player_get_type ())
 #define GBB_EVENT_PLAYER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GBB_TYPE_EVENT_PLAYER, GbbEventPlayer))
 #define GBB_EVENT_PLAYER_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), GBB_TYPE_EVENT_PLAYER, GbbEventPlayerClass))
@@ -19,14 +39,23 @@ struct _GbbEventPlayer {
     gboolean ready;
     char *keyboard_device_node;
     char *mouse_device_node;
+
+    GbbReplayTiming timing;
 };
 
 struct _GbbEventPlayerClass {
     GObjectClass parent_class;
 
-  void (*play_fd) (GbbEventPlayer *player,
-                   int             fd);
-  void (*stop)    (GbbEventPlayer *player);
+  void (*load_fd)      (GbbEventPlayer *player,
+                        const char     *name,
+                        int             fd);
+  void (*start)        (GbbEventPlayer *player,
+                        const char     *name,
+                        guint           loops);
+  void (*stop)         (GbbEventPlayer *player);
+  void (*get_position) (GbbEventPlayer *player,
+                        guint          *iteration,
+                        guint          *event);
 };
 
 gboolean gbb_event_player_is_ready(GbbEventPlayer *player);
@@ -34,12 +63,32 @@ gboolean gbb_event_player_is_ready(GbbEventPlayer *player);
 const char *gbb_event_player_get_keyboard_device_node(GbbEventPlayer *player);
 const char *gbb_event_player_get_mouse_device_node   (GbbEventPlayer *player);
 
+void gbb_event_player_load_fd  (GbbEventPlayer *player,
+                                const char     *name,
+                                int             fd);
+void gbb_event_player_load_file(GbbEventPlayer *player,
+                                const char     *name,
+                                const char     *filename);
+void gbb_event_player_start    (GbbEventPlayer *player,
+                                const char     *name,
+                                guint           loops);
+void gbb_event_player_get_position(GbbEventPlayer *player,
+                                   guint          *iteration,
+                                   guint          *event);
+
 void gbb_event_player_play_fd  (GbbEventPlayer *player,
                                 int             fd);
 void gbb_event_player_play_file(GbbEventPlayer *player,
                                 const char     *filename);
+void gbb_event_player_loop_fd  (GbbEventPlayer *player,
+                                int             fd);
+void gbb_event_player_loop_file(GbbEventPlayer *player,
+                                const char     *filename);
 void gbb_event_player_stop     (GbbEventPlayer *player);
 
+const GbbReplayTiming *gbb_event_player_get_replay_timing  (GbbEventPlayer *player);
+void                   gbb_event_player_reset_replay_timing(GbbEventPlayer *player);
+
 GType gbb_event_player_get_type(void);
 
 /* For implementations */
@@ -47,5 +96,24 @@ void gbb_event_player_set_ready (GbbEventPlayer *player,
                                  const char     *keyboard_device_node,
                                  const char     *mouse_device_node);
 void gbb_event_player_finished  (GbbEventPlayer *player);
+void gbb_event_player_iteration (GbbEventPlayer *player);
+void gbb_event_player_add_replay_timing (GbbEventPlayer        *player,
+                                         const GbbReplayTiming *timing);
+
+void     gbb_replay_timing_reset         (GbbReplayTiming       *timing);
+void     gbb_replay_timing_add_event     (GbbReplayTiming       *timing,
+                                          gint64                 lateness);
+void     gbb_replay_timing_add_iteration (GbbReplayTiming       *timing,
+                                          gint64                 drift);
+void     gbb_replay_timing_merge         (GbbReplayTiming       *timing,
+                                          const GbbReplayTiming *other);
+gint64   gbb_replay_timing_get_percentile(const GbbReplayTiming *timing,
+                                          double                 percentile);
+gint64   gbb_replay_timing_bucket_value  (guint                  bucket);
+guint    gbb_replay_timing_value_bucket  (gint64                 lateness);
+
+GVariant *gbb_replay_timing_to_variant   (const GbbReplayTiming *timing);
+void      gbb_replay_timing_from_variant (GbbReplayTiming       *timing,
+                                          GVariant              *variant);
 
 #endif /* __EVENT_PLAYER_H__*/
@@ -14,11 +14,27 @@ static const char gbb_introspection_xml[] =
     " <interface name='org.gnome.BatteryBench.Player'>"
     "    <property name='KeyboardDeviceNode' type='s' access='read'/>"
     "    <property name='MouseDeviceNode' type='s' access='read'/>"
-    "    <method name='Play'>"
+    "    <method name='Load'>"
+    "      <arg type='s' name='name' direction='in'/>"
     "      <arg type='h' name='eventfd' direction='in'/>"
     "    </method>"
+    "    <method name='Start'>"
+    "      <arg type='s' name='name' direction='in'/>"
+    "      <arg type='u' name='loops' direction='in'/>"
+    "    </method>"
     "    <method name='Stop'>"
     "    </method>"
+    "    <method name='GetPosition'>"
+    "      <arg type='s' name='name' direction='out'/>"
+    "      <arg type='u' name='iteration' direction='out'/>"
+    "      <arg type='u' name='event' direction='out'/>"
+    "    </method>"
+    "    <signal name='Progress'>"
+    "      <arg type='u' name='iterations'/>"
+    "    </signal>"
+    "    <signal name='Finished'>"
+    "      <arg type='(uuxuxxau)' name='timing'/>"
+    "    </signal>"
     "    <method name='Destroy'>"
     "    </method>"
     " </interface>"
@@ -0,0 +1,554 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <errno.h>
+#include <string.h>
+
+#include "json-reader.h"
+
+/* Longest number we bother to parse; anything longer isn't one we wrote */
+#define MAX_NUMBER_LENGTH 64
+
+/* Limit on the nesting of skipped values, which are skipped recursively */
+#define MAX_DEPTH 64
+
+struct _GbbJsonReader {
+    char *filename;
+    GBytes *bytes;
+    const char *pos;
+    const char *end;
+    int line;
+
+    /* Nothing has been read yet from the current object or array */
+    gboolean first;
+    /* Name of the member last read, for error messages */
+    GString *member;
+    guint depth;
+
+    GError *error;
+};
+
+GbbJsonReader *
+gbb_json_reader_new(GBytes     *bytes,
+                    const char *filename)
+{
+    GbbJsonReader *reader = g_slice_new0(GbbJsonReader);
+    gsize length;
+
+    reader->filename = g_strdup(filename);
+    reader->bytes = g_bytes_ref(bytes);
+    reader->pos = g_bytes_get_data(bytes, &length);
+    reader->end = reader->pos + length;
+    reader->line = 1;
+    reader->member = g_string_new(NULL);
+
+    return reader;
+}
+
+void
+gbb_json_reader_free(GbbJsonReader *reader)
+{
+    g_free(reader->filename);
+    g_bytes_unref(reader->bytes);
+    g_string_free(reader->member, TRUE);
+    g_clear_error(&reader->error);
+    g_slice_free(GbbJsonReader, reader);
+}
+
+gboolean
+gbb_json_reader_fail(GbbJsonReader *reader,
+                     const char    *format,
+                     ...)
+{
+    va_list args;
+    char *message;
+
+    if (reader->error)
+        return FALSE;
+
+    va_start(args, format);
+    message = g_strdup_vprintf(format, args);
+    va_end(args);
+
+    g_set_error(&reader->error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "%s:%d: %s", reader->filename, reader->line, message);
+    g_free(message);
+
+    return FALSE;
+}
+
+gboolean
+gbb_json_reader_has_error(GbbJsonReader *reader)
+{
+    return reader->error != NULL;
+}
+
+gboolean
+gbb_json_reader_finish(GbbJsonReader *reader,
+                       GError       **error)
+{
+    if (reader->error) {
+        g_propagate_error(error, reader->error);
+        reader->error = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+skip_whitespace(GbbJsonReader *reader)
+{
+    while (reader->pos < reader->end) {
+        switch (*reader->pos) {
+        case '\n':
+            reader->line++;
+            /* fall through */
+        case ' ':
+        case '\t':
+        case '\r':
+            reader->pos++;
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+/* Skips whitespace and returns the next character, 0 at the end */
+static char
+peek(GbbJsonReader *reader)
+{
+    skip_whitespace(reader);
+
+    return reader->pos < reader->end ? *reader->pos : 0;
+}
+
+static gboolean
+type_error(GbbJsonReader *reader,
+           const char    *type)
+{
+    if (reader->member->len > 0)
+        return gbb_json_reader_fail(reader, "value for '%s' is not %s", reader->member->str, type);
+    else
+        return gbb_json_reader_fail(reader, "expected %s", type);
+}
+
+gboolean
+gbb_json_reader_end(GbbJsonReader *reader)
+{
+    if (reader->error)
+        return FALSE;
+
+    if (peek(reader) != 0)
+        return gbb_json_reader_fail(reader, "unexpected data after the end of the document");
+
+    return TRUE;
+}
+
+static gboolean
+begin(GbbJsonReader *reader,
+      char           c,
+      const char    *type)
+{
+    if (reader->error)
+        return FALSE;
+
+    if (peek(reader) != c)
+        return type_error(reader, type);
+
+    reader->pos++;
+    reader->first = TRUE;
+
+    return TRUE;
+}
+
+gboolean
+gbb_json_reader_begin_object(GbbJsonReader *reader)
+{
+    return begin(reader, '{', "an object");
+}
+
+gboolean
+gbb_json_reader_begin_array(GbbJsonReader *reader)
+{
+    return begin(reader, '[', "an array");
+}
+
+/* Gets past what comes before the next value of an object or array;
+ * FALSE if at its end */
+static gboolean
+next(GbbJsonReader *reader,
+     char           end)
+{
+    char c;
+
+    if (reader->error)
+        return FALSE;
+
+    c = peek(reader);
+    if (c == end) {
+        reader->pos++;
+        /* Back in the enclosing object or array, which we only
+         * get into by reading something out of it */
+        reader->first = FALSE;
+        return FALSE;
+    }
+
+    if (!reader->first) {
+        if (c != ',')
+            return gbb_json_reader_fail(reader, "expected ',' or '%c'", end);
+        reader->pos++;
+    }
+
+    reader->first = FALSE;
+
+    return TRUE;
+}
+
+static void
+append_unichar(GString  *out,
+               gunichar  c)
+{
+    if (out)
+        g_string_append_unichar(out, c);
+}
+
+static gboolean
+read_hex4(GbbJsonReader *reader,
+          gunichar      *c)
+{
+    int i;
+
+    if (reader->end - reader->pos < 4)
+        return gbb_json_reader_fail(reader, "bad \\u escape in string");
+
+    *c = 0;
+    for (i = 0; i < 4; i++) {
+        int v = g_ascii_xdigit_value(reader->pos[i]);
+        if (v < 0)
+            return gbb_json_reader_fail(reader, "bad \\u escape in string");
+        *c = (*c << 4) | v;
+    }
+    reader->pos += 4;
+
+    return TRUE;
+}
+
+/* Reads the string at the current position into out (if not NULL) */
+static gboolean
+parse_string(GbbJsonReader *reader,
+             GString       *out)
+{
+    gunichar c, low;
+
+    if (out)
+        g_string_truncate(out, 0);
+
+    reader->pos++; /* '"' */
+
+    while (TRUE) {
+        const char *start = reader->pos;
+
+        /* Copy plain runs of characters in one go */
+        while (reader->pos < reader->end &&
+               *reader->pos != '"' && *reader->pos != '\\' && (guchar)*reader->pos >= 0x20)
+            reader->pos++;
+        if (out)
+            g_string_append_len(out, start, reader->pos - start);
+
+        if (reader->pos == reader->end)
+            return gbb_json_reader_fail(reader, "unterminated string");
+
+        switch (*reader->pos++) {
+        case '"':
+            return TRUE;
+        case '\\':
+            if (reader->pos == reader->end)
+                return gbb_json_reader_fail(reader, "unterminated string");
+
+            switch (*reader->pos++) {
+            case '"': append_unichar(out, '"'); break;
+            case '\\': append_unichar(out, '\\'); break;
+            case '/': append_unichar(out, '/'); break;
+            case 'b': append_unichar(out, '\b'); break;
+            case 'f': append_unichar(out, '\f'); break;
+            case 'n': append_unichar(out, '\n'); break;
+            case 'r': append_unichar(out, '\r'); break;
+            case 't': append_unichar(out, '\t'); break;
+            case 'u':
+                if (!read_hex4(reader, &c))
+                    return FALSE;
+
+                /* Characters outside the BMP come as surrogate pairs */
+                if (c >= 0xd800 && c < 0xdc00) {
+                    if (reader->end - reader->pos < 2 ||
+                        reader->pos[0] != '\\' || reader->pos[1] != 'u')
+                        return gbb_json_reader_fail(reader, "unpaired surrogate in string");
+                    reader->pos += 2;
+                    if (!read_hex4(reader, &low))
+                        return FALSE;
+                    if (low < 0xdc00 || low >= 0xe000)
+                        return gbb_json_reader_fail(reader, "unpaired surrogate in string");
+                    c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                } else if (c >= 0xdc00 && c < 0xe000) {
+                    return gbb_json_reader_fail(reader, "unpaired surrogate in string");
+                }
+
+                append_unichar(out, c);
+                break;
+            default:
+                return gbb_json_reader_fail(reader, "bad escape in string");
+            }
+            break;
+        default:
+            return gbb_json_reader_fail(reader, "control character in string");
+        }
+    }
+}
+
+gboolean
+gbb_json_reader_next_member(GbbJsonReader *reader,
+                            const char   **name)
+{
+    if (!next(reader, '}'))
+        return FALSE;
+
+    if (peek(reader) != '"')
+        return gbb_json_reader_fail(reader, "expected a member name");
+    if (!parse_string(reader, reader->member))
+        return FALSE;
+
+    if (peek(reader) != ':')
+        return gbb_json_reader_fail(reader, "expected ':' after '%s'", reader->member->str);
+    reader->pos++;
+
+    *name = reader->member->str;
+
+    return TRUE;
+}
+
+gboolean
+gbb_json_reader_next_element(GbbJsonReader *reader)
+{
+    return next(reader, ']');
+}
+
+gboolean
+gbb_json_reader_read_string(GbbJsonReader *reader,
+                            char         **value)
+{
+    GString *str;
+
+    if (reader->error)
+        return FALSE;
+
+    if (peek(reader) != '"')
+        return type_error(reader, "a string");
+
+    str = g_string_new(NULL);
+    if (!parse_string(reader, str) ||
+        (!g_utf8_validate(str->str, str->len, NULL) &&
+         !gbb_json_reader_fail(reader, "invalid UTF-8 in string"))) {
+        g_string_free(str, TRUE);
+        return FALSE;
+    }
+
+    *value = g_string_free(str, FALSE);
+
+    return TRUE;
+}
+
+/* Copies the number at the current position, NUL-terminated, into buf;
+ * the mapped file isn't, so we can't parse it in place */
+static gboolean
+scan_number(GbbJsonReader *reader,
+            char          *buf,
+            gboolean      *is_int)
+{
+    const char *start;
+    gsize len;
+
+    peek(reader);
+
+    start = reader->pos;
+    *is_int = TRUE;
+
+    while (reader->pos < reader->end) {
+        char c = *reader->pos;
+
+        if (c == '.' || c == 'e' || c == 'E')
+            *is_int = FALSE;
+        else if (!g_ascii_isdigit(c) && c != '-' && c != '+')
+            break;
+
+        reader->pos++;
+    }
+
+    len = reader->pos - start;
+    if (len == 0) {
+        reader->pos = start;
+        return FALSE;
+    }
+    if (len >= MAX_NUMBER_LENGTH)
+        return gbb_json_reader_fail(reader, "number too long");
+
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+
+    return TRUE;
+}
+
+gboolean
+gbb_json_reader_read_int(GbbJsonReader *reader,
+                         gint64        *value)
+{
+    char buf[MAX_NUMBER_LENGTH];
+    gboolean is_int;
+    char *end;
+    gint64 v;
+
+    if (reader->error)
+        return FALSE;
+
+    if (!scan_number(reader, buf, &is_int) || !is_int)
+        return type_error(reader, "an integer");
+
+    errno = 0;
+    v = g_ascii_strtoll(buf, &end, 10);
+    if (*end != '\0' || errno != 0)
+        return gbb_json_reader_fail(reader, "bad number '%s'", buf);
+
+    *value = v;
+
+    return TRUE;
+}
+
+gboolean
+gbb_json_reader_read_double(GbbJsonReader *reader,
+                            double        *value)
+{
+    char buf[MAX_NUMBER_LENGTH];
+    gboolean is_int;
+    char *end;
+    double v;
+
+    if (reader->error)
+        return FALSE;
+
+    if (!scan_number(reader, buf, &is_int))
+        return type_error(reader, "a number");
+
+    errno = 0;
+    v = g_ascii_strtod(buf, &end);
+    if (*end != '\0' || errno != 0)
+        return gbb_json_reader_fail(reader, "bad number '%s'", buf);
+
+    *value = v;
+
+    return TRUE;
+}
+
+static gboolean
+match_literal(GbbJsonReader *reader,
+              const char    *literal)
+{
+    gsize len = strlen(literal);
+
+    if ((gsize)(reader->end - reader->pos) < len ||
+        memcmp(reader->pos, literal, len) != 0)
+        return FALSE;
+
+    reader->pos += len;
+
+    return TRUE;
+}
+
+gboolean
+gbb_json_reader_read_boolean(GbbJsonReader *reader,
+                             gboolean      *value)
+{
+    if (reader->error)
+        return FALSE;
+
+    peek(reader);
+
+    if (match_literal(reader, "true"))
+        *value = TRUE;
+    else if (match_literal(reader, "false"))
+        *value = FALSE;
+    else
+        return type_error(reader, "a boolean");
+
+    return TRUE;
+}
+
+gboolean
+gbb_json_reader_skip_value(GbbJsonReader *reader)
+{
+    char buf[MAX_NUMBER_LENGTH];
+    const char *name;
+    gboolean is_int;
+
+    if (reader->error)
+        return FALSE;
+
+    switch (peek(reader)) {
+    case '{':
+    case '[':
+        if (reader->depth == MAX_DEPTH)
+            return gbb_json_reader_fail(reader, "values nested too deeply");
+        reader->depth++;
+
+        if (*reader->pos == '{') {
+            gbb_json_reader_begin_object(reader);
+            while (gbb_json_reader_next_member(reader, &name))
+                gbb_json_reader_skip_value(reader);
+        } else {
+            gbb_json_reader_begin_array(reader);
+            while (gbb_json_reader_next_element(reader))
+                gbb_json_reader_skip_value(reader);
+        }
+
+        reader->depth--;
+        break;
+    case '"':
+        parse_string(reader, NULL);
+        break;
+    default:
+        if (!match_literal(reader, "true") &&
+            !match_literal(reader, "false") &&
+            !match_literal(reader, "null") &&
+            !scan_number(reader, buf, &is_int))
+            return gbb_json_reader_fail(reader, "expected a value");
+    }
+
+    return reader->error == NULL;
+}
+
+JsonNode *
+gbb_json_reader_read_node(GbbJsonReader *reader)
+{
+    JsonParser *parser;
+    JsonNode *node = NULL;
+    GError *error = NULL;
+    const char *start;
+
+    if (reader->error)
+        return NULL;
+
+    peek(reader);
+    start = reader->pos;
+    if (!gbb_json_reader_skip_value(reader))
+        return NULL;
+
+    parser = json_parser_new();
+    if (json_parser_load_from_data(parser, start, reader->pos - start, &error)) {
+        node = json_node_copy(json_parser_get_root(parser));
+    } else {
+        gbb_json_reader_fail(reader, "%s", error->message);
+        g_clear_error(&error);
+    }
+    g_object_unref(parser);
+
+    return node;
+}
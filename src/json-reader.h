@@ -0,0 +1,70 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __JSON_READER_H__
+#define __JSON_READER_H__
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+/* A pull parser for JSON documents: the caller walks the document in
+ * the order it's written, reading the values it wants and skipping
+ * the rest, so nothing is built up in memory beyond the value at
+ * hand. Given a mapped file, stopping early means the rest of it is
+ * never even read from disk.
+ *
+ * The first error is kept, and makes every call after it fail; so a
+ * loop over the members of an object can just carry on, and the error
+ * be checked once at the end with gbb_json_reader_finish().
+ *
+ *  gbb_json_reader_begin_object(reader);
+ *  while (gbb_json_reader_next_member(reader, &name)) {
+ *      if (strcmp(name, "power") == 0)
+ *          gbb_json_reader_read_double(reader, &power);
+ *      else
+ *          gbb_json_reader_skip_value(reader);
+ *  }
+ */
+typedef struct _GbbJsonReader GbbJsonReader;
+
+/* filename is only used in error messages */
+GbbJsonReader *gbb_json_reader_new           (GBytes        *bytes,
+                                              const char    *filename);
+void           gbb_json_reader_free          (GbbJsonReader *reader);
+
+/* Returns the first error, if any; doesn't look at the rest of the input */
+gboolean gbb_json_reader_finish        (GbbJsonReader *reader,
+                                        GError       **error);
+gboolean gbb_json_reader_has_error     (GbbJsonReader *reader);
+/* Makes the reader fail, at the current position, for errors in
+ * values that parsed fine. Always returns FALSE */
+gboolean gbb_json_reader_fail          (GbbJsonReader *reader,
+                                        const char    *format,
+                                        ...) G_GNUC_PRINTF(2, 3);
+/* Checks that nothing but whitespace is left after the root value */
+gboolean gbb_json_reader_end           (GbbJsonReader *reader);
+
+gboolean gbb_json_reader_begin_object  (GbbJsonReader *reader);
+gboolean gbb_json_reader_begin_array   (GbbJsonReader *reader);
+
+/* FALSE at the end of the object (or array), or on error. The name is
+ * valid until the next call on the reader */
+gboolean gbb_json_reader_next_member   (GbbJsonReader *reader,
+                                        const char   **name);
+gboolean gbb_json_reader_next_element  (GbbJsonReader *reader);
+
+/* Any of these fail if the value is of another type, except that an
+ * integer is also accepted as a double */
+gboolean gbb_json_reader_read_string   (GbbJsonReader *reader,
+                                        char         **value);
+gboolean gbb_json_reader_read_int      (GbbJsonReader *reader,
+                                        gint64        *value);
+gboolean gbb_json_reader_read_double   (GbbJsonReader *reader,
+                                        double        *value);
+gboolean gbb_json_reader_read_boolean  (GbbJsonReader *reader,
+                                        gboolean      *value);
+gboolean gbb_json_reader_skip_value    (GbbJsonReader *reader);
+/* Parses the next value into a tree, for the parts of a document that
+ * are easier to handle as one; NULL on error */
+JsonNode *gbb_json_reader_read_node    (GbbJsonReader *reader);
+
+#endif /* __JSON_READER_H__ */
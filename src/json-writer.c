@@ -0,0 +1,324 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <string.h>
+
+#include "json-writer.h"
+
+/* Written out to the stream whenever this much has been collected */
+#define BUFFER_SIZE (64 * 1024)
+
+/* Same layout as the pretty output of JsonGenerator */
+#define INDENT 2
+
+struct _GbbJsonWriter {
+    GOutputStream *stream;
+    gboolean pretty;
+    GString *buffer;
+    GError *error;
+
+    /* Number of values so far in each open object or array */
+    GArray *counts;
+    gboolean after_member_name;
+};
+
+GbbJsonWriter *
+gbb_json_writer_new(GOutputStream *stream,
+                    gboolean       pretty)
+{
+    GbbJsonWriter *writer = g_slice_new0(GbbJsonWriter);
+
+    writer->stream = g_object_ref(stream);
+    writer->pretty = pretty;
+    writer->buffer = g_string_sized_new(BUFFER_SIZE);
+    writer->counts = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    return writer;
+}
+
+void
+gbb_json_writer_free(GbbJsonWriter *writer)
+{
+    g_object_unref(writer->stream);
+    g_string_free(writer->buffer, TRUE);
+    g_array_unref(writer->counts);
+    g_clear_error(&writer->error);
+    g_slice_free(GbbJsonWriter, writer);
+}
+
+static void
+writer_flush(GbbJsonWriter *writer)
+{
+    if (writer->error == NULL && writer->buffer->len > 0)
+        g_output_stream_write_all(writer->stream,
+                                  writer->buffer->str, writer->buffer->len,
+                                  NULL, NULL, &writer->error);
+
+    g_string_truncate(writer->buffer, 0);
+}
+
+static void
+writer_check_flush(GbbJsonWriter *writer)
+{
+    if (writer->buffer->len >= BUFFER_SIZE)
+        writer_flush(writer);
+}
+
+gboolean
+gbb_json_writer_finish(GbbJsonWriter *writer,
+                       GError       **error)
+{
+    g_warn_if_fail(writer->counts->len == 0);
+
+    if (writer->pretty)
+        g_string_append_c(writer->buffer, '\n');
+    writer_flush(writer);
+
+    if (writer->error == NULL)
+        g_output_stream_flush(writer->stream, NULL, &writer->error);
+
+    if (writer->error) {
+        g_propagate_error(error, writer->error);
+        writer->error = NULL;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+writer_newline(GbbJsonWriter *writer,
+               guint          depth)
+{
+    if (!writer->pretty)
+        return;
+
+    g_string_append_c(writer->buffer, '\n');
+    g_string_append_printf(writer->buffer, "%*s", depth * INDENT, "");
+}
+
+/* Whatever has to come between the previous value and the next one */
+static void
+writer_separator(GbbJsonWriter *writer)
+{
+    guint *count;
+
+    if (writer->after_member_name) {
+        writer->after_member_name = FALSE;
+        return;
+    }
+
+    if (writer->counts->len == 0)
+        return;
+
+    count = &g_array_index(writer->counts, guint, writer->counts->len - 1);
+    if (*count > 0)
+        g_string_append_c(writer->buffer, ',');
+    (*count)++;
+
+    writer_newline(writer, writer->counts->len);
+}
+
+static void
+writer_begin(GbbJsonWriter *writer,
+             char           c)
+{
+    guint count = 0;
+
+    writer_separator(writer);
+    g_string_append_c(writer->buffer, c);
+    g_array_append_val(writer->counts, count);
+}
+
+static void
+writer_end(GbbJsonWriter *writer,
+           char           c)
+{
+    guint count;
+
+    g_return_if_fail(writer->counts->len > 0);
+
+    count = g_array_index(writer->counts, guint, writer->counts->len - 1);
+    g_array_set_size(writer->counts, writer->counts->len - 1);
+
+    if (count > 0)
+        writer_newline(writer, writer->counts->len);
+    g_string_append_c(writer->buffer, c);
+
+    writer_check_flush(writer);
+}
+
+void
+gbb_json_writer_begin_object(GbbJsonWriter *writer)
+{
+    writer_begin(writer, '{');
+}
+
+void
+gbb_json_writer_end_object(GbbJsonWriter *writer)
+{
+    writer_end(writer, '}');
+}
+
+void
+gbb_json_writer_begin_array(GbbJsonWriter *writer)
+{
+    writer_begin(writer, '[');
+}
+
+void
+gbb_json_writer_end_array(GbbJsonWriter *writer)
+{
+    writer_end(writer, ']');
+}
+
+static void
+append_string(GString    *buffer,
+              const char *str)
+{
+    const char *p;
+
+    g_string_append_c(buffer, '"');
+
+    for (p = str; *p; p++) {
+        switch (*p) {
+        case '"':
+            g_string_append(buffer, "\\\"");
+            break;
+        case '\\':
+            g_string_append(buffer, "\\\\");
+            break;
+        case '\b':
+            g_string_append(buffer, "\\b");
+            break;
+        case '\f':
+            g_string_append(buffer, "\\f");
+            break;
+        case '\n':
+            g_string_append(buffer, "\\n");
+            break;
+        case '\r':
+            g_string_append(buffer, "\\r");
+            break;
+        case '\t':
+            g_string_append(buffer, "\\t");
+            break;
+        default:
+            if ((guchar)*p < 0x20)
+                g_string_append_printf(buffer, "\\u%04x", (guchar)*p);
+            else
+                g_string_append_c(buffer, *p);
+        }
+    }
+
+    g_string_append_c(buffer, '"');
+}
+
+void
+gbb_json_writer_set_member_name(GbbJsonWriter *writer,
+                                const char    *name)
+{
+    g_return_if_fail(!writer->after_member_name);
+
+    writer_separator(writer);
+    append_string(writer->buffer, name);
+    g_string_append(writer->buffer, writer->pretty ? " : " : ":");
+    writer->after_member_name = TRUE;
+}
+
+void
+gbb_json_writer_add_string_value(GbbJsonWriter *writer,
+                                 const char    *value)
+{
+    writer_separator(writer);
+    append_string(writer->buffer, value);
+    writer_check_flush(writer);
+}
+
+void
+gbb_json_writer_add_int_value(GbbJsonWriter *writer,
+                              gint64         value)
+{
+    writer_separator(writer);
+    g_string_append_printf(writer->buffer, "%" G_GINT64_FORMAT, value);
+    writer_check_flush(writer);
+}
+
+void
+gbb_json_writer_add_double_value(GbbJsonWriter *writer,
+                                 double         value)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    writer_separator(writer);
+
+    /* %.17g, so it reads back exactly the same; keep it a double
+     * for readers that care about the type */
+    g_ascii_dtostr(buf, sizeof(buf), value);
+    g_string_append(writer->buffer, buf);
+    if (strspn(buf, "-0123456789") == strlen(buf))
+        g_string_append(writer->buffer, ".0");
+
+    writer_check_flush(writer);
+}
+
+void
+gbb_json_writer_add_boolean_value(GbbJsonWriter *writer,
+                                  gboolean       value)
+{
+    writer_separator(writer);
+    g_string_append(writer->buffer, value ? "true" : "false");
+    writer_check_flush(writer);
+}
+
+void
+gbb_json_writer_add_node(GbbJsonWriter *writer,
+                         JsonNode      *node)
+{
+    GList *members, *elements, *l;
+
+    switch (json_node_get_node_type(node)) {
+    case JSON_NODE_OBJECT: {
+        JsonObject *object = json_node_get_object(node);
+
+        gbb_json_writer_begin_object(writer);
+        members = json_object_get_members(object);
+        for (l = members; l; l = l->next) {
+            gbb_json_writer_set_member_name(writer, l->data);
+            gbb_json_writer_add_node(writer, json_object_get_member(object, l->data));
+        }
+        g_list_free(members);
+        gbb_json_writer_end_object(writer);
+        break;
+    }
+    case JSON_NODE_ARRAY:
+        gbb_json_writer_begin_array(writer);
+        elements = json_array_get_elements(json_node_get_array(node));
+        for (l = elements; l; l = l->next)
+            gbb_json_writer_add_node(writer, l->data);
+        g_list_free(elements);
+        gbb_json_writer_end_array(writer);
+        break;
+    case JSON_NODE_VALUE:
+        switch (json_node_get_value_type(node)) {
+        case G_TYPE_INT64:
+            gbb_json_writer_add_int_value(writer, json_node_get_int(node));
+            break;
+        case G_TYPE_DOUBLE:
+            gbb_json_writer_add_double_value(writer, json_node_get_double(node));
+            break;
+        case G_TYPE_BOOLEAN:
+            gbb_json_writer_add_boolean_value(writer, json_node_get_boolean(node));
+            break;
+        case G_TYPE_STRING:
+            gbb_json_writer_add_string_value(writer, json_node_get_string(node));
+            break;
+        default:
+            g_warn_if_reached();
+        }
+        break;
+    case JSON_NODE_NULL:
+        writer_separator(writer);
+        g_string_append(writer->buffer, "null");
+        break;
+    }
+}
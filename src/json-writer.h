@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __JSON_WRITER_H__
+#define __JSON_WRITER_H__
+
+#include <gio/gio.h>
+#include <json-glib/json-glib.h>
+
+/* Writes a JSON document to a stream as it is produced, with calls
+ * that mirror JsonBuilder, so that big documents never have to be
+ * held in memory as a whole. Output is collected in a buffer of
+ * fixed size and written out whenever that fills up.
+ *
+ * The first error writing to the stream is kept and makes everything
+ * after it a no-op; it is returned by gbb_json_writer_finish().
+ */
+typedef struct _GbbJsonWriter GbbJsonWriter;
+
+GbbJsonWriter *gbb_json_writer_new    (GOutputStream *stream,
+                                       gboolean       pretty);
+gboolean       gbb_json_writer_finish (GbbJsonWriter *writer,
+                                       GError       **error);
+void           gbb_json_writer_free   (GbbJsonWriter *writer);
+
+void gbb_json_writer_begin_object    (GbbJsonWriter *writer);
+void gbb_json_writer_end_object      (GbbJsonWriter *writer);
+void gbb_json_writer_begin_array     (GbbJsonWriter *writer);
+void gbb_json_writer_end_array       (GbbJsonWriter *writer);
+void gbb_json_writer_set_member_name (GbbJsonWriter *writer,
+                                      const char    *name);
+
+void gbb_json_writer_add_string_value  (GbbJsonWriter *writer,
+                                        const char    *value);
+void gbb_json_writer_add_int_value     (GbbJsonWriter *writer,
+                                        gint64         value);
+void gbb_json_writer_add_double_value  (GbbJsonWriter *writer,
+                                        double         value);
+void gbb_json_writer_add_boolean_value (GbbJsonWriter *writer,
+                                        gboolean       value);
+/* For the small parts of a document that are easier to build as a
+ * tree, such as the output of gbb_system_info_to_json() */
+void gbb_json_writer_add_node          (GbbJsonWriter *writer,
+                                        JsonNode      *node);
+
+#endif /* __JSON_WRITER_H__ */
@@ -0,0 +1,226 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <errno.h>
+#include <string.h>
+
+#include "log-index.h"
+
+/* Bump when what is stored changes; older indexes are thrown away */
+#define INDEX_VERSION 1
+#define INDEX_GROUP "index"
+
+struct _GbbLogIndex {
+    char *path;
+    GKeyFile *key_file;
+    GHashTable *seen; /* groups looked up or added since loading */
+    gboolean dirty;
+};
+
+GbbLogSummary *
+gbb_log_summary_new_for_run(GbbTestRun *run)
+{
+    GbbLogSummary *summary = g_slice_new0(GbbLogSummary);
+
+    summary->filename = g_strdup(gbb_test_run_get_filename(run));
+    summary->name = g_strdup(gbb_test_run_get_name(run));
+    summary->duration_type = gbb_test_run_get_duration_type(run);
+    if (summary->duration_type == GBB_DURATION_TIME)
+        summary->duration = gbb_test_run_get_duration_time(run);
+    else
+        summary->duration = gbb_test_run_get_duration_percent(run);
+    summary->start_time = gbb_test_run_get_start_time(run);
+    summary->power = gbb_test_run_get_average_power(run);
+
+    return summary;
+}
+
+void
+gbb_log_summary_free(GbbLogSummary *summary)
+{
+    g_free(summary->filename);
+    g_free(summary->name);
+    g_slice_free(GbbLogSummary, summary);
+}
+
+GbbLogIndex *
+gbb_log_index_new(const char *path)
+{
+    GbbLogIndex *index = g_slice_new0(GbbLogIndex);
+    GError *error = NULL;
+
+    index->path = g_strdup(path);
+    index->key_file = g_key_file_new();
+    index->seen = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    if (!g_key_file_load_from_file(index->key_file, path, G_KEY_FILE_NONE, &error)) {
+        if (!g_error_matches(error, G_FILE_ERROR, G_FILE_ERROR_NOENT))
+            g_warning("Can't read log index '%s': %s", path, error->message);
+        g_clear_error(&error);
+    } else if (g_key_file_get_integer(index->key_file, INDEX_GROUP, "version", NULL) != INDEX_VERSION) {
+        g_key_file_unref(index->key_file);
+        index->key_file = g_key_file_new();
+    }
+
+    g_key_file_set_integer(index->key_file, INDEX_GROUP, "version", INDEX_VERSION);
+
+    return index;
+}
+
+void
+gbb_log_index_free(GbbLogIndex *index)
+{
+    g_free(index->path);
+    g_key_file_unref(index->key_file);
+    g_hash_table_destroy(index->seen);
+    g_slice_free(GbbLogIndex, index);
+}
+
+static gint64
+info_get_mtime(GFileInfo *info)
+{
+    return (g_file_info_get_attribute_uint64(info, G_FILE_ATTRIBUTE_TIME_MODIFIED) * G_USEC_PER_SEC +
+            g_file_info_get_attribute_uint32(info, G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC));
+}
+
+GbbLogSummary *
+gbb_log_index_lookup(GbbLogIndex *index,
+                     const char  *filename,
+                     GFileInfo   *info)
+{
+    GKeyFile *key_file = index->key_file;
+    GbbLogSummary *summary = NULL;
+    GError *error = NULL;
+    char *group = g_path_get_basename(filename);
+    char *duration_type = NULL;
+
+    if (!g_key_file_has_group(key_file, group))
+        goto out;
+
+    /* Mark it as seen even if stale; it's about to be replaced */
+    g_hash_table_add(index->seen, g_strdup(group));
+
+    if (g_key_file_get_int64(key_file, group, "size", &error) != g_file_info_get_size(info) || error)
+        goto out;
+    if (g_key_file_get_int64(key_file, group, "mtime", &error) != info_get_mtime(info) || error)
+        goto out;
+
+    summary = g_slice_new0(GbbLogSummary);
+    summary->filename = g_strdup(filename);
+
+    summary->name = g_key_file_get_string(key_file, group, "name", &error);
+    if (error)
+        goto out;
+
+    duration_type = g_key_file_get_string(key_file, group, "duration-type", &error);
+    if (error)
+        goto out;
+    if (strcmp(duration_type, "time") == 0) {
+        summary->duration_type = GBB_DURATION_TIME;
+    } else if (strcmp(duration_type, "percent") == 0) {
+        summary->duration_type = GBB_DURATION_PERCENT;
+    } else {
+        g_set_error(&error, G_KEY_FILE_ERROR, G_KEY_FILE_ERROR_INVALID_VALUE,
+                    "Bad duration type '%s'", duration_type);
+        goto out;
+    }
+
+    summary->duration = g_key_file_get_double(key_file, group, "duration", &error);
+    if (error)
+        goto out;
+    summary->start_time = g_key_file_get_int64(key_file, group, "start-time", &error);
+    if (error)
+        goto out;
+    summary->power = g_key_file_get_double(key_file, group, "power", &error);
+
+out:
+    if (error) {
+        g_debug("Ignoring index entry for '%s': %s", group, error->message);
+        g_clear_error(&error);
+        g_clear_pointer(&summary, gbb_log_summary_free);
+    }
+
+    g_free(duration_type);
+    g_free(group);
+
+    return summary;
+}
+
+void
+gbb_log_index_add(GbbLogIndex         *index,
+                  GFileInfo           *info,
+                  const GbbLogSummary *summary)
+{
+    GKeyFile *key_file = index->key_file;
+    char *group = g_path_get_basename(summary->filename);
+
+    g_key_file_remove_group(key_file, group, NULL);
+
+    g_key_file_set_int64(key_file, group, "size", g_file_info_get_size(info));
+    g_key_file_set_int64(key_file, group, "mtime", info_get_mtime(info));
+    g_key_file_set_string(key_file, group, "name", summary->name ? summary->name : "");
+    g_key_file_set_string(key_file, group, "duration-type",
+                          summary->duration_type == GBB_DURATION_TIME ? "time" : "percent");
+    g_key_file_set_double(key_file, group, "duration", summary->duration);
+    g_key_file_set_int64(key_file, group, "start-time", summary->start_time);
+    g_key_file_set_double(key_file, group, "power", summary->power);
+
+    g_hash_table_add(index->seen, group);
+    index->dirty = TRUE;
+}
+
+void
+gbb_log_index_remove(GbbLogIndex *index,
+                     const char  *filename)
+{
+    char *group = g_path_get_basename(filename);
+
+    if (g_key_file_remove_group(index->key_file, group, NULL))
+        index->dirty = TRUE;
+    g_hash_table_remove(index->seen, group);
+
+    g_free(group);
+}
+
+void
+gbb_log_index_prune(GbbLogIndex *index)
+{
+    gchar **groups = g_key_file_get_groups(index->key_file, NULL);
+    int i;
+
+    for (i = 0; groups[i]; i++) {
+        if (strcmp(groups[i], INDEX_GROUP) == 0)
+            continue;
+
+        if (!g_hash_table_contains(index->seen, groups[i])) {
+            g_key_file_remove_group(index->key_file, groups[i], NULL);
+            index->dirty = TRUE;
+        }
+    }
+
+    g_strfreev(groups);
+}
+
+gboolean
+gbb_log_index_save(GbbLogIndex *index,
+                   GError     **error)
+{
+    if (!index->dirty)
+        return TRUE;
+
+    char *dirname = g_path_get_dirname(index->path);
+    int result = g_mkdir_with_parents(dirname, 0755);
+    g_free(dirname);
+
+    if (result != 0) {
+        int errsv = errno;
+        g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(errsv),
+                    "Can't create directory for '%s': %s", index->path, g_strerror(errsv));
+        return FALSE;
+    }
+
+    if (!g_key_file_save_to_file(index->key_file, index->path, error))
+        return FALSE;
+
+    index->dirty = FALSE;
+    return TRUE;
+}
@@ -0,0 +1,55 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __LOG_INDEX_H__
+#define __LOG_INDEX_H__
+
+#include <gio/gio.h>
+
+#include "test-run.h"
+
+/* What the log browser shows about a run without loading it */
+typedef struct {
+    char *filename;
+    char *name;
+    GbbDurationType duration_type;
+    double duration;    /* seconds or percent, depending on duration_type */
+    gint64 start_time;
+    double power;       /* average (W), -1 if unknown */
+} GbbLogSummary;
+
+GbbLogSummary *gbb_log_summary_new_for_run (GbbTestRun    *run);
+void           gbb_log_summary_free        (GbbLogSummary *summary);
+
+/* A cache of the summaries of the logs in a folder, kept as a key
+ * file. Entries are keyed by file name and checked against the size
+ * and modification time of the log, so only logs that are new or
+ * have changed since the last time need to be parsed.
+ */
+typedef struct _GbbLogIndex GbbLogIndex;
+
+/* What the GFileInfo passed in needs to have */
+#define GBB_LOG_INDEX_ATTRIBUTES G_FILE_ATTRIBUTE_STANDARD_SIZE "," \
+    G_FILE_ATTRIBUTE_TIME_MODIFIED "," G_FILE_ATTRIBUTE_TIME_MODIFIED_USEC
+
+GbbLogIndex   *gbb_log_index_new    (const char          *path);
+void           gbb_log_index_free   (GbbLogIndex         *index);
+
+/* Returns NULL if there is no entry for the log or it is stale */
+GbbLogSummary *gbb_log_index_lookup (GbbLogIndex         *index,
+                                     const char          *filename,
+                                     GFileInfo           *info);
+void           gbb_log_index_add    (GbbLogIndex         *index,
+                                     GFileInfo           *info,
+                                     const GbbLogSummary *summary);
+void           gbb_log_index_remove (GbbLogIndex         *index,
+                                     const char          *filename);
+
+/* Drops the entries that haven't been looked up or added since
+ * the index was loaded, i.e. those of logs that are gone */
+void           gbb_log_index_prune  (GbbLogIndex         *index);
+
+/* Does nothing if there were no changes */
+gboolean       gbb_log_index_save   (GbbLogIndex         *index,
+                                     GError             **error);
+
+#endif /* __LOG_INDEX_H__ */
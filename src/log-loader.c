@@ -0,0 +1,535 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include "log-loader.h"
+
+/* How often (ms) parsed logs are handed to the main thread */
+#define BATCH_INTERVAL 100
+
+/* Changes to the folder are acted on once it has been quiet for
+ * this long (ms), so that a copy of many logs is handled at once */
+#define WATCH_SETTLE_TIME 500
+
+typedef struct {
+    char *filename;
+    GFileInfo *info;
+    GbbLogSummary *summary; /* NULL if the log couldn't be parsed */
+    GError *error;
+} LoadJob;
+
+struct _GbbLogLoader {
+    GObject parent;
+
+    GFile *folder;
+    GbbLogIndex *index; /* only used from the main thread */
+    GCancellable *cancellable;
+
+    GThreadPool *pool;
+    GAsyncQueue *results; /* LoadJob */
+    guint n_pending;
+    guint batch_timeout;
+
+    gboolean listed;
+    gboolean list_complete;
+    gboolean finished;
+
+    GFileMonitor *monitor;
+    GHashTable *changed; /* paths, since the last settle timeout */
+    guint settle_timeout;
+};
+
+enum {
+    LOADED,
+    REMOVED,
+    FINISHED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+G_DEFINE_TYPE(GbbLogLoader, gbb_log_loader, G_TYPE_OBJECT)
+
+static void
+load_job_free(LoadJob *job)
+{
+    g_free(job->filename);
+    g_clear_object(&job->info);
+    if (job->summary)
+        gbb_log_summary_free(job->summary);
+    g_clear_error(&job->error);
+    g_slice_free(LoadJob, job);
+}
+
+static void
+load_job_worker(gpointer data,
+                gpointer user_data)
+{
+    LoadJob *job = data;
+    GbbLogLoader *loader = user_data;
+
+    if (!g_cancellable_set_error_if_cancelled(loader->cancellable, &job->error)) {
+        /* The list doesn't need the samples */
+        GbbTestRun *run = gbb_test_run_new_from_file(job->filename, GBB_TEST_RUN_READ_HEADER_ONLY,
+                                                     &job->error);
+        if (run) {
+            job->summary = gbb_log_summary_new_for_run(run);
+            g_object_unref(run);
+        }
+    }
+
+    g_async_queue_push(loader->results, job);
+}
+
+static void
+gbb_log_loader_dispose(GObject *object)
+{
+    GbbLogLoader *loader = GBB_LOG_LOADER(object);
+
+    g_cancellable_cancel(loader->cancellable);
+
+    /* Drops what hasn't started yet, waits for the rest */
+    if (loader->pool) {
+        g_thread_pool_free(loader->pool, TRUE, TRUE);
+        loader->pool = NULL;
+    }
+
+    if (loader->batch_timeout) {
+        g_source_remove(loader->batch_timeout);
+        loader->batch_timeout = 0;
+    }
+
+    if (loader->settle_timeout) {
+        g_source_remove(loader->settle_timeout);
+        loader->settle_timeout = 0;
+    }
+
+    if (loader->monitor) {
+        g_signal_handlers_disconnect_by_data(loader->monitor, loader);
+        g_file_monitor_cancel(loader->monitor);
+        g_clear_object(&loader->monitor);
+    }
+
+    G_OBJECT_CLASS(gbb_log_loader_parent_class)->dispose(object);
+}
+
+static void
+gbb_log_loader_finalize(GObject *object)
+{
+    GbbLogLoader *loader = GBB_LOG_LOADER(object);
+
+    g_async_queue_unref(loader->results);
+    g_hash_table_destroy(loader->changed);
+    g_object_unref(loader->cancellable);
+    g_object_unref(loader->folder);
+    gbb_log_index_free(loader->index);
+
+    G_OBJECT_CLASS(gbb_log_loader_parent_class)->finalize(object);
+}
+
+static void
+gbb_log_loader_init(GbbLogLoader *loader)
+{
+    loader->cancellable = g_cancellable_new();
+    loader->results = g_async_queue_new_full((GDestroyNotify)load_job_free);
+    loader->changed = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+gbb_log_loader_class_init(GbbLogLoaderClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+    gobject_class->dispose = gbb_log_loader_dispose;
+    gobject_class->finalize = gbb_log_loader_finalize;
+
+    signals[LOADED] =
+        g_signal_new ("loaded",
+                      GBB_TYPE_LOG_LOADER,
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL, NULL, NULL,
+                      G_TYPE_NONE, 1, G_TYPE_POINTER);
+    signals[REMOVED] =
+        g_signal_new ("removed",
+                      GBB_TYPE_LOG_LOADER,
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL, NULL, NULL,
+                      G_TYPE_NONE, 1, G_TYPE_STRING);
+    signals[FINISHED] =
+        g_signal_new ("finished",
+                      GBB_TYPE_LOG_LOADER,
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL, NULL, NULL,
+                      G_TYPE_NONE, 0);
+}
+
+GbbLogLoader *
+gbb_log_loader_new(GFile      *folder,
+                   const char *index_path)
+{
+    GbbLogLoader *loader = g_object_new(GBB_TYPE_LOG_LOADER, NULL);
+    GError *error = NULL;
+
+    loader->folder = g_object_ref(folder);
+    loader->index = gbb_log_index_new(index_path);
+
+    /* Parsing is CPU bound; one thread per processor */
+    loader->pool = g_thread_pool_new(load_job_worker, loader,
+                                     g_get_num_processors(), FALSE, &error);
+    if (loader->pool == NULL)
+        g_error("Can't create thread pool: %s", error->message);
+
+    return loader;
+}
+
+static void
+loader_check_finished(GbbLogLoader *loader)
+{
+    GError *error = NULL;
+
+    if (!loader->listed || loader->n_pending > 0)
+        return;
+
+    /* Everything that's there has been looked up or added */
+    if (!loader->finished && loader->list_complete)
+        gbb_log_index_prune(loader->index);
+
+    if (!gbb_log_index_save(loader->index, &error)) {
+        g_warning("Can't save log index: %s", error->message);
+        g_clear_error(&error);
+    }
+
+    if (!loader->finished) {
+        loader->finished = TRUE;
+        g_signal_emit(loader, signals[FINISHED], 0);
+    }
+}
+
+static gboolean
+on_batch_timeout(gpointer data)
+{
+    GbbLogLoader *loader = data;
+    GPtrArray *batch = g_ptr_array_new_with_free_func((GDestroyNotify)load_job_free);
+    GPtrArray *summaries = g_ptr_array_new();
+    LoadJob *job;
+
+    while ((job = g_async_queue_try_pop(loader->results)) != NULL) {
+        loader->n_pending--;
+        g_ptr_array_add(batch, job);
+
+        if (job->summary) {
+            gbb_log_index_add(loader->index, job->info, job->summary);
+            g_ptr_array_add(summaries, job->summary);
+        } else {
+            g_warning("Can't read test log '%s': %s", job->filename, job->error->message);
+        }
+    }
+
+    if (summaries->len > 0)
+        g_signal_emit(loader, signals[LOADED], 0, summaries);
+
+    g_ptr_array_free(summaries, TRUE);
+    g_ptr_array_free(batch, TRUE);
+
+    if (loader->n_pending > 0)
+        return G_SOURCE_CONTINUE;
+
+    loader->batch_timeout = 0;
+    loader_check_finished(loader);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+list_logs_thread(GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+    GbbLogLoader *loader = source_object;
+    GPtrArray *jobs = g_ptr_array_new_with_free_func((GDestroyNotify)load_job_free);
+    GError *error = NULL;
+    GFileEnumerator *enumerator;
+
+    enumerator = g_file_enumerate_children (loader->folder,
+                                            "standard::name," GBB_LOG_INDEX_ATTRIBUTES,
+                                            G_FILE_QUERY_INFO_NONE,
+                                            cancellable, &error);
+    if (!enumerator) {
+        /* No logs yet */
+        if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+            g_clear_error(&error);
+        goto out;
+    }
+
+    while (TRUE) {
+        GFileInfo *info = g_file_enumerator_next_file (enumerator, cancellable, &error);
+        if (!info)
+            break;
+
+        if (gbb_test_run_is_log_filename(g_file_info_get_name(info))) {
+            LoadJob *job = g_slice_new0(LoadJob);
+            GFile *child = g_file_enumerator_get_child (enumerator, info);
+
+            job->filename = g_file_get_path(child);
+            job->info = g_object_ref(info);
+            g_ptr_array_add(jobs, job);
+
+            g_object_unref(child);
+        }
+
+        g_object_unref(info);
+    }
+
+    g_object_unref(enumerator);
+
+out:
+    /* Whatever was listed before an error is still worth showing */
+    if (error)
+        g_task_set_task_data(task, error, (GDestroyNotify)g_error_free);
+
+    g_task_return_pointer(task, jobs, (GDestroyNotify)g_ptr_array_unref);
+}
+
+/* Takes the jobs; summaries the index already has are handed out
+ * at once if show_known is set, the other logs go to the pool */
+static void
+loader_queue_jobs(GbbLogLoader *loader,
+                  GPtrArray    *jobs,
+                  gboolean      show_known)
+{
+    GPtrArray *summaries = g_ptr_array_new();
+    guint i;
+
+    /* Take the jobs out of the array as we go; those that need
+     * parsing belong to the pool from then on */
+    g_ptr_array_set_free_func(jobs, NULL);
+
+    for (i = 0; i < jobs->len; i++) {
+        LoadJob *job = g_ptr_array_index(jobs, i);
+
+        job->summary = gbb_log_index_lookup(loader->index, job->filename, job->info);
+        if (job->summary) {
+            g_ptr_array_add(summaries, job->summary);
+        } else {
+            loader->n_pending++;
+            g_thread_pool_push(loader->pool, job, NULL);
+            g_ptr_array_index(jobs, i) = NULL;
+        }
+    }
+
+    if (show_known && summaries->len > 0)
+        g_signal_emit(loader, signals[LOADED], 0, summaries);
+    g_ptr_array_free(summaries, TRUE);
+
+    for (i = 0; i < jobs->len; i++) {
+        if (g_ptr_array_index(jobs, i))
+            load_job_free(g_ptr_array_index(jobs, i));
+    }
+    g_ptr_array_unref(jobs);
+
+    if (loader->n_pending > 0) {
+        if (!loader->batch_timeout)
+            loader->batch_timeout = g_timeout_add(BATCH_INTERVAL, on_batch_timeout, loader);
+    } else {
+        loader_check_finished(loader);
+    }
+}
+
+static void
+on_logs_listed(GObject      *source_object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+    GbbLogLoader *loader = GBB_LOG_LOADER(source_object);
+    GError *list_error = g_task_get_task_data(G_TASK(result));
+    GPtrArray *jobs;
+
+    /* NULL if the loader was disposed while listing */
+    jobs = g_task_propagate_pointer(G_TASK(result), NULL);
+    if (jobs == NULL || loader->pool == NULL) {
+        if (jobs)
+            g_ptr_array_unref(jobs);
+        return;
+    }
+
+    if (list_error)
+        g_warning("Error reading logs: %s", list_error->message);
+
+    loader->listed = TRUE;
+    loader->list_complete = list_error == NULL;
+
+    /* What the index already knew about shows up at once */
+    loader_queue_jobs(loader, jobs, TRUE);
+}
+
+typedef struct {
+    GPtrArray *paths;
+    GPtrArray *jobs;    /* LoadJob, for the paths that exist */
+    GPtrArray *missing; /* paths */
+} StatData;
+
+static void
+stat_data_free(StatData *data)
+{
+    g_ptr_array_unref(data->paths);
+    if (data->jobs)
+        g_ptr_array_unref(data->jobs);
+    if (data->missing)
+        g_ptr_array_unref(data->missing);
+    g_slice_free(StatData, data);
+}
+
+static void
+stat_logs_thread(GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+    StatData *data = task_data;
+    guint i;
+
+    data->jobs = g_ptr_array_new_with_free_func((GDestroyNotify)load_job_free);
+    data->missing = g_ptr_array_new_with_free_func(g_free);
+
+    for (i = 0; i < data->paths->len; i++) {
+        const char *path = g_ptr_array_index(data->paths, i);
+        GFile *file = g_file_new_for_path(path);
+        GFileInfo *info = g_file_query_info(file, GBB_LOG_INDEX_ATTRIBUTES,
+                                            G_FILE_QUERY_INFO_NONE,
+                                            cancellable, NULL);
+        if (info) {
+            LoadJob *job = g_slice_new0(LoadJob);
+            job->filename = g_strdup(path);
+            job->info = info;
+            g_ptr_array_add(data->jobs, job);
+        } else {
+            g_ptr_array_add(data->missing, g_strdup(path));
+        }
+
+        g_object_unref(file);
+    }
+
+    g_task_return_boolean(task, TRUE);
+}
+
+static void
+on_logs_statted(GObject      *source_object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+    GbbLogLoader *loader = GBB_LOG_LOADER(source_object);
+    StatData *data = g_task_get_task_data(G_TASK(result));
+    guint i;
+
+    if (!g_task_propagate_boolean(G_TASK(result), NULL))
+        return;
+
+    for (i = 0; i < data->missing->len; i++) {
+        const char *path = g_ptr_array_index(data->missing, i);
+
+        gbb_log_index_remove(loader->index, path);
+        g_signal_emit(loader, signals[REMOVED], 0, path);
+    }
+
+    /* Logs the index is up to date on haven't really changed */
+    loader_queue_jobs(loader, data->jobs, FALSE);
+    data->jobs = NULL;
+}
+
+static gboolean
+on_settle_timeout(gpointer user_data)
+{
+    GbbLogLoader *loader = user_data;
+    StatData *data = g_slice_new0(StatData);
+    GHashTableIter iter;
+    gpointer key;
+
+    loader->settle_timeout = 0;
+
+    data->paths = g_ptr_array_new_with_free_func(g_free);
+    g_hash_table_iter_init(&iter, loader->changed);
+    while (g_hash_table_iter_next(&iter, &key, NULL)) {
+        g_ptr_array_add(data->paths, key);
+        g_hash_table_iter_steal(&iter);
+    }
+
+    GTask *task = g_task_new(loader, loader->cancellable, on_logs_statted, NULL);
+    g_task_set_task_data(task, data, (GDestroyNotify)stat_data_free);
+    g_task_run_in_thread(task, stat_logs_thread);
+    g_object_unref(task);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+loader_file_changed(GbbLogLoader *loader,
+                    GFile        *file)
+{
+    char *path;
+
+    if (file == NULL)
+        return;
+
+    path = g_file_get_path(file);
+    if (path == NULL || !gbb_test_run_is_log_filename(path)) {
+        g_free(path);
+        return;
+    }
+
+    /* Whether it was added, changed or removed is sorted out when
+     * things have settled down */
+    g_hash_table_add(loader->changed, path);
+
+    if (loader->settle_timeout)
+        g_source_remove(loader->settle_timeout);
+    loader->settle_timeout = g_timeout_add(WATCH_SETTLE_TIME, on_settle_timeout, loader);
+}
+
+static void
+on_folder_changed(GFileMonitor      *monitor,
+                  GFile             *file,
+                  GFile             *other_file,
+                  GFileMonitorEvent  event_type,
+                  GbbLogLoader      *loader)
+{
+    switch (event_type) {
+    case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+    case G_FILE_MONITOR_EVENT_CREATED:
+    case G_FILE_MONITOR_EVENT_DELETED:
+    case G_FILE_MONITOR_EVENT_MOVED_IN:
+    case G_FILE_MONITOR_EVENT_MOVED_OUT:
+        loader_file_changed(loader, file);
+        break;
+    case G_FILE_MONITOR_EVENT_RENAMED:
+        loader_file_changed(loader, file);
+        loader_file_changed(loader, other_file);
+        break;
+    default:
+        /* CHANGED comes many times while a file is written; we
+         * wait for CHANGES_DONE_HINT */
+        break;
+    }
+}
+
+void
+gbb_log_loader_start(GbbLogLoader *loader)
+{
+    GError *error = NULL;
+
+    /* Watch first, so nothing added while listing is missed */
+    loader->monitor = g_file_monitor_directory(loader->folder, G_FILE_MONITOR_WATCH_MOVES,
+                                               loader->cancellable, &error);
+    if (loader->monitor) {
+        g_signal_connect(loader->monitor, "changed",
+                         G_CALLBACK(on_folder_changed), loader);
+    } else {
+        g_warning("Can't watch log folder: %s", error->message);
+        g_clear_error(&error);
+    }
+
+    GTask *task = g_task_new(loader, loader->cancellable, on_logs_listed, NULL);
+    g_task_run_in_thread(task, list_logs_thread);
+    g_object_unref(task);
+}
@@ -0,0 +1,35 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __LOG_LOADER_H__
+#define __LOG_LOADER_H__
+
+#include <gio/gio.h>
+
+#include "log-index.h"
+
+G_BEGIN_DECLS
+
+/* Reads the summaries of the logs in a folder without blocking the
+ * main loop: the folder is listed in a thread, logs that the index
+ * doesn't know about are parsed by a pool of worker threads, and the
+ * results come back to the main thread in batches.
+ *
+ * ::loaded is emitted with a GPtrArray of GbbLogSummary that is only
+ * valid during the emission; ::finished once all logs are read and
+ * the index is saved.
+ *
+ * After that the folder is watched: logs that are added or changed
+ * come in through ::loaded again, and ::removed is emitted with the
+ * path of each log that is gone.
+ */
+#define GBB_TYPE_LOG_LOADER gbb_log_loader_get_type()
+G_DECLARE_FINAL_TYPE(GbbLogLoader, gbb_log_loader, GBB, LOG_LOADER, GObject)
+
+/* index_path is where the GbbLogIndex of the folder is kept */
+GbbLogLoader *gbb_log_loader_new   (GFile        *folder,
+                                    const char   *index_path);
+void          gbb_log_loader_start (GbbLogLoader *loader);
+
+G_END_DECLS
+
+#endif /* __LOG_LOADER_H__ */
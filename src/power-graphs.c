@@ -5,6 +5,27 @@
 #include "power-graphs.h"
 #include "util-gtk.h"
 
+/* Long runs have many more samples than the charts have pixels, so
+ * the samples are reduced to the first, last, minimum and maximum
+ * value falling into each pixel column; that is all that is needed
+ * to draw the same line. The reduction is kept between draws and
+ * only extended with the samples added since.
+ */
+typedef struct {
+    double first;
+    double last;
+    double min;
+    double max;
+    guint n_points;
+} ChartColumn;
+
+typedef struct {
+    int width;
+    double max_x;
+    guint n_states;  /* history entries already reduced */
+    GArray *columns; /* ChartColumn */
+} ChartCache;
+
 struct _GbbPowerGraphs {
     GtkGrid parent;
 
@@ -21,6 +42,10 @@ struct _GbbPowerGraphs {
 
     GbbTestRun *run;
 
+    ChartCache power_cache;
+    ChartCache percentage_cache;
+    ChartCache life_cache;
+
     double max_x;
     double max_y_power;
     double max_y_life;
@@ -135,9 +160,9 @@ update_chart_ranges(GbbPowerGraphs *graphs)
             const GbbPowerState *last_state = gbb_test_run_get_last_state(graphs->run);
 
             if (start_state != last_state) {
-                GbbPowerStatistics *stats = gbb_power_statistics_compute(start_state, last_state);
-                graphs->max_x = round_up_time(stats->battery_life);
-                gbb_power_statistics_free(stats);
+                GbbPowerStatistics stats;
+                gbb_power_statistics_init(&stats, start_state, last_state);
+                graphs->max_x = round_up_time(stats.battery_life);
             }
         }
         break;
@@ -151,6 +176,60 @@ update_chart_ranges(GbbPowerGraphs *graphs)
     redraw_graphs(graphs);
 }
 
+static void
+chart_cache_init(ChartCache *cache)
+{
+    cache->columns = g_array_new(FALSE, TRUE, sizeof(ChartColumn));
+    cache->n_states = 0;
+}
+
+static void
+chart_cache_clear(ChartCache *cache)
+{
+    g_array_set_size(cache->columns, 0);
+    cache->n_states = 0;
+}
+
+static void
+chart_cache_update(ChartCache   *cache,
+                   int           width,
+                   double        max_x,
+                   const gint64 *times,
+                   const double *values,
+                   guint         n_states)
+{
+    guint i;
+
+    if (cache->width != width || cache->max_x != max_x || n_states < cache->n_states) {
+        chart_cache_clear(cache);
+        cache->width = width;
+        cache->max_x = max_x;
+    }
+
+    /* The first entry has no derived value */
+    for (i = MAX(1, cache->n_states); i < n_states; i++) {
+        double x = width * (times[i] - times[0]) / 1000000. / max_x;
+        guint c = x > 0 ? (guint) x : 0;
+        double v = values[i];
+        ChartColumn *column;
+
+        if (c >= cache->columns->len)
+            g_array_set_size(cache->columns, c + 1);
+
+        column = &g_array_index(cache->columns, ChartColumn, c);
+        if (column->n_points == 0) {
+            column->first = column->min = column->max = v;
+        } else {
+            column->min = MIN(column->min, v);
+            column->max = MAX(column->max, v);
+        }
+        column->last = v;
+        column->n_points++;
+    }
+
+    cache->n_states = n_states;
+}
+
 static void
 on_chart_area_draw (GtkWidget      *chart_area,
                     cairo_t        *cr,
@@ -255,38 +334,54 @@ on_chart_area_draw (GtkWidget      *chart_area,
     if (!graphs->run)
         return;
 
-    GQueue *history = gbb_test_run_get_history(graphs->run);
-    if (!history->head && history->head == history->tail)
+    const GbbPowerHistory *history = gbb_test_run_get_history(graphs->run);
+    guint n_states = gbb_power_history_get_length(history);
+    if (n_states < 2)
         return;
 
-    GbbPowerState *start_state = history->head->data;
-    GbbPowerState *last_state = history->head->data;
-    GList *l;
-    for (l = history->head->next; l; l = l->next) {
-        GbbPowerState *state = l->data;
-        double v;
-
-        if (chart_area == graphs->power_area) {
-            GbbPowerStatistics *interval_stats = gbb_power_statistics_compute(last_state, state);
-            v = interval_stats->power / graphs->max_y_power;
-            gbb_power_statistics_free(interval_stats);
-        } else if (chart_area == graphs->percentage_area) {
-            v = gbb_power_state_get_percent(state) / 100;
-        } else {
-            GbbPowerStatistics *overall_stats = gbb_power_statistics_compute(start_state, state);
-            v = overall_stats->battery_life / graphs->max_y_life;
-            gbb_power_statistics_free(overall_stats);
-        }
+    const gint64 *times = gbb_power_history_get_times(history);
+    const double *values;
+    ChartCache *cache;
+    double scale;
+
+    if (chart_area == graphs->power_area) {
+        values = gbb_test_run_get_power_series(graphs->run);
+        cache = &graphs->power_cache;
+        scale = 1 / graphs->max_y_power;
+    } else if (chart_area == graphs->percentage_area) {
+        values = gbb_test_run_get_percent_series(graphs->run);
+        cache = &graphs->percentage_cache;
+        scale = 1 / 100.;
+    } else {
+        values = gbb_test_run_get_life_series(graphs->run);
+        cache = &graphs->life_cache;
+        scale = 1 / graphs->max_y_life;
+    }
+
+    chart_cache_update(cache, allocation.width, graphs->max_x,
+                       times, values, n_states);
+
+    gboolean started = FALSE;
+    guint c;
+    for (c = 0; c < cache->columns->len; c++) {
+        const ChartColumn *column = &g_array_index(cache->columns, ChartColumn, c);
+        double x = c + 0.5;
 
-        double x = allocation.width * (state->time_us - start_state->time_us) / 1000000. / graphs->max_x;
-        double y = (1 - v) * allocation.height;
+        if (column->n_points == 0)
+            continue;
 
-        if (l == history->head->next)
-            cairo_move_to(cr, x, y);
-        else
-            cairo_line_to(cr, x, y);
+        if (!started) {
+            cairo_move_to(cr, x, (1 - column->first * scale) * allocation.height);
+            started = TRUE;
+        } else {
+            cairo_line_to(cr, x, (1 - column->first * scale) * allocation.height);
+        }
 
-        last_state = state;
+        if (column->n_points > 1) {
+            cairo_line_to(cr, x, (1 - column->max * scale) * allocation.height);
+            cairo_line_to(cr, x, (1 - column->min * scale) * allocation.height);
+            cairo_line_to(cr, x, (1 - column->last * scale) * allocation.height);
+        }
     }
 
     cairo_set_source_rgb(cr, 0, 0, 0.8);
@@ -300,6 +395,10 @@ gbb_power_graphs_finalize(GObject *object)
 
     gbb_power_graphs_set_test_run(graphs, NULL);
 
+    g_array_unref(graphs->power_cache.columns);
+    g_array_unref(graphs->percentage_cache.columns);
+    g_array_unref(graphs->life_cache.columns);
+
     G_OBJECT_CLASS(gbb_power_graphs_parent_class)->finalize(object);
 }
 
@@ -308,6 +407,10 @@ gbb_power_graphs_init(GbbPowerGraphs *graphs)
 {
     gtk_widget_init_template(GTK_WIDGET (graphs));
 
+    chart_cache_init(&graphs->power_cache);
+    chart_cache_init(&graphs->percentage_cache);
+    chart_cache_init(&graphs->life_cache);
+
     g_signal_connect(graphs->power_area, "draw",
                     G_CALLBACK(on_chart_area_draw),
                      graphs);
@@ -368,6 +471,10 @@ gbb_power_graphs_set_test_run(GbbPowerGraphs *graphs,
         g_clear_object(&graphs->run);
     }
 
+    chart_cache_clear(&graphs->power_cache);
+    chart_cache_clear(&graphs->percentage_cache);
+    chart_cache_clear(&graphs->life_cache);
+
     if (run) {
         graphs->run = g_object_ref(run);
         g_signal_connect(graphs->run, "updated",
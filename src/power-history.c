@@ -0,0 +1,155 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include "power-history.h"
+
+#define INITIAL_SIZE 64
+
+struct _GbbPowerHistory {
+    guint length;
+    guint allocated;
+
+    gint64 *time_us;
+    double *energy_now;
+    double *energy_full;
+    double *energy_full_design;
+    guint8 *online;
+    /* NULL until a state has a value for the domain */
+    double *rapl_energy[GBB_RAPL_N_DOMAINS];
+};
+
+GbbPowerHistory *
+gbb_power_history_new(void)
+{
+    return g_slice_new0(GbbPowerHistory);
+}
+
+void
+gbb_power_history_free(GbbPowerHistory *history)
+{
+    int d;
+
+    g_free(history->time_us);
+    g_free(history->energy_now);
+    g_free(history->energy_full);
+    g_free(history->energy_full_design);
+    g_free(history->online);
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++)
+        g_free(history->rapl_energy[d]);
+
+    g_slice_free(GbbPowerHistory, history);
+}
+
+static void
+history_grow(GbbPowerHistory *history)
+{
+    int d;
+
+    history->allocated = MAX(INITIAL_SIZE, 2 * history->allocated);
+
+    history->time_us = g_renew(gint64, history->time_us, history->allocated);
+    history->energy_now = g_renew(double, history->energy_now, history->allocated);
+    history->energy_full = g_renew(double, history->energy_full, history->allocated);
+    history->energy_full_design = g_renew(double, history->energy_full_design, history->allocated);
+    history->online = g_renew(guint8, history->online, history->allocated);
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++) {
+        if (history->rapl_energy[d])
+            history->rapl_energy[d] = g_renew(double, history->rapl_energy[d], history->allocated);
+    }
+}
+
+void
+gbb_power_history_append(GbbPowerHistory     *history,
+                         const GbbPowerState *state)
+{
+    guint i;
+    int d;
+
+    if (history->length == history->allocated)
+        history_grow(history);
+
+    i = history->length++;
+
+    history->time_us[i] = state->time_us;
+    history->energy_now[i] = state->energy_now;
+    history->energy_full[i] = state->energy_full;
+    history->energy_full_design[i] = state->energy_full_design;
+    history->online[i] = state->online != FALSE;
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++) {
+        if (history->rapl_energy[d] == NULL) {
+            guint j;
+
+            if (state->rapl_energy[d] < 0)
+                continue;
+
+            history->rapl_energy[d] = g_new(double, history->allocated);
+            for (j = 0; j < i; j++)
+                history->rapl_energy[d][j] = -1;
+        }
+
+        history->rapl_energy[d][i] = state->rapl_energy[d];
+    }
+}
+
+guint
+gbb_power_history_get_length(const GbbPowerHistory *history)
+{
+    return history->length;
+}
+
+void
+gbb_power_history_get_state(const GbbPowerHistory *history,
+                            guint                  index,
+                            GbbPowerState         *state)
+{
+    int d;
+
+    g_return_if_fail(index < history->length);
+
+    state->time_us = history->time_us[index];
+    state->online = history->online[index];
+    state->energy_now = history->energy_now[index];
+    state->energy_full = history->energy_full[index];
+    state->energy_full_design = history->energy_full_design[index];
+    state->voltage_now = -1.0;
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++)
+        state->rapl_energy[d] = history->rapl_energy[d] ? history->rapl_energy[d][index] : -1;
+}
+
+const gint64 *
+gbb_power_history_get_times(const GbbPowerHistory *history)
+{
+    return history->time_us;
+}
+
+const double *
+gbb_power_history_get_energy_now(const GbbPowerHistory *history)
+{
+    return history->energy_now;
+}
+
+const double *
+gbb_power_history_get_energy_full(const GbbPowerHistory *history)
+{
+    return history->energy_full;
+}
+
+const double *
+gbb_power_history_get_energy_full_design(const GbbPowerHistory *history)
+{
+    return history->energy_full_design;
+}
+
+const guint8 *
+gbb_power_history_get_online(const GbbPowerHistory *history)
+{
+    return history->online;
+}
+
+const double *
+gbb_power_history_get_rapl_energy(const GbbPowerHistory *history,
+                                  GbbRaplDomain          domain)
+{
+    g_return_val_if_fail(domain < GBB_RAPL_N_DOMAINS, NULL);
+
+    return history->rapl_energy[domain];
+}
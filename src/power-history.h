@@ -0,0 +1,38 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __POWER_HISTORY_H__
+#define __POWER_HISTORY_H__
+
+#include <glib.h>
+
+#include "power-monitor.h"
+
+/* A growable, column-oriented list of power states: each field of
+ * GbbPowerState lives in its own contiguous array, so scanning e.g.
+ * all the energy values touches only those.
+ */
+typedef struct _GbbPowerHistory GbbPowerHistory;
+
+GbbPowerHistory *gbb_power_history_new        (void);
+void             gbb_power_history_free       (GbbPowerHistory       *history);
+
+void             gbb_power_history_append     (GbbPowerHistory       *history,
+                                               const GbbPowerState   *state);
+
+guint            gbb_power_history_get_length (const GbbPowerHistory *history);
+void             gbb_power_history_get_state  (const GbbPowerHistory *history,
+                                               guint                  index,
+                                               GbbPowerState         *state);
+
+/* Direct access to the columns; the arrays have get_length() elements
+ * and are only valid until the next append. A RAPL column is NULL when
+ * no state so far had a value for the domain */
+const gint64    *gbb_power_history_get_times              (const GbbPowerHistory *history);
+const double    *gbb_power_history_get_energy_now         (const GbbPowerHistory *history);
+const double    *gbb_power_history_get_energy_full        (const GbbPowerHistory *history);
+const double    *gbb_power_history_get_energy_full_design (const GbbPowerHistory *history);
+const guint8    *gbb_power_history_get_online             (const GbbPowerHistory *history);
+const double    *gbb_power_history_get_rapl_energy        (const GbbPowerHistory *history,
+                                                           GbbRaplDomain          domain);
+
+#endif /* __POWER_HISTORY_H__ */
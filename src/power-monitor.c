@@ -1,21 +1,84 @@
 /* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
 
+#include <math.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
 
 #include <gio/gio.h>
+#include <gudev/gudev.h>
 
 #include "power-monitor.h"
+#include "power-rapl.h"
+#include "power-source.h"
 #include "power-supply.h"
+#include "util-clock.h"
+#include "util-sysfs.h"
 
-/* Time between reading values out of proc (ms) */
+/* Time between reading values out of proc (ms) while we don't know
+ * when the firmware is going to update them */
 #define UPDATE_FREQUENCY 250
 
+/* Once the update cadence of a battery is known we read just after
+ * the expected update; this is how long after (ms) */
+#define ALIGN_MARGIN 40
+
+/* When nothing changes for this long (s) we fall back to a coarse
+ * timer that can be coalesced with other wakeups */
+#define LEARN_TIMEOUT 30
+#define IDLE_INTERVAL 1
+
+/* Number of expected updates that can go by without a change before
+ * we consider the cadence lost */
+#define MAX_MISSED 3
+
+/* Upper bound for the time between two reads (s) */
+#define MAX_INTERVAL 30
+
+typedef enum {
+    CADENCE_LEARNING,
+    CADENCE_LOCKED,
+    CADENCE_MISSED,
+    CADENCE_IDLE
+} CadenceMode;
+
+/* What we learned about when a battery updates its values */
+typedef struct {
+    CadenceMode mode;
+    double energy;
+    gint64 mode_start_us;
+    gint64 last_change_us;  /* estimated time of the last update */
+    gint64 candidate_us;    /* interval seen while learning */
+    gint64 period_us;
+    gint64 next_update_us;  /* expected time of the next update */
+    int n_missed;
+} BatteryCadence;
+
+typedef struct {
+    GbbPowerSource *source;
+    double update_interval; /* s, see GbbPowerSourceInterface */
+    BatteryCadence cadence; /* if the interval is unknown */
+} MonitorSource;
+
 struct _GbbPowerMonitor {
     GObject parent;
-    GList *batteries;
-    GList *adapters;
+    MonitorSource *sources;
+    guint n_sources;
     GbbPowerState current_state;
     guint update_timeout;
+
+    GUdevClient *udev_client;
+    gint64 last_read_us;
+    /* As of last_read_us, -1 if not known */
+    double last_rapl_energy[GBB_RAPL_N_DOMAINS];
+
+    /* Self-overhead accounting */
+    gint64 overhead_start_us;
+    guint64 n_wakeups;
+    guint64 n_reads;
+    guint64 n_syscalls;
+    double cpu_time;
+    struct rusage start_usage;
 };
 
 struct _GbbPowerMonitorClass {
@@ -60,38 +123,40 @@ gbb_power_statistics_free (GbbPowerStatistics *statistics)
 }
 
 
-static gboolean
-find_power_supplies(GbbPowerMonitor *monitor,
-                    GCancellable *cancellable,
-                    GError      **error)
+static GList *
+find_power_sources(GError **error)
 {
-
     GList *supplies;
     GList *l;
+    GbbRapl *rapl;
+    gboolean have_battery = FALSE;
+    gboolean have_mains = FALSE;
 
     supplies = gbb_power_supply_discover();
 
     for (l = supplies; l != NULL; l = l->next) {
         if (GBB_IS_BATTERY(l->data)) {
-            monitor->batteries = g_list_prepend(monitor->batteries, l->data);
+            have_battery = TRUE;
         } else if (GBB_IS_MAINS(l->data)) {
-            monitor->adapters = g_list_prepend(monitor->adapters, l->data);
+            have_mains = TRUE;
         } else {
             g_assert_not_reached();
         }
     }
 
-    g_list_free(supplies);
-
-    if (monitor->batteries == NULL) {
+    if (!have_battery) {
         g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED,
                             "No batteries found!");
-    } else if (monitor->adapters == NULL) {
+    } else if (!have_mains) {
         g_set_error_literal(error, G_IO_ERROR, G_IO_ERROR_FAILED,
                             "No power adapter found!");
     }
 
-    return *error == NULL;
+    rapl = gbb_rapl_discover();
+    if (rapl)
+        supplies = g_list_append(supplies, rapl);
+
+    return supplies;
 }
 
 static void
@@ -99,8 +164,15 @@ gbb_power_monitor_finalize(GObject *object)
 {
     GbbPowerMonitor *monitor = GBB_POWER_MONITOR(object);
 
-    g_list_foreach(monitor->batteries, (GFunc)g_object_unref, NULL);
-    g_list_foreach(monitor->adapters, (GFunc)g_object_unref, NULL);
+    if (monitor->update_timeout)
+        gbb_clock_source_remove(monitor->update_timeout);
+
+    g_clear_object(&monitor->udev_client);
+
+    guint i;
+    for (i = 0; i < monitor->n_sources; i++)
+        g_object_unref(monitor->sources[i].source);
+    g_free(monitor->sources);
 
     G_OBJECT_CLASS(gbb_power_monitor_parent_class)->finalize(object);
 }
@@ -108,6 +180,10 @@ gbb_power_monitor_finalize(GObject *object)
 static void
 gbb_power_monitor_init(GbbPowerMonitor *monitor)
 {
+    int d;
+
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++)
+        monitor->last_rapl_energy[d] = -1;
 }
 
 static void
@@ -135,15 +211,20 @@ add_to (double *total, double  increment)
         *total = increment;
 }
 
-static void
+void
 gbb_power_state_init(GbbPowerState *state)
 {
+    int i;
+
     state->time_us = 0;
     state->online = FALSE;
     state->energy_now = -1.0;
     state->energy_full = -1.0;
     state->energy_full_design = -1.0;
     state->voltage_now = -1.0;
+
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++)
+        state->rapl_energy[i] = -1.0;
 }
 
 GbbPowerState *
@@ -160,57 +241,300 @@ gbb_power_state_copy(const GbbPowerState *state)
     return g_slice_dup(GbbPowerState, state);
 }
 
+static double
+thread_cpu_time(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+timeval_to_seconds(const struct timeval *tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void
+cadence_set_mode(BatteryCadence *cadence,
+                 CadenceMode     mode,
+                 gint64          now)
+{
+    if (cadence->mode == mode)
+        return;
+
+    cadence->mode = mode;
+    cadence->mode_start_us = now;
+}
+
+static gint64
+cadence_tolerance(gint64 period_us)
+{
+    /* While learning we poll, so we only know an update time to
+     * within one polling interval */
+    return MAX(UPDATE_FREQUENCY * 1000, period_us / 10);
+}
+
+/* Feeds a new reading of a battery taken at read_us into what we know
+ * about its cadence; returns the estimated time of the update if the
+ * value changed since prev_read_us, 0 otherwise */
+static gint64
+cadence_observe(BatteryCadence *cadence,
+                double          energy,
+                gint64          prev_read_us,
+                gint64          read_us)
+{
+    gint64 change_us;
+
+    if (prev_read_us == 0) {
+        cadence->energy = energy;
+        cadence->mode = CADENCE_LEARNING;
+        cadence->mode_start_us = read_us;
+        return 0;
+    }
+
+    if (energy == cadence->energy) {
+        switch (cadence->mode) {
+        case CADENCE_LEARNING:
+            if (read_us - cadence->mode_start_us > LEARN_TIMEOUT * 1000000LL)
+                cadence_set_mode(cadence, CADENCE_IDLE, read_us);
+            break;
+        case CADENCE_LOCKED:
+            if (read_us >= cadence->next_update_us)
+                cadence_set_mode(cadence, CADENCE_MISSED, read_us);
+            break;
+        case CADENCE_MISSED:
+            /* A whole period went by; firmware sometimes reports the
+             * same value again, so try the next slot before giving up */
+            if (read_us > cadence->next_update_us + cadence->period_us / 2) {
+                cadence->next_update_us += cadence->period_us;
+                if (++cadence->n_missed >= MAX_MISSED) {
+                    cadence->period_us = 0;
+                    cadence_set_mode(cadence, CADENCE_IDLE, read_us);
+                } else {
+                    cadence_set_mode(cadence, CADENCE_LOCKED, read_us);
+                }
+            }
+            break;
+        case CADENCE_IDLE:
+            break;
+        }
+
+        return 0;
+    }
+
+    /* The update happened somewhere in (prev_read_us, read_us] */
+    if (cadence->mode == CADENCE_LOCKED)
+        change_us = CLAMP(cadence->next_update_us, prev_read_us + 1, read_us);
+    else
+        change_us = prev_read_us + (read_us - prev_read_us) / 2;
+
+    if (cadence->mode == CADENCE_IDLE || cadence->last_change_us == 0) {
+        /* Coarse timing, not good enough to learn from */
+        cadence->candidate_us = 0;
+        cadence->period_us = 0;
+        cadence_set_mode(cadence, CADENCE_LEARNING, read_us);
+    } else {
+        gint64 interval = change_us - cadence->last_change_us;
+
+        if (cadence->period_us > 0) {
+            gint64 n = (interval + cadence->period_us / 2) / cadence->period_us;
+
+            if (n >= 1 && n <= MAX_MISSED &&
+                ABS(interval - n * cadence->period_us) < cadence_tolerance(cadence->period_us)) {
+                cadence->period_us += (interval / n - cadence->period_us) / 8;
+                cadence_set_mode(cadence, CADENCE_LOCKED, read_us);
+            } else {
+                cadence->period_us = 0;
+                cadence->candidate_us = interval;
+                cadence_set_mode(cadence, CADENCE_LEARNING, read_us);
+            }
+        } else if (cadence->candidate_us > 0 &&
+                   ABS(interval - cadence->candidate_us) < cadence_tolerance(cadence->candidate_us)) {
+            cadence->period_us = (interval + cadence->candidate_us) / 2;
+            cadence_set_mode(cadence, CADENCE_LOCKED, read_us);
+        } else {
+            cadence->candidate_us = interval;
+            cadence_set_mode(cadence, CADENCE_LEARNING, read_us);
+        }
+    }
+
+    /* A new update restarts the learning timeout */
+    if (cadence->mode == CADENCE_LEARNING)
+        cadence->mode_start_us = read_us;
+
+    cadence->energy = energy;
+    cadence->last_change_us = change_us;
+    cadence->n_missed = 0;
+
+    if (cadence->mode == CADENCE_LOCKED)
+        cadence->next_update_us = change_us + cadence->period_us;
+
+    return change_us;
+}
+
+/* Time (us) from now until the battery should be read again; if
+ * coarse is set, the read doesn't need to be precise */
+static gint64
+cadence_next_read(BatteryCadence *cadence,
+                  gint64          now,
+                  gboolean       *coarse)
+{
+    gint64 delay;
+
+    *coarse = FALSE;
+
+    switch (cadence->mode) {
+    case CADENCE_LOCKED:
+        delay = cadence->next_update_us + ALIGN_MARGIN * 1000 - now;
+        if (delay > 0)
+            return delay;
+        /* Already behind; poll until we see it */
+        return UPDATE_FREQUENCY * 1000;
+    case CADENCE_IDLE:
+        *coarse = TRUE;
+        return IDLE_INTERVAL * 1000000LL;
+    case CADENCE_LEARNING:
+    case CADENCE_MISSED:
+    default:
+        return UPDATE_FREQUENCY * 1000;
+    }
+}
+
 static GbbPowerState *
 read_state(GbbPowerMonitor *monitor,
            GbbPowerState   *state)
 {
-    GList *l;
     int n_batteries = 0;
+    guint64 syscalls_before = sysfs_attr_get_syscall_count();
+    gint64 previous_read_us = monitor->last_read_us;
+    gint64 change_us = 0;
+    guint i;
+    int d;
 
     gbb_power_state_init(state);
-    state->time_us = g_get_monotonic_time();
+    state->time_us = gbb_clock_get_time();
+
+    for (i = 0; i < monitor->n_sources; i++) {
+        MonitorSource *ms = &monitor->sources[i];
+        GbbPowerState sample;
 
-    for (l = monitor->adapters; l; l = l->next) {
-        GbbMains *mains = l->data;
-        gboolean online = gbb_mains_poll(mains);
+        gbb_power_state_init(&sample);
+        gbb_power_source_read(ms->source, &sample);
 
-        if (online)
+        if (sample.online)
             state->online = TRUE;
-    }
 
-    for (l = monitor->batteries; l; l = l->next) {
-        GbbBattery *battery = l->data;
-        double energy_now = gbb_battery_poll(battery);
-        double energy_full = -1.0;
-        double energy_full_design = -1.0;
+        /* Continuous sources such as the RAPL counters are cumulative,
+         * so they are just sampled along, and brought to the time stamp
+         * of the battery reading below */
+        for (d = 0; d < GBB_RAPL_N_DOMAINS; d++) {
+            if (sample.rapl_energy[d] >= 0)
+                add_to (&state->rapl_energy[d], sample.rapl_energy[d]);
+        }
 
-        g_object_get(battery,
-                     "energy-full", &energy_full,
-                     "energy-full-design", &energy_full_design,
-                     NULL);
+        /* A failed read (NAN) still counts as a battery */
+        if (!(sample.energy_now >= 0 || isnan(sample.energy_now)))
+            continue;
+
+        if (ms->update_interval < 0) {
+            gint64 battery_change_us = cadence_observe(&ms->cadence, sample.energy_now,
+                                                       monitor->last_read_us, state->time_us);
+            /* Better than our estimate, if the source knows */
+            if (battery_change_us != 0 && sample.time_us != 0)
+                battery_change_us = sample.time_us;
+            change_us = MAX(change_us, battery_change_us);
+        }
 
-        add_to (&state->energy_now, energy_now);
-        add_to (&state->energy_full, energy_full);
+        add_to (&state->energy_now, sample.energy_now);
+        add_to (&state->energy_full, sample.energy_full);
 
-        if (energy_full_design >= 0) {
+        if (sample.energy_full_design >= 0) {
             if (n_batteries == 0 || state->energy_full_design >= 0)
-                add_to (&state->energy_full_design, energy_full_design);
+                add_to (&state->energy_full_design, sample.energy_full_design);
         } else {
             state->energy_full_design = -1;
         }
 
-        state->voltage_now = -1.0;
         n_batteries += 1;
     }
 
+    monitor->n_reads++;
+    monitor->n_syscalls += sysfs_attr_get_syscall_count() - syscalls_before;
+    monitor->last_read_us = state->time_us;
+
+    /* Time stamp the state with when the battery actually updated
+     * rather than when we happened to look. The counters were read
+     * now, so take them back to then along a straight line from the
+     * previous read, for them to cover the same interval as the
+     * battery. */
+    double fraction = 1.0;
+    if (change_us != 0 && previous_read_us != 0 && state->time_us > previous_read_us)
+        fraction = CLAMP((double)(change_us - previous_read_us) /
+                         (state->time_us - previous_read_us), 0.0, 1.0);
+
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++) {
+        double read_energy = state->rapl_energy[d];
+        double last_energy = monitor->last_rapl_energy[d];
+
+        if (read_energy >= 0 && last_energy >= 0)
+            state->rapl_energy[d] = last_energy + fraction * (read_energy - last_energy);
+        monitor->last_rapl_energy[d] = read_energy;
+    }
+
+    if (change_us != 0)
+        state->time_us = change_us;
+
     return state;
 }
 
-static gboolean
-update_timeout(gpointer data)
+static gboolean update_timeout(gpointer data);
+
+static void
+schedule_update(GbbPowerMonitor *monitor)
+{
+    gint64 now = gbb_clock_get_time();
+    gint64 delay = MAX_INTERVAL * 1000000LL;
+    gboolean all_coarse = TRUE;
+    guint i;
+
+    for (i = 0; i < monitor->n_sources; i++) {
+        MonitorSource *ms = &monitor->sources[i];
+        gboolean coarse;
+        gint64 source_delay;
+
+        if (ms->update_interval == GBB_POWER_SOURCE_UPDATE_CONTINUOUS)
+            continue;
+
+        if (ms->update_interval > 0) {
+            /* Values change on a known schedule; read just after */
+            gint64 period_us = ms->update_interval * 1000000;
+            source_delay = period_us - (now % period_us) + ALIGN_MARGIN * 1000;
+            coarse = FALSE;
+        } else {
+            source_delay = cadence_next_read(&ms->cadence, now, &coarse);
+        }
+
+        delay = MIN(delay, source_delay);
+        all_coarse = all_coarse && coarse;
+    }
+
+    if (all_coarse)
+        monitor->update_timeout = gbb_clock_timeout_add_seconds(delay / 1000000, update_timeout, monitor);
+    else
+        monitor->update_timeout = gbb_clock_timeout_add(MAX(1, delay / 1000), update_timeout, monitor);
+}
+
+static void
+update(GbbPowerMonitor *monitor)
 {
-    GbbPowerMonitor *monitor = data;
     GbbPowerState state;
+    double cpu_start = thread_cpu_time();
+
+    monitor->n_wakeups++;
     read_state(monitor, &state);
 
     if (!gbb_power_state_equal(&monitor->current_state, &state)) {
@@ -218,20 +542,98 @@ update_timeout(gpointer data)
         g_signal_emit(monitor, signals[CHANGED], 0);
     }
 
-    return G_SOURCE_CONTINUE;
+    schedule_update(monitor);
+
+    /* Note that this includes the "changed" handlers */
+    monitor->cpu_time += thread_cpu_time() - cpu_start;
+}
+
+static gboolean
+update_timeout(gpointer data)
+{
+    GbbPowerMonitor *monitor = data;
+
+    monitor->update_timeout = 0;
+    update(monitor);
+
+    return G_SOURCE_REMOVE;
+}
+
+/* The kernel sends uevents when AC is (un)plugged and, with some
+ * firmware, when the battery updates; no need to wait for the
+ * scheduled read in that case */
+static void
+on_udev_uevent(GUdevClient     *client,
+               const char      *action,
+               GUdevDevice     *device,
+               GbbPowerMonitor *monitor)
+{
+    if (g_strcmp0(action, "change") != 0)
+        return;
+
+    gbb_power_monitor_update(monitor);
+}
+
+void
+gbb_power_monitor_update(GbbPowerMonitor *monitor)
+{
+    if (monitor->update_timeout) {
+        gbb_clock_source_remove(monitor->update_timeout);
+        monitor->update_timeout = 0;
+    }
+
+    update(monitor);
 }
 
 GbbPowerMonitor *
 gbb_power_monitor_new(void)
 {
-    GbbPowerMonitor *monitor = g_object_new(GBB_TYPE_POWER_MONITOR, NULL);
+    static const gchar *subsystems[] = { "power_supply", NULL };
+    GbbPowerMonitor *monitor;
     GError *error = NULL;
+    GList *sources;
 
-    if (!find_power_supplies(monitor, NULL, &error))
+    sources = find_power_sources(&error);
+    if (error)
         g_error("%s\n", error->message);
 
+    monitor = gbb_power_monitor_new_for_sources(sources);
+    g_list_free_full(sources, g_object_unref);
+
+    /* Only for the real supplies: uevents from the host would add
+     * samples to a simulated or replayed run */
+    monitor->udev_client = g_udev_client_new(subsystems);
+    g_signal_connect(monitor->udev_client, "uevent",
+                     G_CALLBACK(on_udev_uevent), monitor);
+
+    return monitor;
+}
+
+GbbPowerMonitor *
+gbb_power_monitor_new_for_sources(GList *sources)
+{
+    GbbPowerMonitor *monitor = g_object_new(GBB_TYPE_POWER_MONITOR, NULL);
+    GList *l;
+    guint i;
+
+    monitor->n_sources = g_list_length(sources);
+    monitor->sources = g_new0(MonitorSource, monitor->n_sources);
+
+    for (l = sources, i = 0; l; l = l->next, i++) {
+        MonitorSource *ms = &monitor->sources[i];
+
+        ms->source = g_object_ref(l->data);
+        ms->update_interval = gbb_power_source_get_update_interval(ms->source);
+
+        g_debug("Power source %s: resolution %g J, update interval %g s",
+                G_OBJECT_TYPE_NAME(ms->source),
+                gbb_power_source_get_resolution(ms->source),
+                ms->update_interval);
+    }
+
+    gbb_power_monitor_reset_overhead(monitor);
     read_state(monitor, &monitor->current_state);
-    monitor->update_timeout = g_timeout_add(UPDATE_FREQUENCY, update_timeout, monitor);
+    schedule_update(monitor);
 
     return monitor;
 }
@@ -242,20 +644,54 @@ gbb_power_monitor_get_state (GbbPowerMonitor *monitor)
     return &monitor->current_state;
 }
 
-GbbPowerStatistics *
-gbb_power_statistics_compute (const GbbPowerState   *base,
-                              const GbbPowerState   *current)
+void
+gbb_power_monitor_reset_overhead(GbbPowerMonitor *monitor)
+{
+    monitor->overhead_start_us = gbb_clock_get_time();
+    monitor->n_wakeups = 0;
+    monitor->n_reads = 0;
+    monitor->n_syscalls = 0;
+    monitor->cpu_time = 0;
+    getrusage(RUSAGE_SELF, &monitor->start_usage);
+}
+
+void
+gbb_power_monitor_get_overhead(GbbPowerMonitor    *monitor,
+                               GbbMonitorOverhead *overhead)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    overhead->elapsed = (gbb_clock_get_time() - monitor->overhead_start_us) / 1000000.;
+    overhead->n_wakeups = monitor->n_wakeups;
+    overhead->n_reads = monitor->n_reads;
+    overhead->n_syscalls = monitor->n_syscalls;
+    overhead->cpu_time = monitor->cpu_time;
+    overhead->process_cpu_time =
+        timeval_to_seconds(&usage.ru_utime) - timeval_to_seconds(&monitor->start_usage.ru_utime) +
+        timeval_to_seconds(&usage.ru_stime) - timeval_to_seconds(&monitor->start_usage.ru_stime);
+    overhead->n_context_switches = usage.ru_nvcsw - monitor->start_usage.ru_nvcsw;
+}
+
+void
+gbb_power_statistics_init (GbbPowerStatistics    *statistics,
+                           const GbbPowerState   *base,
+                           const GbbPowerState   *current)
 {
-    GbbPowerStatistics *statistics = g_slice_new(GbbPowerStatistics);
     statistics->power = -1;
     statistics->current = -1;
     statistics->battery_life = -1;
     statistics->battery_life_design = -1;
 
+    int i;
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++)
+        statistics->rapl_power[i] = -1;
+
     double time_elapsed = (current->time_us - base->time_us) / 1000000.;
 
     if (time_elapsed < (UPDATE_FREQUENCY / 1000.)) {
-        return statistics;
+        return;
     }
 
     double energy_used = base->energy_now - current->energy_now;
@@ -267,5 +703,17 @@ gbb_power_statistics_compute (const GbbPowerState   *base,
             statistics->battery_life_design = 3600 * base->energy_full_design / statistics->power;
     }
 
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++) {
+        if (base->rapl_energy[i] >= 0 && current->rapl_energy[i] >= 0)
+            statistics->rapl_power[i] = (current->rapl_energy[i] - base->rapl_energy[i]) / time_elapsed;
+    }
+}
+
+GbbPowerStatistics *
+gbb_power_statistics_compute (const GbbPowerState   *base,
+                              const GbbPowerState   *current)
+{
+    GbbPowerStatistics *statistics = g_slice_new(GbbPowerStatistics);
+    gbb_power_statistics_init(statistics, base, current);
     return statistics;
 }
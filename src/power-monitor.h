@@ -3,10 +3,13 @@
 
 #include <glib.h>
 
+#include "power-rapl.h"
+
 typedef struct _GbbPowerMonitor      GbbPowerMonitor;
 typedef struct _GbbPowerMonitorClass GbbPowerMonitorClass;
 typedef struct _GbbPowerState        GbbPowerState;
 typedef struct _GbbPowerStatistics   GbbPowerStatistics;
+typedef struct _GbbMonitorOverhead   GbbMonitorOverhead;
 
 #define GBB_TYPE_POWER_MONITOR         (gbb_power_monitor_get_type ())
 #define GBB_POWER_MONITOR(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GBB_TYPE_POWER_MONITOR, GbbPowerMonitor))
@@ -22,6 +25,10 @@ struct _GbbPowerState {
     double energy_full;
     double energy_full_design;
     double voltage_now;
+
+    /* J used per RAPL domain since the monitor was created; only
+     * differences between states are meaningful. -1 if not present */
+    double rapl_energy[GBB_RAPL_N_DOMAINS];
 };
 
 struct _GbbPowerStatistics {
@@ -31,20 +38,49 @@ struct _GbbPowerStatistics {
 
     double battery_life;
     double battery_life_design;
+
+    double rapl_power[GBB_RAPL_N_DOMAINS]; /* W, -1 if unknown */
+};
+
+/* What the monitor itself costs, accumulated since the last call to
+ * gbb_power_monitor_reset_overhead().
+ */
+struct _GbbMonitorOverhead {
+    double  elapsed;            /* s, wall clock time covered */
+    guint64 n_wakeups;          /* timeouts dispatched */
+    guint64 n_reads;            /* power supply reads */
+    guint64 n_syscalls;         /* syscalls issued by those reads */
+    double  cpu_time;           /* s, CPU time spent inside the timeouts */
+    double  process_cpu_time;   /* s, user + system time of the whole process */
+    gint64  n_context_switches; /* voluntary, whole process */
 };
 
 GType               gbb_power_monitor_get_type(void);
 
 GbbPowerMonitor    *gbb_power_monitor_new        (void);
+/* sources is a list of GbbPowerSource, the monitor takes references.
+ * Unlike gbb_power_monitor_new(), it doesn't listen to power_supply
+ * uevents, so it's only updated on the sources' own schedule */
+GbbPowerMonitor    *gbb_power_monitor_new_for_sources (GList *sources);
 
 const GbbPowerState *gbb_power_monitor_get_state (GbbPowerMonitor *monitor);
+/* Reads the sources now rather than at the next scheduled time */
+void                gbb_power_monitor_update    (GbbPowerMonitor *monitor);
+
+void                gbb_power_monitor_reset_overhead (GbbPowerMonitor    *monitor);
+void                gbb_power_monitor_get_overhead   (GbbPowerMonitor    *monitor,
+                                                      GbbMonitorOverhead *overhead);
 
 GbbPowerState      *gbb_power_state_new          (void);
+void                gbb_power_state_init         (GbbPowerState         *state);
 GbbPowerState      *gbb_power_state_copy         (const GbbPowerState   *state);
 void                gbb_power_state_free         (GbbPowerState         *state);
 
 double              gbb_power_state_get_percent  (const GbbPowerState   *state);
 
+void                gbb_power_statistics_init    (GbbPowerStatistics    *statistics,
+                                                  const GbbPowerState   *base,
+                                                  const GbbPowerState   *current);
 GbbPowerStatistics *gbb_power_statistics_compute (const GbbPowerState   *base,
                                                   const GbbPowerState   *current);
 void                gbb_power_statistics_free    (GbbPowerStatistics *statistics);
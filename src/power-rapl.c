@@ -0,0 +1,214 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <string.h>
+
+#include <gudev/gudev.h>
+
+#include "power-rapl.h"
+#include "power-source.h"
+#include "util-sysfs.h"
+
+typedef struct {
+    GbbRaplDomain domain;
+    SysfsAttr *energy_uj;
+    guint64 max_energy_range_uj;
+    guint64 last_uj;
+    guint64 total_uj;
+} RaplZone;
+
+struct _GbbRapl {
+    GObject parent;
+
+    GArray *zones;
+    gboolean present[GBB_RAPL_N_DOMAINS];
+};
+
+static void rapl_source_init (GbbPowerSourceInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GbbRapl, gbb_rapl, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GBB_TYPE_POWER_SOURCE,
+                                              rapl_source_init));
+
+static const char *domain_names[GBB_RAPL_N_DOMAINS] = {
+    "package",
+    "core",
+    "uncore",
+    "dram",
+    "psys"
+};
+
+const char *
+gbb_rapl_domain_get_name(GbbRaplDomain domain)
+{
+    g_return_val_if_fail(domain < GBB_RAPL_N_DOMAINS, NULL);
+
+    return domain_names[domain];
+}
+
+static gboolean
+domain_from_zone_name(const char    *name,
+                      GbbRaplDomain *domain)
+{
+    int i;
+
+    /* Packages are numbered: package-0, package-1, ... */
+    if (g_str_has_prefix(name, "package-")) {
+        *domain = GBB_RAPL_PACKAGE;
+        return TRUE;
+    }
+
+    for (i = GBB_RAPL_CORE; i < GBB_RAPL_N_DOMAINS; i++) {
+        if (strcmp(name, domain_names[i]) == 0) {
+            *domain = i;
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+GbbRapl *
+gbb_rapl_discover(void)
+{
+    GUdevClient *client;
+    GList *devices;
+    GList *l;
+    GbbRapl *rapl = g_object_new(GBB_TYPE_RAPL, NULL);
+
+    client = g_udev_client_new(NULL);
+    devices = g_udev_client_query_by_subsystem(client, "powercap");
+
+    for (l = devices; l != NULL; l = l->next) {
+        GUdevDevice *device = l->data;
+        const char *zone_name;
+        RaplZone zone = { 0, };
+
+        /* intel-rapl-mmio:N mirrors the package zone of intel-rapl:N,
+         * and the bare intel-rapl control type has no counter */
+        if (!g_str_has_prefix(g_udev_device_get_name(device), "intel-rapl:"))
+            continue;
+
+        zone_name = g_udev_device_get_sysfs_attr(device, "name");
+        if (zone_name == NULL || !domain_from_zone_name(zone_name, &zone.domain)) {
+            g_warning("Unknown RAPL zone '%s'. Skipping.",
+                      zone_name ? zone_name : g_udev_device_get_name(device));
+            continue;
+        }
+
+        if (!sysfs_read_guint64(device, "max_energy_range_uj", &zone.max_energy_range_uj))
+            zone.max_energy_range_uj = 0;
+
+        zone.energy_uj = sysfs_attr_open(device, "energy_uj");
+        if (!sysfs_attr_read_guint64(zone.energy_uj, &zone.last_uj)) {
+            g_debug("Can't read energy of RAPL zone '%s'. Skipping.",
+                    g_udev_device_get_name(device));
+            sysfs_attr_close(zone.energy_uj);
+            continue;
+        }
+
+        rapl->present[zone.domain] = TRUE;
+        g_array_append_val(rapl->zones, zone);
+    }
+
+    g_list_free_full(devices, (GDestroyNotify) g_object_unref);
+    g_object_unref(client);
+
+    if (rapl->zones->len == 0)
+        g_clear_object(&rapl);
+
+    return rapl;
+}
+
+static void
+gbb_rapl_finalize(GObject *object)
+{
+    GbbRapl *rapl = GBB_RAPL(object);
+    guint i;
+
+    for (i = 0; i < rapl->zones->len; i++)
+        sysfs_attr_close(g_array_index(rapl->zones, RaplZone, i).energy_uj);
+
+    g_array_free(rapl->zones, TRUE);
+
+    G_OBJECT_CLASS(gbb_rapl_parent_class)->finalize(object);
+}
+
+static void
+gbb_rapl_init(GbbRapl *rapl)
+{
+    rapl->zones = g_array_new(FALSE, TRUE, sizeof(RaplZone));
+}
+
+static void
+gbb_rapl_class_init(GbbRaplClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+    gobject_class->finalize = gbb_rapl_finalize;
+}
+
+static void
+zone_update(RaplZone *zone)
+{
+    guint64 value;
+
+    /* On a failed read we just pick up the difference next time */
+    if (!sysfs_attr_read_guint64(zone->energy_uj, &value))
+        return;
+
+    if (value >= zone->last_uj) {
+        zone->total_uj += value - zone->last_uj;
+    } else if (zone->max_energy_range_uj > zone->last_uj) {
+        /* The counter wrapped around since the last read */
+        zone->total_uj += zone->max_energy_range_uj - zone->last_uj + value;
+    } else {
+        zone->total_uj += value;
+    }
+
+    zone->last_uj = value;
+}
+
+void
+gbb_rapl_read(GbbRapl *rapl,
+              double  *energy)
+{
+    guint i;
+
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++)
+        energy[i] = rapl->present[i] ? 0 : -1.0;
+
+    for (i = 0; i < rapl->zones->len; i++) {
+        RaplZone *zone = &g_array_index(rapl->zones, RaplZone, i);
+
+        zone_update(zone);
+        energy[zone->domain] += zone->total_uj / 1000000.;
+    }
+}
+
+static void
+rapl_source_read(GbbPowerSource *source,
+                 GbbPowerState  *state)
+{
+    gbb_rapl_read(GBB_RAPL(source), state->rapl_energy);
+}
+
+static double
+rapl_source_get_resolution(GbbPowerSource *source)
+{
+    /* energy_uj; the hardware unit is usually coarser */
+    return 1 / 1000000.;
+}
+
+static double
+rapl_source_get_update_interval(GbbPowerSource *source)
+{
+    return GBB_POWER_SOURCE_UPDATE_CONTINUOUS;
+}
+
+static void
+rapl_source_init(GbbPowerSourceInterface *iface)
+{
+    iface->read = rapl_source_read;
+    iface->get_resolution = rapl_source_get_resolution;
+    iface->get_update_interval = rapl_source_get_update_interval;
+}
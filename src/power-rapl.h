@@ -0,0 +1,36 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __POWER_RAPL_H__
+#define __POWER_RAPL_H__
+
+#include <glib-object.h>
+
+/* The RAPL (Running Average Power Limit) energy counters that the
+ * kernel exports through the powercap class. Zones of the same kind
+ * (e.g. the packages of a multi-socket system) are summed together.
+ */
+typedef enum {
+    GBB_RAPL_PACKAGE,
+    GBB_RAPL_CORE,
+    GBB_RAPL_UNCORE,
+    GBB_RAPL_DRAM,
+    GBB_RAPL_PSYS,
+    GBB_RAPL_N_DOMAINS
+} GbbRaplDomain;
+
+/* Also a GbbPowerSource, filling in GbbPowerState.rapl_energy */
+#define GBB_TYPE_RAPL gbb_rapl_get_type()
+G_DECLARE_FINAL_TYPE(GbbRapl, gbb_rapl, GBB, RAPL, GObject)
+
+/* Returns NULL if there are no readable RAPL zones; energy_uj is only
+ * readable by root on recent kernels */
+GbbRapl    *gbb_rapl_discover         (void);
+
+/* Energy used (J) per domain since gbb_rapl_discover(), with counter
+ * wraparound accounted for; -1 for domains that aren't present */
+void        gbb_rapl_read             (GbbRapl       *rapl,
+                                       double        *energy);
+
+const char *gbb_rapl_domain_get_name  (GbbRaplDomain  domain);
+
+#endif /* __POWER_RAPL_H__ */
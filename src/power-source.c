@@ -0,0 +1,52 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include "power-source.h"
+
+G_DEFINE_INTERFACE(GbbPowerSource, gbb_power_source, G_TYPE_OBJECT)
+
+static void
+gbb_power_source_default_init(GbbPowerSourceInterface *iface)
+{
+}
+
+void
+gbb_power_source_read(GbbPowerSource *source,
+                      GbbPowerState  *state)
+{
+    GbbPowerSourceInterface *iface;
+
+    g_return_if_fail(GBB_IS_POWER_SOURCE(source));
+
+    iface = GBB_POWER_SOURCE_GET_IFACE(source);
+    g_return_if_fail(iface->read != NULL);
+
+    iface->read(source, state);
+}
+
+double
+gbb_power_source_get_resolution(GbbPowerSource *source)
+{
+    GbbPowerSourceInterface *iface;
+
+    g_return_val_if_fail(GBB_IS_POWER_SOURCE(source), 0);
+
+    iface = GBB_POWER_SOURCE_GET_IFACE(source);
+    if (iface->get_resolution == NULL)
+        return 0;
+
+    return iface->get_resolution(source);
+}
+
+double
+gbb_power_source_get_update_interval(GbbPowerSource *source)
+{
+    GbbPowerSourceInterface *iface;
+
+    g_return_val_if_fail(GBB_IS_POWER_SOURCE(source), GBB_POWER_SOURCE_UPDATE_UNKNOWN);
+
+    iface = GBB_POWER_SOURCE_GET_IFACE(source);
+    if (iface->get_update_interval == NULL)
+        return GBB_POWER_SOURCE_UPDATE_UNKNOWN;
+
+    return iface->get_update_interval(source);
+}
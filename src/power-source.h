@@ -0,0 +1,47 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __POWER_SOURCE_H__
+#define __POWER_SOURCE_H__
+
+#include <glib-object.h>
+
+#include "power-monitor.h"
+
+G_BEGIN_DECLS
+
+/* Anything GbbPowerMonitor can sample: the sysfs batteries and AC
+ * adapters, the RAPL counters, or a simulated battery. The monitor
+ * combines the readings of all its sources into one GbbPowerState.
+ */
+#define GBB_TYPE_POWER_SOURCE gbb_power_source_get_type()
+G_DECLARE_INTERFACE(GbbPowerSource, gbb_power_source, GBB, POWER_SOURCE, GObject)
+
+/* Update intervals with a special meaning */
+#define GBB_POWER_SOURCE_UPDATE_CONTINUOUS  0.0  /* can be read at any time */
+#define GBB_POWER_SOURCE_UPDATE_UNKNOWN    -1.0  /* learned by the monitor */
+
+struct _GbbPowerSourceInterface
+{
+    GTypeInterface parent_iface;
+
+    /* Fills in the fields of state that the source knows about; state
+     * has been initialized with gbb_power_state_init(). A source that
+     * knows when its values last changed may set state->time_us */
+    void   (*read)                (GbbPowerSource *source,
+                                   GbbPowerState  *state);
+
+    /* Smallest step of energy the source reports (J), 0 if unknown */
+    double (*get_resolution)      (GbbPowerSource *source);
+
+    /* Time between updates of the values (s), or one of the above */
+    double (*get_update_interval) (GbbPowerSource *source);
+};
+
+void        gbb_power_source_read                (GbbPowerSource *source,
+                                                  GbbPowerState  *state);
+double      gbb_power_source_get_resolution      (GbbPowerSource *source);
+double      gbb_power_source_get_update_interval (GbbPowerSource *source);
+
+G_END_DECLS
+
+#endif /* __POWER_SOURCE_H__ */
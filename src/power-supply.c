@@ -7,6 +7,7 @@
 
 #include "util-sysfs.h"
 
+#include "power-source.h"
 #include "power-supply.h"
 
 typedef struct _GbbPowerSupplyPrivate {
@@ -57,7 +58,8 @@ gbb_power_supply_get_property(GObject    *object,
         break;
 
     case PROP_NAME:
-        name = g_udev_device_get_name(priv->udevice);
+        /* Simulated supplies have no device */
+        name = priv->udevice ? g_udev_device_get_name(priv->udevice) : NULL;
         g_value_set_string(value, name);
         break;
     }
@@ -172,6 +174,8 @@ struct _GbbBattery {
     double energy_full;
     double energy_full_design;
     gboolean use_charge;
+
+    SysfsAttr *energy_now;
 };
 
 enum {
@@ -191,7 +195,11 @@ enum {
 
 static GParamSpec *battery_props[PROP_BAT_LAST] = { NULL, };
 
-G_DEFINE_TYPE(GbbBattery, gbb_battery, GBB_TYPE_POWER_SUPPLY);
+static void     battery_source_init           (GbbPowerSourceInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GbbBattery, gbb_battery, GBB_TYPE_POWER_SUPPLY,
+                        G_IMPLEMENT_INTERFACE(GBB_TYPE_POWER_SOURCE,
+                                              battery_source_init));
 
 static void     voltage_design_initialize     (GbbBattery *battery);
 static void     energy_design_initialize      (GbbBattery *battery);
@@ -204,6 +212,8 @@ gbb_battery_finalize(GObject *obj)
     g_free(bat->vendor);
     g_free(bat->model);
 
+    sysfs_attr_close(bat->energy_now);
+
     G_OBJECT_CLASS(gbb_battery_parent_class)->finalize(obj);
 }
 
@@ -256,6 +266,9 @@ gbb_battery_constructed(GObject *obj)
     voltage_design_initialize(bat);
     energy_design_initialize(bat);
 
+    bat->energy_now = sysfs_attr_open(device,
+                                      bat->use_charge ? "charge_now" : "energy_now");
+
     gbb_battery_poll(bat);
 
     G_OBJECT_CLASS(gbb_battery_parent_class)->constructed(obj);
@@ -392,26 +405,63 @@ energy_design_initialize(GbbBattery *bat)
 double
 gbb_battery_poll(GbbBattery *bat)
 {
-    GbbPowerSupplyPrivate *priv = SUPPLY_GET_PRIV(bat);
-    GUdevDevice *dev = priv->udevice;
     double new_value;
 
+    new_value = sysfs_attr_read_double_scaled(bat->energy_now);
+
     if (bat->use_charge) {
-        new_value = sysfs_read_double_scaled(dev, "charge_now");
         new_value *= bat->voltage_desgin;
-    } else {
-        new_value = sysfs_read_double_scaled(dev, "energy_now");
     }
 
     bat->energy = new_value;
     return new_value;
 }
 
+static void
+battery_source_read(GbbPowerSource *source,
+                    GbbPowerState  *state)
+{
+    GbbBattery *bat = GBB_BATTERY(source);
+
+    state->energy_now = gbb_battery_poll(bat);
+    state->energy_full = bat->energy_full;
+    state->energy_full_design = bat->energy_full_design;
+}
+
+static double
+battery_source_get_resolution(GbbPowerSource *source)
+{
+    GbbBattery *bat = GBB_BATTERY(source);
+
+    /* sysfs reports uWh, or uAh that we convert with the design voltage */
+    if (bat->use_charge)
+        return 3600 * bat->voltage_desgin / 1000000.;
+    else
+        return 3600 / 1000000.;
+}
+
+static double
+battery_source_get_update_interval(GbbPowerSource *source)
+{
+    /* Up to the firmware; the monitor figures it out */
+    return GBB_POWER_SOURCE_UPDATE_UNKNOWN;
+}
+
+static void
+battery_source_init(GbbPowerSourceInterface *iface)
+{
+    iface->read = battery_source_read;
+    iface->get_resolution = battery_source_get_resolution;
+    iface->get_update_interval = battery_source_get_update_interval;
+}
+
 /* ************************************************************************** */
 
 struct _GbbMains {
     GbbPowerSupply parent;
     gboolean online;
+
+    SysfsAttr *online_attr;
 };
 
 enum {
@@ -424,7 +474,21 @@ enum {
 
 static GParamSpec *mains_props[PROP_MAINS_LAST] = { NULL, };
 
-G_DEFINE_TYPE(GbbMains, gbb_mains, GBB_TYPE_POWER_SUPPLY);
+static void     mains_source_init             (GbbPowerSourceInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GbbMains, gbb_mains, GBB_TYPE_POWER_SUPPLY,
+                        G_IMPLEMENT_INTERFACE(GBB_TYPE_POWER_SOURCE,
+                                              mains_source_init));
+
+static void
+gbb_mains_finalize(GObject *obj)
+{
+    GbbMains *mns = GBB_MAINS(obj);
+
+    sysfs_attr_close(mns->online_attr);
+
+    G_OBJECT_CLASS(gbb_mains_parent_class)->finalize(obj);
+}
 
 static void
 gbb_mains_get_property(GObject    *object,
@@ -445,6 +509,9 @@ static void
 gbb_mains_constructed(GObject *obj)
 {
     GbbMains *mns = GBB_MAINS(obj);
+    GbbPowerSupplyPrivate *priv = SUPPLY_GET_PRIV(mns);
+
+    mns->online_attr = sysfs_attr_open(priv->udevice, "online");
     gbb_mains_poll(mns);
 }
 
@@ -459,6 +526,7 @@ gbb_mains_class_init(GbbMainsClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
 
+    gobject_class->finalize     = gbb_mains_finalize;
     gobject_class->get_property = gbb_mains_get_property;
     gobject_class->constructed  = gbb_mains_constructed;
 
@@ -480,9 +548,9 @@ gbb_mains_poll(GbbMains *mns)
     GbbPowerSupplyPrivate *priv = SUPPLY_GET_PRIV(mns);
     GUdevDevice *dev = priv->udevice;
     gboolean ok;
-    guint64 val;
+    guint64 val = 0;
 
-    ok = sysfs_read_guint64(dev, "online", &val);
+    ok = sysfs_attr_read_guint64(mns->online_attr, &val);
 
     if (ok) {
         mns->online = val;
@@ -491,5 +559,27 @@ gbb_mains_poll(GbbMains *mns)
                   g_udev_device_get_sysfs_path(dev));
     }
 
-    return val;
+    /* The last known status if the read failed */
+    return mns->online;
+}
+
+static void
+mains_source_read(GbbPowerSource *source,
+                  GbbPowerState  *state)
+{
+    state->online = gbb_mains_poll(GBB_MAINS(source));
+}
+
+static double
+mains_source_get_update_interval(GbbPowerSource *source)
+{
+    /* Plugging and unplugging is also announced with a uevent */
+    return GBB_POWER_SOURCE_UPDATE_CONTINUOUS;
+}
+
+static void
+mains_source_init(GbbPowerSourceInterface *iface)
+{
+    iface->read = mains_source_read;
+    iface->get_update_interval = mains_source_get_update_interval;
 }
@@ -18,24 +18,35 @@ struct _GbbRemotePlayer {
     GCancellable *cancellable;
 
     GDBusProxy *player_proxy;
-    int pending_fd;
+
+    /* Requests made before the helper's player was available */
+    GSList *pending_loads;
+    char *pending_start;
+    guint pending_loops;
+
     gboolean started;
+    guint iterations;
 };
 
 struct _GbbRemotePlayerClass {
     GbbEventPlayerClass parent_class;
 };
 
+typedef struct {
+    char *name;
+    int fd;
+} PendingLoad;
+
 G_DEFINE_TYPE(GbbRemotePlayer, gbb_remote_player, GBB_TYPE_EVENT_PLAYER);
 
 static void
-close_pending_fd(GbbRemotePlayer *player)
+pending_load_free(PendingLoad *load)
 {
-    if (player->pending_fd != -1) {
-        if (close(player->pending_fd) != 0)
-            die_errno("Error closing file");
-        player->pending_fd = -1;
-    }
+    if (load->fd != -1 && close(load->fd) != 0)
+        die_errno("Error closing file");
+
+    g_free(load->name);
+    g_slice_free(PendingLoad, load);
 }
 
 static void
@@ -43,7 +54,8 @@ gbb_remote_player_finalize(GObject *object)
 {
     GbbRemotePlayer *player = GBB_REMOTE_PLAYER(object);
 
-    close_pending_fd(player);
+    g_slist_free_full(player->pending_loads, (GDestroyNotify)pending_load_free);
+    g_free(player->pending_start);
 
     g_cancellable_cancel(player->cancellable);
     g_clear_object(&player->cancellable);
@@ -58,17 +70,36 @@ static void
 gbb_remote_player_init(GbbRemotePlayer *player)
 {
     player->cancellable = g_cancellable_new();
-    player->pending_fd = -1;
 }
 
 static void
-on_play_reply(GObject      *source_object,
+on_load_reply(GObject      *source_object,
               GAsyncResult *result,
               gpointer      user_data)
 {
     GError *error = NULL;
     GVariant *retval = g_dbus_proxy_call_with_unix_fd_list_finish(G_DBUS_PROXY(source_object),
                                                                   NULL, result, &error);
+    if (error) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_dbus_error_strip_remote_error(error);
+            g_warning("Failed to load event log: %s", error->message);
+        }
+        g_clear_error(&error);
+        return;
+    }
+
+    g_variant_unref(retval);
+}
+
+static void
+on_start_reply(GObject      *source_object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+    GError *error = NULL;
+    GVariant *retval = g_dbus_proxy_call_finish(G_DBUS_PROXY(source_object),
+                                                result, &error);
     if (error) {
         if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
             g_clear_error(&error);
@@ -76,53 +107,111 @@ on_play_reply(GObject      *source_object,
         }
 
         g_dbus_error_strip_remote_error(error);
-        g_warning("Failed to play:s %s", error->message);
+        g_warning("Failed to play: %s", error->message);
         g_clear_error(&error);
-    } else {
-        g_variant_unref(retval);
+
+        /* There won't be a Finished signal */
+        GbbRemotePlayer *player = user_data;
+        player->started = FALSE;
+        gbb_event_player_finished(GBB_EVENT_PLAYER(player));
+        return;
     }
 
-    GbbRemotePlayer *player = user_data;
-    player->started = FALSE;
-    gbb_event_player_finished(GBB_EVENT_PLAYER(player));
+    g_variant_unref(retval);
+}
+
+static void
+remote_player_send_load(GbbRemotePlayer *player,
+                        const char      *name,
+                        int              fd)
+{
+    GUnixFDList *fd_list = g_unix_fd_list_new_from_array(&fd, 1);
+
+    g_dbus_proxy_call_with_unix_fd_list(player->player_proxy, "Load",
+                                        g_variant_new("(sh)", name, 0),
+                                        G_DBUS_CALL_FLAGS_NONE,
+                                        -1,
+                                        fd_list,
+                                        player->cancellable,
+                                        on_load_reply,
+                                        player);
+    g_object_unref(fd_list);
 }
 
 static void
-remote_player_maybe_start(GbbRemotePlayer *player)
+remote_player_send_start(GbbRemotePlayer *player,
+                         const char      *name,
+                         guint            loops)
 {
-    if (gbb_event_player_is_ready(GBB_EVENT_PLAYER(player)) &&
-        player->player_proxy && player->pending_fd != -1)
-    {
-        GUnixFDList *fd_list = g_unix_fd_list_new_from_array(&player->pending_fd, 1);
-        player->pending_fd = -1;
-
-        g_dbus_proxy_call_with_unix_fd_list(player->player_proxy, "Play",
-                                            g_variant_new("(h)", 0),
-                                            G_DBUS_CALL_FLAGS_NONE,
-                                            G_MAXINT,
-                                            fd_list,
-                                            player->cancellable,
-                                            on_play_reply,
-                                            player);
-        g_object_unref(fd_list);
-        player->started = TRUE;
+    /* Messages are handled in order, so this comes after any loads */
+    g_dbus_proxy_call(player->player_proxy, "Start",
+                      g_variant_new("(su)", name, loops),
+                      G_DBUS_CALL_FLAGS_NONE,
+                      -1,
+                      player->cancellable,
+                      on_start_reply,
+                      player);
+}
+
+static void
+remote_player_send_pending(GbbRemotePlayer *player)
+{
+    GSList *l;
+
+    player->pending_loads = g_slist_reverse(player->pending_loads);
+    for (l = player->pending_loads; l; l = l->next) {
+        PendingLoad *load = l->data;
+
+        remote_player_send_load(player, load->name, load->fd);
+        load->fd = -1;
+    }
+    g_slist_free_full(player->pending_loads, (GDestroyNotify)pending_load_free);
+    player->pending_loads = NULL;
+
+    if (player->pending_start) {
+        remote_player_send_start(player, player->pending_start, player->pending_loops);
+        g_clear_pointer(&player->pending_start, g_free);
     }
 }
 
 static void
-gbb_remote_player_play_fd(GbbEventPlayer *event_player,
+gbb_remote_player_load_fd(GbbEventPlayer *event_player,
+                          const char     *name,
                           int             fd)
 {
     GbbRemotePlayer *player = GBB_REMOTE_PLAYER(event_player);
 
-    if (player->pending_fd != -1 || player->started) {
+    if (player->player_proxy) {
+        remote_player_send_load(player, name, fd);
+    } else {
+        PendingLoad *load = g_slice_new(PendingLoad);
+        load->name = g_strdup(name);
+        load->fd = fd;
+        player->pending_loads = g_slist_prepend(player->pending_loads, load);
+    }
+}
+
+static void
+gbb_remote_player_start(GbbEventPlayer *event_player,
+                        const char     *name,
+                        guint           loops)
+{
+    GbbRemotePlayer *player = GBB_REMOTE_PLAYER(event_player);
+
+    if (player->started) {
         g_critical("Player is already playing");
         return;
     }
 
-    player->pending_fd = fd;
+    player->started = TRUE;
+    player->iterations = 0;
 
-    remote_player_maybe_start(player);
+    if (player->player_proxy) {
+        remote_player_send_start(player, name, loops);
+    } else {
+        player->pending_start = g_strdup(name);
+        player->pending_loops = loops;
+    }
 }
 
 static void
@@ -130,9 +219,11 @@ gbb_remote_player_stop(GbbEventPlayer *event_player)
 {
     GbbRemotePlayer *player = GBB_REMOTE_PLAYER(event_player);
 
-    if (player->pending_fd != -1) {
-        close_pending_fd(player);
-    } else {
+    if (player->pending_start) {
+        g_clear_pointer(&player->pending_start, g_free);
+        player->started = FALSE;
+        gbb_event_player_finished(event_player);
+    } else if (player->started) {
         GError *error = NULL;
 
         GVariant *retval = g_dbus_proxy_call_sync(player->player_proxy,
@@ -151,6 +242,37 @@ gbb_remote_player_stop(GbbEventPlayer *event_player)
     }
 }
 
+static void
+gbb_remote_player_get_position(GbbEventPlayer *event_player,
+                               guint          *iteration,
+                               guint          *event)
+{
+    GbbRemotePlayer *player = GBB_REMOTE_PLAYER(event_player);
+    GError *error = NULL;
+
+    *iteration = 0;
+    *event = 0;
+
+    if (!player->started || !player->player_proxy)
+        return;
+
+    GVariant *retval = g_dbus_proxy_call_sync(player->player_proxy,
+                                              "GetPosition",
+                                              NULL,
+                                              G_DBUS_CALL_FLAGS_NONE,
+                                              -1,
+                                              NULL,
+                                              &error);
+    if (error) {
+        g_warning("Error getting remote player position: %s\n", error->message);
+        g_clear_error(&error);
+        return;
+    }
+
+    g_variant_get(retval, "(&suu)", NULL, iteration, event);
+    g_variant_unref(retval);
+}
+
 static void
 gbb_remote_player_class_init(GbbRemotePlayerClass *player_class)
 {
@@ -158,9 +280,45 @@ gbb_remote_player_class_init(GbbRemotePlayerClass *player_class)
     gobject_class->finalize = gbb_remote_player_finalize;
 
     GbbEventPlayerClass *event_player_class = GBB_EVENT_PLAYER_CLASS (player_class);
-    event_player_class->play_fd = gbb_remote_player_play_fd;
+    event_player_class->load_fd = gbb_remote_player_load_fd;
+    event_player_class->start = gbb_remote_player_start;
     event_player_class->stop = gbb_remote_player_stop;
+    event_player_class->get_position = gbb_remote_player_get_position;
+}
 
+static void
+on_player_signal(GDBusProxy *proxy,
+                 const char *sender_name,
+                 const char *signal_name,
+                 GVariant   *parameters,
+                 gpointer    data)
+{
+    GbbRemotePlayer *player = data;
+
+    if (!player->started)
+        return;
+
+    if (g_strcmp0(signal_name, "Progress") == 0) {
+        guint32 iterations;
+
+        /* Iterations may arrive batched; emit ::iteration for each */
+        g_variant_get(parameters, "(u)", &iterations);
+        while (player->started && player->iterations < iterations) {
+            player->iterations++;
+            gbb_event_player_iteration(GBB_EVENT_PLAYER(player));
+        }
+    } else if (g_strcmp0(signal_name, "Finished") == 0) {
+        GVariant *timing_variant;
+        GbbReplayTiming timing;
+
+        g_variant_get(parameters, "(@(uuxuxxau))", &timing_variant);
+        gbb_replay_timing_from_variant(&timing, timing_variant);
+        gbb_event_player_add_replay_timing(GBB_EVENT_PLAYER(player), &timing);
+        g_variant_unref(timing_variant);
+
+        player->started = FALSE;
+        gbb_event_player_finished(GBB_EVENT_PLAYER(player));
+    }
 }
 
 static void
@@ -184,6 +342,8 @@ on_player_proxy_ready_cb(GObject      *source_object,
     GbbRemotePlayer *player = data;
 
     player->player_proxy = player_proxy;
+    g_signal_connect(player->player_proxy, "g-signal",
+                     G_CALLBACK(on_player_signal), player);
 
     GVariant *keyboard_node_variant = g_dbus_proxy_get_cached_property(player->player_proxy,
                                                                        "KeyboardDeviceNode");
@@ -196,7 +356,7 @@ on_player_proxy_ready_cb(GObject      *source_object,
     g_variant_unref(keyboard_node_variant);
     g_variant_unref(mouse_node_variant);
 
-    remote_player_maybe_start(player);
+    remote_player_send_pending(player);
 }
 
 static void
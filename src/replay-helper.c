@@ -1,6 +1,7 @@
 /* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
 
 #include <stdlib.h>
+#include <string.h>
 
 #include <gio/gio.h>
 #include <gio/gunixfdlist.h>
@@ -12,6 +13,11 @@
 
 typedef struct _Player Player;
 
+/* Exit when there have been no players or pending CreatePlayer
+ * calls for this long; we are started again by D-Bus activation
+ * when needed */
+#define IDLE_EXIT_TIMEOUT 60 /* seconds */
+
 struct _Player {
     GDBusConnection *connection;
     char *name;
@@ -21,24 +27,95 @@ struct _Player {
     guint registration_id;
     GbbEventPlayer *player;
 
-    GDBusMethodInvocation *invocation;
-    guint finished_connection;
+    char *playing;
+    guint iterations;
+    guint progress_idle;
 };
 
 int player_serial = 0;
 
+static GMainLoop *main_loop;
+static guint n_players;
+/* CreatePlayer calls waiting on polkit, possibly on a password prompt */
+static guint n_pending_creates;
+static guint idle_exit_timeout;
+
+static gboolean
+on_idle_exit_timeout(gpointer data)
+{
+    idle_exit_timeout = 0;
+    g_main_loop_quit(main_loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+update_idle_exit(void)
+{
+    gboolean busy = n_players > 0 || n_pending_creates > 0;
+
+    if (!busy && idle_exit_timeout == 0) {
+        idle_exit_timeout = g_timeout_add_seconds(IDLE_EXIT_TIMEOUT,
+                                                  on_idle_exit_timeout, NULL);
+    } else if (busy && idle_exit_timeout != 0) {
+        g_source_remove(idle_exit_timeout);
+        idle_exit_timeout = 0;
+    }
+}
+
+static void
+player_emit(Player     *player,
+            const char *signal_name,
+            GVariant   *parameters)
+{
+    GError *error = NULL;
+
+    if (!g_dbus_connection_emit_signal(player->connection,
+                                       player->creator,
+                                       player->path,
+                                       GBB_DBUS_INTERFACE_PLAYER,
+                                       signal_name,
+                                       parameters,
+                                       &error)) {
+        g_warning("Can't emit %s: %s", signal_name, error->message);
+        g_clear_error(&error);
+    }
+}
+
+static void
+player_flush_progress(Player *player)
+{
+    if (player->progress_idle) {
+        g_source_remove(player->progress_idle);
+        player->progress_idle = 0;
+    }
+
+    player_emit(player, "Progress", g_variant_new("(u)", player->iterations));
+}
+
+static gboolean
+on_progress_idle(gpointer data)
+{
+    Player *player = data;
+
+    player->progress_idle = 0;
+    player_flush_progress(player);
+
+    return G_SOURCE_REMOVE;
+}
+
 static void
 player_destroy(Player *player)
 {
-    if (player->invocation) {
-        gbb_event_player_stop(player->player);
-        g_dbus_method_invocation_return_error(player->invocation,
-                                              G_DBUS_ERROR,
-                                              G_DBUS_ERROR_FAILED,
-                                              "Player destroyed during playback");
-        g_signal_handler_disconnect(player->player, player->finished_connection);
+    if (player->player) {
+        g_signal_handlers_disconnect_by_data(player->player, player);
+        if (player->playing)
+            gbb_event_player_stop(player->player);
     }
 
+    if (player->progress_idle)
+        g_source_remove(player->progress_idle);
+
     g_clear_object(&player->player);
 
     g_dbus_connection_signal_unsubscribe(player->connection,
@@ -51,18 +128,117 @@ player_destroy(Player *player)
     g_free(player->name);
     g_free(player->path);
     g_free(player->creator);
+    g_free(player->playing);
     g_slice_free(Player, player);
+
+    n_players--;
+    update_idle_exit();
+}
+
+static void
+on_player_iteration(GbbEventPlayer *event_player,
+                    Player         *player)
+{
+    player->iterations++;
+
+    /* Iterations that complete together go out as one signal */
+    if (!player->progress_idle)
+        player->progress_idle = g_idle_add(on_progress_idle, player);
 }
 
 static void
 on_player_finished(GbbEventPlayer *event_player,
                    Player         *player)
 {
-    g_signal_handler_disconnect(player->player, player->finished_connection);
-    player->finished_connection = 0;
+    if (player->progress_idle)
+        player_flush_progress(player);
+
+    g_clear_pointer(&player->playing, g_free);
 
-    g_dbus_method_invocation_return_value(player->invocation, NULL);
-    player->invocation = NULL;
+    /* Report how closely the log was replayed to its timings */
+    GVariant *timing = gbb_replay_timing_to_variant(gbb_event_player_get_replay_timing(event_player));
+    gbb_event_player_reset_replay_timing(event_player);
+
+    player_emit(player, "Finished", g_variant_new("(@(uuxuxxau))", timing));
+}
+
+static void
+player_load(Player                *player,
+            GVariant              *parameters,
+            GDBusMethodInvocation *invocation)
+{
+    const char *name;
+    gint32 fd_index = -1;
+
+    GDBusMessage *message = g_dbus_method_invocation_get_message(invocation);
+    GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list(message);
+
+    if (fd_list == NULL || g_unix_fd_list_get_length(fd_list) != 1) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_INVALID_ARGS,
+                                               "Exactly one file descriptor should be passed");
+        return;
+    }
+
+    g_variant_get (parameters, "(&sh)", &name, &fd_index);
+    if (fd_index != 0) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_INVALID_ARGS,
+                                               "Bad file descriptor index %d", fd_index);
+        return;
+    }
+
+    if (player->playing && strcmp(player->playing, name) == 0) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_FAILED,
+                                               "Event log '%s' is playing", name);
+        return;
+    }
+
+    int n_fds;
+    int *fds = g_unix_fd_list_steal_fds (fd_list, &n_fds);
+    int fd = fds[0];
+    g_free(fds);
+
+    gbb_event_player_load_fd(player->player, name, fd);
+    g_dbus_method_invocation_return_value(invocation, NULL);
+}
+
+static void
+player_start(Player                *player,
+             GVariant              *parameters,
+             GDBusMethodInvocation *invocation)
+{
+    const char *name;
+    guint32 loops;
+
+    if (player->playing) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_FAILED,
+                                               "Player already playing");
+        return;
+    }
+
+    g_variant_get (parameters, "(&su)", &name, &loops);
+
+    /* Once we reply, the client waits for Finished; make sure there will be one */
+    if (!gbb_evdev_player_has_log(GBB_EVDEV_PLAYER(player->player), name)) {
+        g_dbus_method_invocation_return_error (invocation,
+                                               G_DBUS_ERROR,
+                                               G_DBUS_ERROR_FAILED,
+                                               "No event log '%s' has been loaded", name);
+        return;
+    }
+
+    player->playing = g_strdup(name);
+    player->iterations = 0;
+    g_dbus_method_invocation_return_value(invocation, NULL);
+
+    gbb_event_player_start(player->player, name, loops);
 }
 
 static void
@@ -77,48 +253,12 @@ player_handle_method_call(GDBusConnection       *connection,
 {
     Player *player = user_data;
 
-    if (g_strcmp0 (method_name, "Play") == 0) {
-        gint32 fd_index = -1;
-
-        GDBusMessage *message = g_dbus_method_invocation_get_message(invocation);
-        GUnixFDList *fd_list = g_dbus_message_get_unix_fd_list(message);
-
-        if (g_unix_fd_list_get_length(fd_list) != 1) {
-            g_dbus_method_invocation_return_error (invocation,
-                                                   G_DBUS_ERROR,
-                                                   G_DBUS_ERROR_INVALID_ARGS,
-                                                   "Exactly one file descriptor should be passed");
-        }
-
-        g_variant_get (parameters, "(h)", &fd_index);
-        if (fd_index != 0) {
-            g_dbus_method_invocation_return_error (invocation,
-                                                   G_DBUS_ERROR,
-                                                   G_DBUS_ERROR_INVALID_ARGS,
-                                                   "Bad file descriptor index %d", fd_index);
-        }
-
-        if (player->invocation) {
-            g_dbus_method_invocation_return_error (invocation,
-                                                   G_DBUS_ERROR,
-                                                   G_DBUS_ERROR_FAILED,
-                                                   "Player already playing");
-            return;
-        }
-
-        int n_fds;
-        int *fds = g_unix_fd_list_steal_fds (fd_list, &n_fds);
-        int fd = fds[0];
-        g_free(fds);
-
-        gbb_event_player_play_fd(player->player, fd);
-
-        player->invocation = invocation;
-        player->finished_connection = g_signal_connect(player->player, "finished",
-                                                       G_CALLBACK(on_player_finished), player);
-
+    if (g_strcmp0 (method_name, "Load") == 0) {
+        player_load(player, parameters, invocation);
+    } else if (g_strcmp0 (method_name, "Start") == 0) {
+        player_start(player, parameters, invocation);
     } else if (g_strcmp0 (method_name, "Stop") == 0) {
-        if (player->invocation == NULL) {
+        if (player->playing == NULL) {
             g_dbus_method_invocation_return_error (invocation,
                                                    G_DBUS_ERROR,
                                                    G_DBUS_ERROR_FAILED,
@@ -127,6 +267,16 @@ player_handle_method_call(GDBusConnection       *connection,
         }
         gbb_event_player_stop(player->player);
         g_dbus_method_invocation_return_value(invocation, NULL);
+    } else if (g_strcmp0 (method_name, "GetPosition") == 0) {
+        guint iteration = 0, event = 0;
+
+        if (player->playing)
+            gbb_event_player_get_position(player->player, &iteration, &event);
+
+        g_dbus_method_invocation_return_value(invocation,
+                                              g_variant_new("(suu)",
+                                                            player->playing ? player->playing : "",
+                                                            iteration, event));
     } else if (g_strcmp0 (method_name, "Destroy") == 0) {
         player_destroy(user_data);
         g_dbus_method_invocation_return_value(invocation, NULL);
@@ -197,6 +347,9 @@ on_checked_authorization(GObject      *source_object,
 
     PolkitAuthorizationResult *result = polkit_authority_check_authorization_finish(authority,
                                                                                     res, &error);
+    n_pending_creates--;
+    update_idle_exit();
+
     if (error) {
         g_dbus_method_invocation_return_gerror (invocation, error);
         g_clear_error(&error);
@@ -221,6 +374,8 @@ on_checked_authorization(GObject      *source_object,
     g_variant_get (parameters, "(&s)", &name);
 
     Player *player = g_slice_new0(Player);
+    n_players++;
+    update_idle_exit();
 
     player->connection = g_object_ref(connection);
     player->name = g_strdup(name);
@@ -244,6 +399,10 @@ on_checked_authorization(GObject      *source_object,
         return;
     }
     player->player = GBB_EVENT_PLAYER(evdev_player);
+    g_signal_connect(player->player, "iteration",
+                     G_CALLBACK(on_player_iteration), player);
+    g_signal_connect(player->player, "finished",
+                     G_CALLBACK(on_player_finished), player);
 
     player->registration_id = g_dbus_connection_register_object(connection,
                                                                 player->path,
@@ -270,6 +429,8 @@ on_got_polkit_authority(GObject      *source_object,
     if (error) {
         g_dbus_method_invocation_return_gerror (invocation, error);
         g_clear_error(&error);
+        n_pending_creates--;
+        update_idle_exit();
         return;
     }
 
@@ -296,6 +457,8 @@ helper_handle_method_call(GDBusConnection       *connection,
                           gpointer               user_data)
 {
     if (g_strcmp0 (method_name, "CreatePlayer") == 0) {
+        n_pending_creates++;
+        update_idle_exit();
         polkit_authority_get_async (NULL, on_got_polkit_authority, invocation);
     }
 }
@@ -371,7 +534,6 @@ on_name_lost(GDBusConnection *connection,
 int main(int argc, char **argv)
 {
     guint owner_id;
-    GMainLoop *loop;
     GError *error = NULL;
 
     owner_id = g_bus_own_name(G_BUS_TYPE_SYSTEM,
@@ -385,8 +547,9 @@ int main(int argc, char **argv)
     if (error)
         die("Cannot get bus name: %s\n", error->message);
 
-    loop = g_main_loop_new(NULL, FALSE);
-    g_main_loop_run(loop);
+    main_loop = g_main_loop_new(NULL, FALSE);
+    update_idle_exit();
+    g_main_loop_run(main_loop);
     g_bus_unown_name(owner_id);
 
     return 0;
@@ -0,0 +1,251 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gio/gio.h>
+
+#include "run-journal.h"
+
+#define JOURNAL_MAGIC "# gnome-battery-bench journal 1"
+
+/* Longest time (s) that samples are kept only in memory */
+#define SYNC_INTERVAL 60
+
+struct _GbbRunJournal {
+    char *filename;
+    int fd;
+    GString *buffer;
+    gint64 last_sync_us;
+};
+
+GbbRunJournal *
+gbb_run_journal_create(const char *filename,
+                       GError    **error)
+{
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        int errsv = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+                    "Can't create %s: %s", filename, g_strerror(errsv));
+        return NULL;
+    }
+
+    GbbRunJournal *journal = g_slice_new0(GbbRunJournal);
+    journal->filename = g_strdup(filename);
+    journal->fd = fd;
+    journal->buffer = g_string_new(JOURNAL_MAGIC "\n");
+
+    return journal;
+}
+
+void
+gbb_run_journal_add_header(GbbRunJournal *journal,
+                           const char    *key,
+                           const char    *value)
+{
+    g_return_if_fail(strchr(key, ' ') == NULL);
+    g_return_if_fail(strchr(value, '\n') == NULL);
+
+    g_string_append_printf(journal->buffer, "%s %s\n", key, value);
+}
+
+static void
+append_double(GString *buffer,
+              double   value)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    g_string_append_c(buffer, ' ');
+    g_string_append(buffer, g_ascii_dtostr(buf, sizeof(buf), value));
+}
+
+void
+gbb_run_journal_add_state(GbbRunJournal       *journal,
+                          const GbbPowerState *state)
+{
+    int i;
+
+    g_string_append_printf(journal->buffer, "state %" G_GINT64_FORMAT " %d",
+                           state->time_us, state->online ? 1 : 0);
+    append_double(journal->buffer, state->energy_now);
+    append_double(journal->buffer, state->energy_full);
+    append_double(journal->buffer, state->energy_full_design);
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++)
+        append_double(journal->buffer, state->rapl_energy[i]);
+    g_string_append_c(journal->buffer, '\n');
+
+    /* Keeps the disk asleep for most of the run; we only pay for a
+     * write and a sync every SYNC_INTERVAL */
+    if (g_get_monotonic_time() - journal->last_sync_us >= SYNC_INTERVAL * G_USEC_PER_SEC) {
+        GError *error = NULL;
+
+        if (!gbb_run_journal_sync(journal, &error)) {
+            g_warning("%s", error->message);
+            g_clear_error(&error);
+        }
+    }
+}
+
+gboolean
+gbb_run_journal_sync(GbbRunJournal *journal,
+                     GError       **error)
+{
+    gsize written = 0;
+
+    journal->last_sync_us = g_get_monotonic_time();
+
+    while (written < journal->buffer->len) {
+        ssize_t count = write(journal->fd,
+                              journal->buffer->str + written,
+                              journal->buffer->len - written);
+        if (count < 0) {
+            int errsv = errno;
+            if (errsv == EINTR)
+                continue;
+
+            /* Keep what wasn't written for the next try */
+            g_string_erase(journal->buffer, 0, written);
+            g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+                        "Can't write to %s: %s", journal->filename, g_strerror(errsv));
+            return FALSE;
+        }
+
+        written += count;
+    }
+
+    g_string_truncate(journal->buffer, 0);
+
+    if (fdatasync(journal->fd) != 0) {
+        int errsv = errno;
+        g_set_error(error, G_IO_ERROR, g_io_error_from_errno(errsv),
+                    "Can't sync %s: %s", journal->filename, g_strerror(errsv));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+gbb_run_journal_close(GbbRunJournal *journal,
+                      gboolean       remove)
+{
+    GError *error = NULL;
+
+    if (remove) {
+        if (unlink(journal->filename) != 0)
+            g_warning("Can't remove %s: %s", journal->filename, g_strerror(errno));
+    } else if (!gbb_run_journal_sync(journal, &error)) {
+        g_warning("%s", error->message);
+        g_clear_error(&error);
+    }
+
+    close(journal->fd);
+    g_string_free(journal->buffer, TRUE);
+    g_free(journal->filename);
+    g_slice_free(GbbRunJournal, journal);
+}
+
+static gboolean
+parse_state(char          *line,
+            GbbPowerState *state)
+{
+    double values[3 + GBB_RAPL_N_DOMAINS];
+    char *end;
+    guint i;
+
+    gbb_power_state_init(state);
+
+    state->time_us = g_ascii_strtoll(line, &end, 10);
+    if (end == line)
+        return FALSE;
+    line = end;
+
+    state->online = g_ascii_strtoll(line, &end, 10) != 0;
+    if (end == line)
+        return FALSE;
+    line = end;
+
+    for (i = 0; i < G_N_ELEMENTS(values); i++) {
+        values[i] = g_ascii_strtod(line, &end);
+        if (end == line)
+            return FALSE;
+        line = end;
+    }
+
+    if (*line != '\0')
+        return FALSE;
+
+    state->energy_now = values[0];
+    state->energy_full = values[1];
+    state->energy_full_design = values[2];
+    for (i = 0; i < GBB_RAPL_N_DOMAINS; i++)
+        state->rapl_energy[i] = values[3 + i];
+
+    return TRUE;
+}
+
+gboolean
+gbb_run_journal_read(const char  *filename,
+                     GHashTable **header,
+                     GArray     **states,
+                     GError     **error)
+{
+    char *contents;
+    gsize length;
+    char **lines;
+    guint n_lines;
+    guint i;
+
+    if (!g_file_get_contents(filename, &contents, &length, error))
+        return FALSE;
+
+    if (!g_str_has_prefix(contents, JOURNAL_MAGIC "\n")) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s is not a test run journal", filename);
+        g_free(contents);
+        return FALSE;
+    }
+
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    /* After the last newline there is either nothing or a line that
+     * was being written when we went down */
+    n_lines = g_strv_length(lines) - 1;
+
+    *header = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+    *states = g_array_new(FALSE, FALSE, sizeof(GbbPowerState));
+
+    for (i = 1; i < n_lines; i++) {
+        char *line = lines[i];
+        char *value = strchr(line, ' ');
+
+        if (value == NULL)
+            goto bad_line;
+        *(value++) = '\0';
+
+        if (strcmp(line, "state") == 0) {
+            GbbPowerState state;
+
+            if (!parse_state(value, &state))
+                goto bad_line;
+            g_array_append_val(*states, state);
+        } else {
+            g_hash_table_replace(*header, g_strdup(line), g_strdup(value));
+        }
+    }
+
+    g_strfreev(lines);
+    return TRUE;
+
+bad_line:
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "%s:%u: can't parse journal line", filename, i + 1);
+    g_strfreev(lines);
+    g_clear_pointer(header, g_hash_table_destroy);
+    g_clear_pointer(states, g_array_unref);
+    return FALSE;
+}
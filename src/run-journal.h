@@ -0,0 +1,40 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __RUN_JOURNAL_H__
+#define __RUN_JOURNAL_H__
+
+#include <glib.h>
+
+#include "power-monitor.h"
+
+/* An append-only file that a test run is written to as it goes, so
+ * that a crash only loses the last few samples. It is a line-based
+ * text file: "key value" header lines describing the run, then one
+ * "state ..." line per sample. Writes are buffered and only go to
+ * disk, with fdatasync(), once a minute.
+ */
+typedef struct _GbbRunJournal GbbRunJournal;
+
+GbbRunJournal *gbb_run_journal_create     (const char          *filename,
+                                           GError             **error);
+void           gbb_run_journal_add_header (GbbRunJournal       *journal,
+                                           const char          *key,
+                                           const char          *value);
+void           gbb_run_journal_add_state  (GbbRunJournal       *journal,
+                                           const GbbPowerState *state);
+/* Writes out what is buffered and waits for it to be on disk */
+gboolean       gbb_run_journal_sync       (GbbRunJournal       *journal,
+                                           GError             **error);
+/* Syncs, then closes the file; and deletes it if remove is set */
+void           gbb_run_journal_close      (GbbRunJournal       *journal,
+                                           gboolean             remove);
+
+/* Reads back a journal, e.g. after a crash; a line cut short at the
+ * end is ignored. header maps keys to values, states is an array of
+ * GbbPowerState */
+gboolean       gbb_run_journal_read       (const char          *filename,
+                                           GHashTable         **header,
+                                           GArray             **states,
+                                           GError             **error);
+
+#endif /* __RUN_JOURNAL_H__ */
@@ -0,0 +1,300 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <math.h>
+#include <string.h>
+
+#include <gio/gio.h>
+
+#include "power-source.h"
+#include "simulated-battery.h"
+#include "util-clock.h"
+
+typedef struct {
+    double duration; /* s */
+    double power;    /* W */
+} TraceSegment;
+
+struct _GbbSimulatedBattery {
+    GbbPowerSupply parent;
+
+    double energy_full; /* WH */
+    double energy_full_design;
+    double energy_start;
+    double quantum;
+    double update_interval; /* s */
+
+    GArray *trace; /* TraceSegment */
+    double trace_duration;
+    double trace_energy; /* J used over the whole trace */
+
+    gint64 start_time;
+};
+
+static void simulated_source_init (GbbPowerSourceInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GbbSimulatedBattery, gbb_simulated_battery, GBB_TYPE_POWER_SUPPLY,
+                        G_IMPLEMENT_INTERFACE(GBB_TYPE_POWER_SOURCE,
+                                              simulated_source_init));
+
+static void
+gbb_simulated_battery_finalize(GObject *obj)
+{
+    GbbSimulatedBattery *bat = GBB_SIMULATED_BATTERY(obj);
+
+    g_array_free(bat->trace, TRUE);
+
+    G_OBJECT_CLASS(gbb_simulated_battery_parent_class)->finalize(obj);
+}
+
+static void
+gbb_simulated_battery_init(GbbSimulatedBattery *bat)
+{
+    bat->energy_full = 50;
+    bat->energy_full_design = -1;
+    bat->energy_start = -1;
+    bat->quantum = 0.01;
+    bat->update_interval = 15;
+    bat->trace = g_array_new(FALSE, FALSE, sizeof(TraceSegment));
+}
+
+static void
+gbb_simulated_battery_class_init(GbbSimulatedBatteryClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+    gobject_class->finalize = gbb_simulated_battery_finalize;
+}
+
+static void
+trace_add(GbbSimulatedBattery *bat,
+          double               duration,
+          double               power)
+{
+    TraceSegment segment = { duration, power };
+
+    g_array_append_val(bat->trace, segment);
+    bat->trace_duration += duration;
+    bat->trace_energy += duration * power;
+}
+
+static gboolean
+load_trace(GbbSimulatedBattery *bat,
+           const char          *filename,
+           GError             **error)
+{
+    char *contents;
+    char **lines;
+    int i;
+
+    if (!g_file_get_contents(filename, &contents, NULL, error))
+        return FALSE;
+
+    lines = g_strsplit(contents, "\n", -1);
+    g_free(contents);
+
+    for (i = 0; lines[i]; i++) {
+        char *line = g_strstrip(lines[i]);
+        double duration, power;
+        char *end;
+
+        if (line[0] == '\0' || line[0] == '#')
+            continue;
+
+        duration = g_ascii_strtod(line, &end);
+        power = g_ascii_strtod(end, &end);
+        if (*end != '\0' || !(duration > 0) || !(power >= 0)) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                        "%s:%d: expected '<seconds> <watts>'", filename, i + 1);
+            g_strfreev(lines);
+            return FALSE;
+        }
+
+        trace_add(bat, duration, power);
+    }
+
+    g_strfreev(lines);
+
+    if (bat->trace->len == 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s: empty power trace", filename);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+parse_number(const char *key,
+             const char *value,
+             double      min,
+             double     *result,
+             GError    **error)
+{
+    char *end;
+
+    *result = g_ascii_strtod(value, &end);
+    if (end == value || *end != '\0' || !(*result >= min)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "Bad value '%s' for simulated battery '%s'", value, key);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+parse_model(GbbSimulatedBattery *bat,
+            const char          *model,
+            GError             **error)
+{
+    char **params = g_strsplit(model ? model : "", ",", -1);
+    double percent = 100;
+    double power = 10;
+    gboolean success = FALSE;
+    int i;
+
+    for (i = 0; params[i]; i++) {
+        char *key = params[i];
+        char *value = strchr(key, '=');
+
+        if (key[0] == '\0')
+            continue;
+
+        if (value == NULL) {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                        "Simulated battery parameter '%s' has no value", key);
+            goto out;
+        }
+        *(value++) = '\0';
+
+        if (strcmp(key, "capacity") == 0) {
+            if (!parse_number(key, value, 0.001, &bat->energy_full, error))
+                goto out;
+        } else if (strcmp(key, "design") == 0) {
+            if (!parse_number(key, value, 0.001, &bat->energy_full_design, error))
+                goto out;
+        } else if (strcmp(key, "percent") == 0) {
+            if (!parse_number(key, value, 0, &percent, error))
+                goto out;
+        } else if (strcmp(key, "power") == 0) {
+            if (!parse_number(key, value, 0, &power, error))
+                goto out;
+        } else if (strcmp(key, "trace") == 0) {
+            if (!load_trace(bat, value, error))
+                goto out;
+        } else if (strcmp(key, "interval") == 0) {
+            if (!parse_number(key, value, 0, &bat->update_interval, error))
+                goto out;
+        } else if (strcmp(key, "quantum") == 0) {
+            if (!parse_number(key, value, 0, &bat->quantum, error))
+                goto out;
+        } else {
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                        "Unknown simulated battery parameter '%s'", key);
+            goto out;
+        }
+    }
+
+    if (percent > 100) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                    "Simulated battery can't start at %g%%", percent);
+        goto out;
+    }
+
+    /* A constant draw is a trace with a single segment */
+    if (bat->trace->len == 0)
+        trace_add(bat, 3600, power);
+
+    if (bat->energy_full_design < 0)
+        bat->energy_full_design = bat->energy_full;
+    bat->energy_start = bat->energy_full * percent / 100;
+
+    success = TRUE;
+
+out:
+    g_strfreev(params);
+    return success;
+}
+
+GbbSimulatedBattery *
+gbb_simulated_battery_new(const char *model,
+                          GError    **error)
+{
+    GbbSimulatedBattery *bat = g_object_new(GBB_TYPE_SIMULATED_BATTERY, NULL);
+
+    if (!parse_model(bat, model, error)) {
+        g_object_unref(bat);
+        return NULL;
+    }
+
+    bat->start_time = gbb_clock_get_time();
+
+    return bat;
+}
+
+/* J used in the first t seconds */
+static double
+energy_used(GbbSimulatedBattery *bat,
+            double               t)
+{
+    double passes = floor(t / bat->trace_duration);
+    double used = passes * bat->trace_energy;
+    guint i;
+
+    t -= passes * bat->trace_duration;
+
+    for (i = 0; i < bat->trace->len && t > 0; i++) {
+        TraceSegment *segment = &g_array_index(bat->trace, TraceSegment, i);
+        double duration = MIN(t, segment->duration);
+
+        used += duration * segment->power;
+        t -= duration;
+    }
+
+    return used;
+}
+
+static void
+simulated_source_read(GbbPowerSource *source,
+                      GbbPowerState  *state)
+{
+    GbbSimulatedBattery *bat = GBB_SIMULATED_BATTERY(source);
+    double t = (gbb_clock_get_time() - bat->start_time) / 1000000.;
+    double energy;
+
+    /* Like the firmware, only report what was true at the last update */
+    if (bat->update_interval > 0)
+        t = floor(t / bat->update_interval) * bat->update_interval;
+
+    energy = bat->energy_start - energy_used(bat, t) / 3600;
+    if (bat->quantum > 0)
+        energy = floor(energy / bat->quantum + 1e-9) * bat->quantum;
+
+    state->energy_now = MAX(energy, 0);
+    state->energy_full = bat->energy_full;
+    state->energy_full_design = bat->energy_full_design;
+}
+
+static double
+simulated_source_get_resolution(GbbPowerSource *source)
+{
+    GbbSimulatedBattery *bat = GBB_SIMULATED_BATTERY(source);
+
+    return bat->quantum > 0 ? 3600 * bat->quantum : 3600 / 1000000.;
+}
+
+static double
+simulated_source_get_update_interval(GbbPowerSource *source)
+{
+    /* Not telling, so the monitor has to work it out as it would for
+     * a real battery */
+    return GBB_POWER_SOURCE_UPDATE_UNKNOWN;
+}
+
+static void
+simulated_source_init(GbbPowerSourceInterface *iface)
+{
+    iface->read = simulated_source_read;
+    iface->get_resolution = simulated_source_get_resolution;
+    iface->get_update_interval = simulated_source_get_update_interval;
+}
@@ -0,0 +1,29 @@
+#ifndef __SIMULATED_BATTERY_H__
+#define __SIMULATED_BATTERY_H__
+
+#include "power-supply.h"
+
+G_BEGIN_DECLS
+
+/* A battery that discharges following a model rather than the
+ * hardware, on the clock of util-clock.h. The model is given as
+ * comma-separated key=value pairs:
+ *
+ *  capacity=WH   energy when full (default 50)
+ *  design=WH     design energy when full (default: capacity)
+ *  percent=P     charge at the start (default 100)
+ *  power=W       constant power draw (default 10)
+ *  trace=FILE    power curve instead, lines of "<seconds> <watts>"
+ *                each holding for that long; repeated as needed
+ *  interval=S    firmware update interval (default 15, 0 for none)
+ *  quantum=WH    steps in which energy is reported (default 0.01)
+ */
+#define GBB_TYPE_SIMULATED_BATTERY gbb_simulated_battery_get_type()
+G_DECLARE_FINAL_TYPE(GbbSimulatedBattery, gbb_simulated_battery, GBB, SIMULATED_BATTERY, GbbPowerSupply)
+
+GbbSimulatedBattery *gbb_simulated_battery_new (const char  *model,
+                                                GError     **error);
+
+G_END_DECLS
+
+#endif /* __SIMULATED_BATTERY_H__ */
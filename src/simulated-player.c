@@ -0,0 +1,174 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include "event-log.h"
+#include "simulated-player.h"
+#include "util.h"
+#include "util-clock.h"
+
+typedef struct _GbbSimulatedPlayerClass GbbSimulatedPlayerClass;
+
+struct _GbbSimulatedPlayer {
+    GbbEventPlayer parent;
+
+    GHashTable *durations; /* name => duration (ms) */
+
+    guint loops;
+    guint iteration;
+    guint iteration_timeout;
+    guint finished_idle;
+};
+
+struct _GbbSimulatedPlayerClass {
+    GbbEventPlayerClass parent_class;
+};
+
+G_DEFINE_TYPE(GbbSimulatedPlayer, gbb_simulated_player, GBB_TYPE_EVENT_PLAYER)
+
+static void
+gbb_simulated_player_finalize(GObject *object)
+{
+    GbbSimulatedPlayer *player = GBB_SIMULATED_PLAYER(object);
+
+    if (player->iteration_timeout)
+        gbb_clock_source_remove(player->iteration_timeout);
+    if (player->finished_idle)
+        g_source_remove(player->finished_idle);
+
+    g_hash_table_destroy(player->durations);
+
+    G_OBJECT_CLASS(gbb_simulated_player_parent_class)->finalize(object);
+}
+
+static gboolean
+on_finished_idle(gpointer data)
+{
+    GbbSimulatedPlayer *player = data;
+
+    player->finished_idle = 0;
+    gbb_event_player_finished(GBB_EVENT_PLAYER(player));
+
+    return G_SOURCE_REMOVE;
+}
+
+/* ::finished is emitted from the main loop like it is for the remote
+ * player, never from within start() or stop() */
+static void
+player_finish(GbbSimulatedPlayer *player)
+{
+    if (player->iteration_timeout) {
+        gbb_clock_source_remove(player->iteration_timeout);
+        player->iteration_timeout = 0;
+    }
+
+    if (player->finished_idle == 0)
+        player->finished_idle = g_idle_add(on_finished_idle, player);
+}
+
+static gboolean
+on_iteration_timeout(gpointer data)
+{
+    GbbSimulatedPlayer *player = data;
+
+    player->iteration++;
+    if (player->loops != 0 && player->iteration >= player->loops) {
+        player->iteration_timeout = 0;
+        player_finish(player);
+        return G_SOURCE_REMOVE;
+    }
+
+    gbb_event_player_iteration(GBB_EVENT_PLAYER(player));
+
+    return G_SOURCE_CONTINUE;
+}
+
+static void
+gbb_simulated_player_load_fd(GbbEventPlayer *event_player,
+                             const char     *name,
+                             int             fd)
+{
+    GbbSimulatedPlayer *player = GBB_SIMULATED_PLAYER(event_player);
+    GError *error = NULL;
+    GbbEventLog *log;
+    int duration;
+
+    log = gbb_event_log_new_from_fd(fd, &error);
+    if (log == NULL)
+        die("Can't load event log '%s': %s", name, error->message);
+
+    duration = gbb_event_log_get_duration(log, &error);
+    if (duration < 0)
+        die("Can't read event log '%s': %s", name, error->message);
+
+    gbb_event_log_free(log);
+
+    g_hash_table_replace(player->durations, g_strdup(name), GINT_TO_POINTER(duration));
+}
+
+static void
+gbb_simulated_player_start(GbbEventPlayer *event_player,
+                           const char     *name,
+                           guint           loops)
+{
+    GbbSimulatedPlayer *player = GBB_SIMULATED_PLAYER(event_player);
+    gpointer duration;
+
+    if (!g_hash_table_lookup_extended(player->durations, name, NULL, &duration)) {
+        g_critical("No event log '%s' has been loaded", name);
+        return;
+    }
+
+    player->loops = loops;
+    player->iteration = 0;
+    gbb_replay_timing_reset(&event_player->timing);
+
+    player->iteration_timeout = gbb_clock_timeout_add(MAX(GPOINTER_TO_INT(duration), 1),
+                                                      on_iteration_timeout, player);
+}
+
+static void
+gbb_simulated_player_stop(GbbEventPlayer *event_player)
+{
+    player_finish(GBB_SIMULATED_PLAYER(event_player));
+}
+
+static void
+gbb_simulated_player_get_position(GbbEventPlayer *event_player,
+                                  guint          *iteration,
+                                  guint          *event)
+{
+    GbbSimulatedPlayer *player = GBB_SIMULATED_PLAYER(event_player);
+
+    *iteration = player->iteration;
+    *event = 0;
+}
+
+static void
+gbb_simulated_player_init(GbbSimulatedPlayer *player)
+{
+    player->durations = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+}
+
+static void
+gbb_simulated_player_class_init(GbbSimulatedPlayerClass *simulated_class)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(simulated_class);
+    GbbEventPlayerClass *player_class = GBB_EVENT_PLAYER_CLASS(simulated_class);
+
+    gobject_class->finalize = gbb_simulated_player_finalize;
+
+    player_class->load_fd = gbb_simulated_player_load_fd;
+    player_class->start = gbb_simulated_player_start;
+    player_class->stop = gbb_simulated_player_stop;
+    player_class->get_position = gbb_simulated_player_get_position;
+}
+
+GbbSimulatedPlayer *
+gbb_simulated_player_new(void)
+{
+    GbbSimulatedPlayer *player = g_object_new(GBB_TYPE_SIMULATED_PLAYER, NULL);
+
+    /* There are no devices to wait for */
+    gbb_event_player_set_ready(GBB_EVENT_PLAYER(player), NULL, NULL);
+
+    return player;
+}
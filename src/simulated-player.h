@@ -0,0 +1,23 @@
+#ifndef __SIMULATED_PLAYER_H__
+#define __SIMULATED_PLAYER_H__
+
+#include "event-player.h"
+
+/* A player that doesn't send any events, but takes as long as the
+ * logs would on the clock of util-clock.h; for running tests
+ * against a simulated battery in virtual time.
+ */
+typedef struct _GbbSimulatedPlayer GbbSimulatedPlayer;
+
+#define GBB_TYPE_SIMULATED_PLAYER         (gbb_simulated_player_get_type ())
+#define GBB_SIMULATED_PLAYER(o)           (G_TYPE_CHECK_INSTANCE_CAST ((o), GBB_TYPE_SIMULATED_PLAYER, GbbSimulatedPlayer))
+#define GBB_SIMULATED_PLAYER_CLASS(k)     (G_TYPE_CHECK_CLASS_CAST((k), GBB_TYPE_SIMULATED_PLAYER, GbbSimulatedPlayerClass))
+#define GBB_IS_SIMULATED_PLAYER(o)        (G_TYPE_CHECK_INSTANCE_TYPE ((o), GBB_TYPE_SIMULATED_PLAYER))
+#define GBB_IS_SIMULATED_PLAYER_CLASS(k)  (G_TYPE_CHECK_CLASS_TYPE ((k), GBB_TYPE_SIMULATED_PLAYER))
+#define GBB_SIMULATED_PLAYER_GET_CLASS(o) (G_TYPE_INSTANCE_GET_CLASS ((o), GBB_TYPE_SIMULATED_PLAYER, GbbSimulatedPlayerClass))
+
+GbbSimulatedPlayer *gbb_simulated_player_new(void);
+
+GType gbb_simulated_player_get_type(void);
+
+#endif /* __SIMULATED_PLAYER_H__*/
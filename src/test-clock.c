@@ -0,0 +1,64 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <glib.h>
+
+#include "util-clock.h"
+
+typedef struct {
+    GMainLoop *loop;
+    GString *order;
+} Dispatched;
+
+typedef struct {
+    Dispatched *dispatched;
+    char name;
+} Timeout;
+
+static gboolean
+on_timeout(gpointer data)
+{
+    Timeout *timeout = data;
+
+    g_string_append_c(timeout->dispatched->order, timeout->name);
+    if (timeout->dispatched->order->len == 3)
+        g_main_loop_quit(timeout->dispatched->loop);
+
+    return G_SOURCE_REMOVE;
+}
+
+static void
+test_same_deadline_order(void)
+{
+    Dispatched dispatched;
+    Timeout a = { &dispatched, 'a' };
+    Timeout b = { &dispatched, 'b' };
+    Timeout c = { &dispatched, 'c' };
+
+    dispatched.loop = g_main_loop_new(NULL, FALSE);
+    dispatched.order = g_string_new(NULL);
+
+    gbb_clock_set_virtual();
+    gint64 start = gbb_clock_get_time();
+
+    gbb_clock_timeout_add(1000, on_timeout, &b);
+    gbb_clock_timeout_add(1000, on_timeout, &c);
+    gbb_clock_timeout_add(500, on_timeout, &a);
+
+    g_main_loop_run(dispatched.loop);
+
+    g_assert_cmpstr(dispatched.order->str, ==, "abc");
+    g_assert_cmpint(gbb_clock_get_time() - start, ==, 1000000);
+
+    g_string_free(dispatched.order, TRUE);
+    g_main_loop_unref(dispatched.loop);
+}
+
+int
+main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    g_test_add_func("/clock/virtual/same-deadline-order", test_same_deadline_order);
+
+    return g_test_run();
+}
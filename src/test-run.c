@@ -1,25 +1,41 @@
 /* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
 
+#include "config.h"
+
 #define _XOPEN_SOURCE
+#include <string.h>
 #include <time.h>
 
+#include <glib/gstdio.h>
 #include <json-glib/json-glib.h>
 
 #include "event-log.h"
+#include "json-reader.h"
+#include "json-writer.h"
+#include "run-journal.h"
 #include "system-info.h"
 #include "test-run.h"
 #include "util.h"
+#ifdef HAVE_ZSTD
+#include "zstd-converter.h"
+#endif
 
 struct _GbbTestRun {
     GObject parent;
 
     GbbBatteryTest *test;
     char *id;
+    char *test_id;
     char *filename;
     char *name;
     char *description;
 
-    GQueue *history;
+    GbbPowerHistory *history;
+    GbbPowerState start_state;
+    GbbPowerState last_state;
+    GArray *power_series;   /* W, over the interval up to each entry */
+    GArray *life_series;    /* s, estimated from the start of the run */
+    GArray *percent_series;
     gint64 start_time;
 
     GbbDurationType duration_type;
@@ -33,6 +49,17 @@ struct _GbbTestRun {
     double max_power;
     double max_life;
     double loop_time;
+    double file_power;      /* as stored in the file read, if any */
+
+    gboolean have_overhead;
+    GbbMonitorOverhead overhead;
+
+    gboolean have_replay_timing;
+    GbbReplayTiming replay_timing;
+
+    GbbRunJournal *journal;
+
+    JsonNode *system_info; /* only for runs read from a file */
 };
 
 struct _GbbTestRunClass {
@@ -53,10 +80,20 @@ gbb_test_run_finalize(GObject *object)
 {
     GbbTestRun *run = GBB_TEST_RUN(object);
 
-    g_queue_free_full(run->history, (GDestroyNotify)gbb_power_state_free);
+    /* Never written out; keep the samples around for recovery */
+    if (run->journal)
+        gbb_run_journal_close(run->journal, FALSE);
+
+    gbb_power_history_free(run->history);
+    g_array_unref(run->power_series);
+    g_array_unref(run->life_series);
+    g_array_unref(run->percent_series);
+    g_free(run->id);
+    g_free(run->test_id);
     g_free(run->filename);
     g_free(run->name);
     g_free(run->description);
+    g_clear_pointer(&run->system_info, json_node_free);
 
     G_OBJECT_CLASS(gbb_test_run_parent_class)->finalize(object);
 }
@@ -65,7 +102,11 @@ static void
 gbb_test_run_init(GbbTestRun *run)
 {
     run->id = uuid_gen_new();
-    run->history = g_queue_new();
+    run->file_power = -1;
+    run->history = gbb_power_history_new();
+    run->power_series = g_array_new(FALSE, FALSE, sizeof(double));
+    run->life_series = g_array_new(FALSE, FALSE, sizeof(double));
+    run->percent_series = g_array_new(FALSE, FALSE, sizeof(double));
 }
 
 static void
@@ -90,6 +131,7 @@ gbb_test_run_new(GbbBatteryTest *test)
     GbbTestRun *run = g_object_new(GBB_TYPE_TEST_RUN, NULL);
 
     run->test = test;
+    run->test_id = g_strdup(test->id);
     run->name = g_strdup(test->name);
     run->description = g_strdup(test->description);
 
@@ -179,11 +221,11 @@ gbb_test_run_get_screen_brightness (GbbTestRun *run)
 }
 
 static void
-test_run_add_internal(GbbTestRun    *run,
-                      GbbPowerState *state)
+test_run_add_internal(GbbTestRun          *run,
+                      const GbbPowerState *state)
 {
-    GbbPowerState *start_state = run->history->head ? run->history->head->data : NULL;
-    GbbPowerState *last_state = run->history->tail ? run->history->tail->data : NULL;
+    const GbbPowerState *start_state = gbb_test_run_get_start_state(run);
+    const GbbPowerState *last_state = gbb_test_run_get_last_state(run);
     gboolean use_this_state = FALSE;
 
     if (!start_state) {
@@ -207,23 +249,36 @@ test_run_add_internal(GbbTestRun    *run,
         }
     }
 
-    if (!use_this_state) {
-        gbb_power_state_free(state);
+    if (!use_this_state)
         return;
-    }
 
-    g_queue_push_tail(run->history, state);
+    double power = -1;
+    double life = -1;
+    double percent = gbb_power_state_get_percent(state);
 
     if (start_state) {
-        GbbPowerStatistics *overall_stats = gbb_power_statistics_compute(start_state, state);
-        run->max_life = MAX(overall_stats->battery_life, run->max_life);
+        GbbPowerStatistics overall_stats;
+        gbb_power_statistics_init(&overall_stats, start_state, state);
+        life = overall_stats.battery_life;
+        run->max_life = MAX(life, run->max_life);
+
+        GbbPowerStatistics interval_stats;
+        gbb_power_statistics_init(&interval_stats, last_state, state);
+        power = interval_stats.power;
+        run->max_power = MAX(power, run->max_power);
+    }
 
-        GbbPowerStatistics *interval_stats = gbb_power_statistics_compute(last_state, state);
-        run->max_power = MAX(interval_stats->power, run->max_power);
+    g_array_append_val(run->power_series, power);
+    g_array_append_val(run->life_series, life);
+    g_array_append_val(run->percent_series, percent);
 
-        gbb_power_statistics_free(interval_stats);
-        gbb_power_statistics_free(overall_stats);
-    }
+    gbb_power_history_append(run->history, state);
+    if (gbb_power_history_get_length(run->history) == 1)
+        run->start_state = *state;
+    run->last_state = *state;
+
+    if (run->journal)
+        gbb_run_journal_add_state(run->journal, state);
 
     g_signal_emit(run, signals[UPDATED], 0);
 }
@@ -232,7 +287,7 @@ void
 gbb_test_run_add(GbbTestRun          *run,
                  const GbbPowerState *state)
 {
-    test_run_add_internal(run, gbb_power_state_copy(state));
+    test_run_add_internal(run, state);
     g_signal_emit(run, signals[UPDATED], 0);
 }
 
@@ -266,23 +321,77 @@ gbb_test_run_get_description (GbbTestRun *run)
     return run->description;
 }
 
-GQueue *
+const GbbPowerHistory *
 gbb_test_run_get_history(GbbTestRun *run)
 {
     return run->history;
 }
 
+const double *
+gbb_test_run_get_power_series(GbbTestRun *run)
+{
+    return (const double *)run->power_series->data;
+}
+
+const double *
+gbb_test_run_get_life_series(GbbTestRun *run)
+{
+    return (const double *)run->life_series->data;
+}
+
+const double *
+gbb_test_run_get_percent_series(GbbTestRun *run)
+{
+    return (const double *)run->percent_series->data;
+}
 
 const GbbPowerState *
 gbb_test_run_get_start_state (GbbTestRun *run)
 {
-    return run->history->head ? run->history->head->data : NULL;
+    return gbb_power_history_get_length(run->history) > 0 ? &run->start_state : NULL;
 }
 
 const GbbPowerState *
 gbb_test_run_get_last_state (GbbTestRun *run)
 {
-    return run->history->tail ? run->history->tail->data : NULL;
+    switch (gbb_power_history_get_length(run->history)) {
+    case 0:
+        return NULL;
+    case 1:
+        /* Callers compare against the start state to find out
+         * whether there is more than one state */
+        return &run->start_state;
+    default:
+        return &run->last_state;
+    }
+}
+
+void
+gbb_test_run_set_monitor_overhead(GbbTestRun               *run,
+                                  const GbbMonitorOverhead *overhead)
+{
+    run->overhead = *overhead;
+    run->have_overhead = TRUE;
+}
+
+const GbbMonitorOverhead *
+gbb_test_run_get_monitor_overhead(GbbTestRun *run)
+{
+    return run->have_overhead ? &run->overhead : NULL;
+}
+
+void
+gbb_test_run_set_replay_timing(GbbTestRun            *run,
+                               const GbbReplayTiming *timing)
+{
+    run->replay_timing = *timing;
+    run->have_replay_timing = TRUE;
+}
+
+const GbbReplayTiming *
+gbb_test_run_get_replay_timing(GbbTestRun *run)
+{
+    return run->have_replay_timing ? &run->replay_timing : NULL;
 }
 
 double
@@ -297,54 +406,87 @@ gbb_test_run_get_max_battery_life(GbbTestRun *run)
     return run->max_life;
 }
 
-static void
-add_int_value_1e6(JsonBuilder *builder,
-                  double       value)
+double
+gbb_test_run_get_average_power(GbbTestRun *run)
 {
-    json_builder_add_int_value(builder, (gint64)(0.5 + 1e6 * value));
+    const GbbPowerState *start_state = gbb_test_run_get_start_state(run);
+    const GbbPowerState *last_state = gbb_test_run_get_last_state(run);
+    GbbPowerStatistics statistics;
+
+    /* Read without the samples */
+    if (start_state == NULL)
+        return run->file_power;
+
+    if (last_state == start_state)
+        return -1;
+
+    gbb_power_statistics_init(&statistics, start_state, last_state);
+    return statistics.power;
 }
 
-gboolean
-gbb_test_run_write_to_file(GbbTestRun *run,
-                           const char *filename,
-                           GError    **error)
+/* Energies are stored as integers, in uWH (or uJ) */
+static gint64
+to_1e6(double value)
 {
-    JsonBuilder *builder = json_builder_new();
+    return (gint64)(0.5 + 1e6 * value);
+}
+
+static void
+add_int_value_1e6(GbbJsonWriter *writer,
+                  double         value)
+{
+    gbb_json_writer_add_int_value(writer, to_1e6(value));
+}
 
-    json_builder_begin_object(builder);
-    json_builder_set_member_name(builder, "id");
-    json_builder_add_string_value(builder, run->id);
-    json_builder_set_member_name(builder, "test-id");
-    json_builder_add_string_value(builder, run->test->id);
-    json_builder_set_member_name(builder, "test-name");
-    json_builder_add_string_value(builder, run->name);
+/* Everything but the log, as members of the root object */
+static void
+write_header(GbbTestRun    *run,
+             GbbJsonWriter *writer)
+{
+    gbb_json_writer_set_member_name(writer, "id");
+    gbb_json_writer_add_string_value(writer, run->id);
+    if (run->test_id) {
+        gbb_json_writer_set_member_name(writer, "test-id");
+        gbb_json_writer_add_string_value(writer, run->test_id);
+    }
+    gbb_json_writer_set_member_name(writer, "test-name");
+    gbb_json_writer_add_string_value(writer, run->name);
     if (run->description) {
-        json_builder_set_member_name(builder, "test-description");
-        json_builder_add_string_value(builder, run->description);
+        gbb_json_writer_set_member_name(writer, "test-description");
+        gbb_json_writer_add_string_value(writer, run->description);
     }
     if (run->duration_type == GBB_DURATION_TIME) {
-        json_builder_set_member_name(builder, "duration-seconds");
-        json_builder_add_double_value(builder, run->duration.seconds);
+        gbb_json_writer_set_member_name(writer, "duration-seconds");
+        gbb_json_writer_add_double_value(writer, run->duration.seconds);
     } else  {
-        json_builder_set_member_name(builder, "until-percent");
-        json_builder_add_double_value(builder, run->duration.percent);
+        gbb_json_writer_set_member_name(writer, "until-percent");
+        gbb_json_writer_add_double_value(writer, run->duration.percent);
     }
-    json_builder_set_member_name(builder, "screen-brightness");
-    json_builder_add_int_value(builder, run->screen_brightness);
+    gbb_json_writer_set_member_name(writer, "screen-brightness");
+    gbb_json_writer_add_int_value(writer, run->screen_brightness);
 
     if (run->start_time != 0) {
         GDateTime *start = g_date_time_new_from_unix_utc(run->start_time);
         char *start_string = g_date_time_format (start, "%F %T");
-        json_builder_set_member_name(builder, "start-time");
-        json_builder_add_string_value(builder, start_string);
+        gbb_json_writer_set_member_name(writer, "start-time");
+        gbb_json_writer_add_string_value(writer, start_string);
         g_date_time_unref(start);
         g_free(start_string);
     }
 
-    /* probably better to do that when we create the run */
-    g_autoptr(GbbSystemInfo) info = gbb_system_info_acquire();
-    json_builder_set_member_name(builder, "system-info");
-    gbb_system_info_to_json(info, builder);
+    /* probably better to do that when we create the run; a run read
+     * from a file keeps the system it was run on */
+    gbb_json_writer_set_member_name(writer, "system-info");
+    if (run->system_info) {
+        gbb_json_writer_add_node(writer, run->system_info);
+    } else {
+        g_autoptr(GbbSystemInfo) info = gbb_system_info_acquire();
+        g_autoptr(JsonBuilder) builder = json_builder_new();
+        gbb_system_info_to_json(info, builder);
+        JsonNode *info_node = json_builder_get_root(builder);
+        gbb_json_writer_add_node(writer, info_node);
+        json_node_free(info_node);
+    }
 
     const GbbPowerState *start_state = gbb_test_run_get_start_state(run);
     const GbbPowerState *end_state = gbb_test_run_get_last_state(run);
@@ -355,90 +497,641 @@ gbb_test_run_write_to_file(GbbTestRun *run,
          */
         GbbPowerStatistics *statistics = gbb_power_statistics_compute(start_state, end_state);
         if (statistics->power > 0) {
-            json_builder_set_member_name(builder, "power");
-            json_builder_add_double_value(builder, statistics->power);
+            gbb_json_writer_set_member_name(writer, "power");
+            gbb_json_writer_add_double_value(writer, statistics->power);
         }
         if (statistics->current > 0) {
-            json_builder_set_member_name(builder, "current");
-            json_builder_add_double_value(builder, statistics->current);
+            gbb_json_writer_set_member_name(writer, "current");
+            gbb_json_writer_add_double_value(writer, statistics->current);
         }
         if (statistics->battery_life > 0) {
-            json_builder_set_member_name(builder, "estimated-life");
-            json_builder_add_double_value(builder, statistics->battery_life);
+            gbb_json_writer_set_member_name(writer, "estimated-life");
+            gbb_json_writer_add_double_value(writer, statistics->battery_life);
         }
         if (statistics->battery_life_design > 0) {
-            json_builder_set_member_name(builder, "estimated-life-design");
-            json_builder_add_double_value(builder, statistics->battery_life_design);
+            gbb_json_writer_set_member_name(writer, "estimated-life-design");
+            gbb_json_writer_add_double_value(writer, statistics->battery_life_design);
+        }
+
+        int d;
+        for (d = 0; d < GBB_RAPL_N_DOMAINS; d++) {
+            if (statistics->rapl_power[d] >= 0) {
+                g_autofree char *member = g_strdup_printf("rapl-%s-power", gbb_rapl_domain_get_name(d));
+                gbb_json_writer_set_member_name(writer, member);
+                gbb_json_writer_add_double_value(writer, statistics->rapl_power[d]);
+            }
         }
 
         gbb_power_statistics_free(statistics);
     }
 
-    json_builder_set_member_name(builder, "log");
-    json_builder_begin_array(builder);
-    GList *l;
+    if (run->have_overhead) {
+        const GbbMonitorOverhead *overhead = &run->overhead;
+
+        gbb_json_writer_set_member_name(writer, "monitor-overhead");
+        gbb_json_writer_begin_object(writer);
+        gbb_json_writer_set_member_name(writer, "duration-seconds");
+        gbb_json_writer_add_double_value(writer, overhead->elapsed);
+        gbb_json_writer_set_member_name(writer, "wakeups");
+        gbb_json_writer_add_int_value(writer, overhead->n_wakeups);
+        gbb_json_writer_set_member_name(writer, "reads");
+        gbb_json_writer_add_int_value(writer, overhead->n_reads);
+        gbb_json_writer_set_member_name(writer, "syscalls");
+        gbb_json_writer_add_int_value(writer, overhead->n_syscalls);
+        gbb_json_writer_set_member_name(writer, "cpu-time");
+        gbb_json_writer_add_double_value(writer, overhead->cpu_time);
+        gbb_json_writer_set_member_name(writer, "process-cpu-time");
+        gbb_json_writer_add_double_value(writer, overhead->process_cpu_time);
+        gbb_json_writer_set_member_name(writer, "context-switches");
+        gbb_json_writer_add_int_value(writer, overhead->n_context_switches);
+
+        /* Derived values, again for the benefit of other consumers */
+        if (overhead->elapsed > 0) {
+            gbb_json_writer_set_member_name(writer, "wakeups-per-second");
+            gbb_json_writer_add_double_value(writer, overhead->n_wakeups / overhead->elapsed);
+        }
+        if (overhead->n_wakeups > 0) {
+            gbb_json_writer_set_member_name(writer, "cpu-time-per-wakeup-us");
+            gbb_json_writer_add_double_value(writer, 1e6 * overhead->cpu_time / overhead->n_wakeups);
+        }
+        if (overhead->n_reads > 0) {
+            gbb_json_writer_set_member_name(writer, "syscalls-per-read");
+            gbb_json_writer_add_double_value(writer, (double) overhead->n_syscalls / overhead->n_reads);
+        }
+        gbb_json_writer_end_object(writer);
+    }
 
-    const GbbPowerState *last_state = NULL;
-    for (l = run->history->head; l; l = l->next) {
-        const GbbPowerState *state = l->data;
+    if (run->have_replay_timing) {
+        const GbbReplayTiming *timing = &run->replay_timing;
+
+        gbb_json_writer_set_member_name(writer, "replay-timing");
+        gbb_json_writer_begin_object(writer);
+        gbb_json_writer_set_member_name(writer, "events");
+        gbb_json_writer_add_int_value(writer, timing->n_events);
+        gbb_json_writer_set_member_name(writer, "late-events");
+        gbb_json_writer_add_int_value(writer, timing->n_late);
+        gbb_json_writer_set_member_name(writer, "late-threshold-ms");
+        gbb_json_writer_add_double_value(writer, GBB_REPLAY_LATE_THRESHOLD_US / 1000.);
+        gbb_json_writer_set_member_name(writer, "p50-ms");
+        gbb_json_writer_add_double_value(writer, gbb_replay_timing_get_percentile(timing, 50) / 1000.);
+        gbb_json_writer_set_member_name(writer, "p99-ms");
+        gbb_json_writer_add_double_value(writer, gbb_replay_timing_get_percentile(timing, 99) / 1000.);
+        gbb_json_writer_set_member_name(writer, "max-ms");
+        gbb_json_writer_add_double_value(writer, timing->max_lateness / 1000.);
+        gbb_json_writer_set_member_name(writer, "iterations");
+        gbb_json_writer_add_int_value(writer, timing->n_iterations);
+        gbb_json_writer_set_member_name(writer, "total-drift-ms");
+        gbb_json_writer_add_double_value(writer, timing->total_drift / 1000.);
+        gbb_json_writer_set_member_name(writer, "max-drift-ms");
+        gbb_json_writer_add_double_value(writer, timing->max_drift / 1000.);
+
+        /* Non-empty buckets as [lateness-us, count], lateness
+         * being the low end of the bucket */
+        gbb_json_writer_set_member_name(writer, "histogram");
+        gbb_json_writer_begin_array(writer);
+        guint i;
+        for (i = 0; i < GBB_REPLAY_TIMING_N_BUCKETS; i++) {
+            if (timing->buckets[i] == 0)
+                continue;
+
+            gbb_json_writer_begin_array(writer);
+            gbb_json_writer_add_int_value(writer, gbb_replay_timing_bucket_value(i));
+            gbb_json_writer_add_int_value(writer, timing->buckets[i]);
+            gbb_json_writer_end_array(writer);
+        }
+        gbb_json_writer_end_array(writer);
+        gbb_json_writer_end_object(writer);
+    }
+}
+
+/* The log is written out sample by sample, straight from the history,
+ * so memory use doesn't depend on the length of the run */
+static void
+write_run(GbbTestRun    *run,
+          GbbJsonWriter *writer)
+{
+    const GbbPowerState *start_state = gbb_test_run_get_start_state(run);
+
+    gbb_json_writer_begin_object(writer);
+    write_header(run, writer);
+
+    gbb_json_writer_set_member_name(writer, "log");
+    gbb_json_writer_begin_array(writer);
 
-        json_builder_begin_object(builder);
-        json_builder_set_member_name(builder, "time-ms");
-        json_builder_add_int_value(builder, (500 + state->time_us - start_state->time_us) / 1000);
+    guint n_states = gbb_power_history_get_length(run->history);
+    GbbPowerState states[2];
+    const GbbPowerState *last_state = NULL;
+    guint i;
+    for (i = 0; i < n_states; i++) {
+        GbbPowerState *state = &states[i % 2];
+        gbb_power_history_get_state(run->history, i, state);
+
+        gbb_json_writer_begin_object(writer);
+        gbb_json_writer_set_member_name(writer, "time-ms");
+        gbb_json_writer_add_int_value(writer, (500 + state->time_us - start_state->time_us) / 1000);
         if (!last_state || state->online != last_state->online) {
-            json_builder_set_member_name(builder, "online");
-            json_builder_add_boolean_value(builder, state->online);
+            gbb_json_writer_set_member_name(writer, "online");
+            gbb_json_writer_add_boolean_value(writer, state->online);
         }
         if (state->energy_now >= 0) {
-            json_builder_set_member_name(builder, "energy");
-            add_int_value_1e6(builder, state->energy_now);
+            gbb_json_writer_set_member_name(writer, "energy");
+            add_int_value_1e6(writer, state->energy_now);
         }
         if (state->energy_full >= 0 && (!last_state || state->energy_full != last_state->energy_full)) {
-            json_builder_set_member_name(builder, "energy-full");
-            add_int_value_1e6(builder, state->energy_full);
+            gbb_json_writer_set_member_name(writer, "energy-full");
+            add_int_value_1e6(writer, state->energy_full);
         }
         if (state->energy_full_design >= 0 && (!last_state || state->energy_full_design != last_state->energy_full_design)) {
-            json_builder_set_member_name(builder, "energy-full-design");
-            add_int_value_1e6(builder, state->energy_full_design);
+            gbb_json_writer_set_member_name(writer, "energy-full-design");
+            add_int_value_1e6(writer, state->energy_full_design);
         }
 
-        json_builder_end_object(builder);
+        /* RAPL energy used since the start of the run, in uJ */
+        int d;
+        for (d = 0; d < GBB_RAPL_N_DOMAINS; d++) {
+            if (state->rapl_energy[d] >= 0 && start_state->rapl_energy[d] >= 0) {
+                g_autofree char *member = g_strdup_printf("rapl-%s", gbb_rapl_domain_get_name(d));
+                gbb_json_writer_set_member_name(writer, member);
+                add_int_value_1e6(writer, state->rapl_energy[d] - start_state->rapl_energy[d]);
+            }
+        }
+
+        gbb_json_writer_end_object(writer);
         last_state = state;
     }
 
-    json_builder_end_array(builder);
+    gbb_json_writer_end_array(writer);
+
+    gbb_json_writer_end_object(writer);
+}
 
-    json_builder_end_object(builder);
+/* The binary format stores the same values as the JSON one, including
+ * the header, which is written as compact JSON. The log follows as
+ * columns, one per value of GbbPowerState: each is the differences
+ * between consecutive entries, zigzag encoded as unsigned LEB128
+ * varints. Values mostly change slowly or not at all, so nearly every
+ * entry is a byte or two per column. All numbers are varints:
+ *
+ *   magic, version, header size, header,
+ *   number of entries, mask of the columns present,
+ *   for each column present: its size, its data
+ *
+ * A column is left out when it has no values at all, e.g. for RAPL
+ * domains the machine doesn't have.
+ */
+#define BINARY_MAGIC "\x89GBBRUN\n"
+#define BINARY_MAGIC_LENGTH 8
+#define BINARY_SUFFIX ".gbbrun"
+#define BINARY_VERSION 1
 
-    JsonNode *root = json_builder_get_root(builder);
+typedef enum {
+    COLUMN_TIME,                /* ms since the start */
+    COLUMN_ONLINE,
+    COLUMN_ENERGY,              /* uWH, -1 if not known */
+    COLUMN_ENERGY_FULL,
+    COLUMN_ENERGY_FULL_DESIGN,
+    COLUMN_RAPL,                /* uJ since the start, for each domain */
+    N_COLUMNS = COLUMN_RAPL + GBB_RAPL_N_DOMAINS
+} Column;
+
+static gint64
+get_column_value(const GbbPowerState *state,
+                 const GbbPowerState *start_state,
+                 Column               column)
+{
+    int d;
+
+    switch (column) {
+    case COLUMN_TIME:
+        return (500 + state->time_us - start_state->time_us) / 1000;
+    case COLUMN_ONLINE:
+        return state->online ? 1 : 0;
+    case COLUMN_ENERGY:
+        return state->energy_now >= 0 ? to_1e6(state->energy_now) : -1;
+    case COLUMN_ENERGY_FULL:
+        return state->energy_full >= 0 ? to_1e6(state->energy_full) : -1;
+    case COLUMN_ENERGY_FULL_DESIGN:
+        return state->energy_full_design >= 0 ? to_1e6(state->energy_full_design) : -1;
+    default:
+        d = column - COLUMN_RAPL;
+        if (state->rapl_energy[d] >= 0 && start_state->rapl_energy[d] >= 0)
+            return to_1e6(state->rapl_energy[d] - start_state->rapl_energy[d]);
+        return -1;
+    }
+}
+
+static void
+set_column_value(GbbPowerState *state,
+                 Column         column,
+                 gint64         value)
+{
+    double v_1e6 = value >= 0 ? value / 1e6 : -1;
+
+    switch (column) {
+    case COLUMN_TIME:
+        state->time_us = value * 1000;
+        break;
+    case COLUMN_ONLINE:
+        state->online = value != 0;
+        break;
+    case COLUMN_ENERGY:
+        state->energy_now = v_1e6;
+        break;
+    case COLUMN_ENERGY_FULL:
+        state->energy_full = v_1e6;
+        break;
+    case COLUMN_ENERGY_FULL_DESIGN:
+        state->energy_full_design = v_1e6;
+        break;
+    default:
+        state->rapl_energy[column - COLUMN_RAPL] = v_1e6;
+        break;
+    }
+}
+
+static void
+put_varint(GByteArray *array,
+           guint64     value)
+{
+    guint8 byte;
+
+    do {
+        byte = value & 0x7f;
+        value >>= 7;
+        if (value != 0)
+            byte |= 0x80;
+        g_byte_array_append(array, &byte, 1);
+    } while (value != 0);
+}
 
-    JsonGenerator *generator = json_generator_new();
-    json_generator_set_pretty(generator, TRUE);
-    json_generator_set_root(generator, root);
+static gboolean
+get_varint(const guint8 **p,
+           const guint8  *end,
+           guint64       *value)
+{
+    guint shift = 0;
+
+    *value = 0;
+    while (*p < end && shift < 64) {
+        guint8 byte = *(*p)++;
+
+        *value |= (guint64)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0)
+            return TRUE;
+        shift += 7;
+    }
+
+    return FALSE;
+}
+
+static guint64
+zigzag_encode(gint64 value)
+{
+    return ((guint64)value << 1) ^ (guint64)(value >> 63);
+}
+
+static gint64
+zigzag_decode(guint64 value)
+{
+    return (gint64)(value >> 1) ^ -(gint64)(value & 1);
+}
+
+static gboolean
+write_binary(GbbTestRun    *run,
+             GOutputStream *output,
+             GError       **error)
+{
+    const GbbPowerState *start_state = gbb_test_run_get_start_state(run);
+    guint n_states = gbb_power_history_get_length(run->history);
+    GByteArray *columns[N_COLUMNS];
+    gboolean have_values[N_COLUMNS];
+    gint64 last_values[N_COLUMNS];
+    GbbPowerState state;
+    guint64 mask = 0;
+    guint i;
+    int c;
+
+    GOutputStream *header = g_memory_output_stream_new_resizable();
+    GbbJsonWriter *writer = gbb_json_writer_new(header, FALSE);
+    gbb_json_writer_begin_object(writer);
+    write_header(run, writer);
+    gbb_json_writer_end_object(writer);
+    gboolean success = gbb_json_writer_finish(writer, error);
+    gbb_json_writer_free(writer);
+    g_output_stream_close(header, NULL, NULL);
+
+    for (c = 0; c < N_COLUMNS; c++) {
+        columns[c] = g_byte_array_new();
+        have_values[c] = c < COLUMN_ENERGY;
+        last_values[c] = 0;
+    }
 
-    /* Small hack to force a fsync() on the file: pre-create the file
-     * with non-zero content which will make g_file_set_contents()
-     * call fsync() since this is now an atomic replace. We don't
-     * really care this first g_file_set_contents fails.
+    for (i = 0; i < n_states; i++) {
+        gbb_power_history_get_state(run->history, i, &state);
+
+        for (c = 0; c < N_COLUMNS; c++) {
+            gint64 value = get_column_value(&state, start_state, c);
+
+            put_varint(columns[c], zigzag_encode(value - last_values[c]));
+            last_values[c] = value;
+            if (value >= 0)
+                have_values[c] = TRUE;
+        }
+    }
+
+    GByteArray *buffer = g_byte_array_new();
+    g_byte_array_append(buffer, (const guint8 *)BINARY_MAGIC, BINARY_MAGIC_LENGTH);
+    put_varint(buffer, BINARY_VERSION);
+    put_varint(buffer, g_memory_output_stream_get_data_size(G_MEMORY_OUTPUT_STREAM(header)));
+    g_byte_array_append(buffer,
+                        g_memory_output_stream_get_data(G_MEMORY_OUTPUT_STREAM(header)),
+                        g_memory_output_stream_get_data_size(G_MEMORY_OUTPUT_STREAM(header)));
+    put_varint(buffer, n_states);
+    for (c = 0; c < N_COLUMNS; c++) {
+        if (have_values[c])
+            mask |= 1 << c;
+    }
+    put_varint(buffer, mask);
+
+    if (success)
+        success = g_output_stream_write_all(output, buffer->data, buffer->len, NULL, NULL, error);
+
+    for (c = 0; c < N_COLUMNS; c++) {
+        if (success && have_values[c]) {
+            g_byte_array_set_size(buffer, 0);
+            put_varint(buffer, columns[c]->len);
+            success = (g_output_stream_write_all(output, buffer->data, buffer->len, NULL, NULL, error) &&
+                       g_output_stream_write_all(output, columns[c]->data, columns[c]->len, NULL, NULL, error));
+        }
+        g_byte_array_unref(columns[c]);
+    }
+
+    g_byte_array_unref(buffer);
+    g_object_unref(header);
+
+    return success;
+}
+
+/* Either format can be compressed on top: that's chosen by the suffix
+ * of the filename when writing, and found from the first bytes when
+ * reading, so that a renamed file still loads.
+ */
+#define GZIP_SUFFIX ".gz"
+#define GZIP_MAGIC "\x1f\x8b"
+#define GZIP_MAGIC_LENGTH 2
+#define ZSTD_SUFFIX ".zst"
+#define ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+#define ZSTD_MAGIC_LENGTH 4
+
+/* *compressor is left NULL for an uncompressed file */
+static gboolean
+get_compressor(const char  *filename,
+               GConverter **compressor,
+               GError     **error)
+{
+    *compressor = NULL;
+
+    if (g_str_has_suffix(filename, GZIP_SUFFIX)) {
+        *compressor = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP, -1));
+    } else if (g_str_has_suffix(filename, ZSTD_SUFFIX)) {
+#ifdef HAVE_ZSTD
+        *compressor = G_CONVERTER(gbb_zstd_converter_new_compressor(0));
+#else
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "%s: built without zstd support", filename);
+        return FALSE;
+#endif
+    }
+
+    return TRUE;
+}
+
+gboolean
+gbb_test_run_write_to_file(GbbTestRun          *run,
+                           const char          *filename,
+                           GbbTestRunWriteFlags flags,
+                           GError             **error)
+{
+    GConverter *compressor;
+    if (!get_compressor(filename, &compressor, error))
+        return FALSE;
+
+    /* g_file_replace() only writes to a temporary file, and fsync()s
+     * it before renaming it over, when replacing a non-empty file; so
+     * for a new file, pre-create it with some content. An existing
+     * file is left alone, for a failed write to keep it. We don't
+     * really care if this g_file_set_contents fails.
      */
-    g_file_set_contents(filename, "gnome-battery-bench", 20, NULL);
-    gsize len;
-    gchar *buffer = json_generator_to_data (generator, &len);
-    gboolean success = g_file_set_contents(filename, buffer, len, error);
-    g_free(buffer);
+    gboolean created = FALSE;
+    if (!g_file_test(filename, G_FILE_TEST_EXISTS))
+        created = g_file_set_contents(filename, "gnome-battery-bench", 20, NULL);
+
+    GFile *file = g_file_new_for_path(filename);
+    GFileOutputStream *output = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE,
+                                               NULL, error);
+    g_object_unref(file);
+    if (output == NULL) {
+        if (created)
+            g_unlink(filename);
+        g_clear_object(&compressor);
+        return FALSE;
+    }
+
+    /* Closing this closes the file as well */
+    GOutputStream *stream;
+    if (compressor) {
+        stream = g_converter_output_stream_new(G_OUTPUT_STREAM(output), compressor);
+        g_object_unref(compressor);
+    } else {
+        stream = g_object_ref(output);
+    }
 
-    g_object_unref(generator);
-    json_node_free(root);
-    g_object_unref(builder);
+    gboolean success;
+    if (flags & GBB_TEST_RUN_WRITE_BINARY) {
+        success = write_binary(run, stream, error);
+    } else {
+        GbbJsonWriter *writer = gbb_json_writer_new(stream,
+                                                    (flags & GBB_TEST_RUN_WRITE_COMPACT) == 0);
+        write_run(run, writer);
+        success = gbb_json_writer_finish(writer, error);
+        gbb_json_writer_free(writer);
+    }
+
+    if (success) {
+        success = g_output_stream_close(stream, NULL, error);
+    } else {
+        /* A cancelled close leaves what was there before in place,
+         * which for a new file is just the placeholder */
+        GCancellable *cancellable = g_cancellable_new();
+        g_cancellable_cancel(cancellable);
+        g_output_stream_close(stream, cancellable, NULL);
+        g_object_unref(cancellable);
+        if (created)
+            g_unlink(filename);
+    }
+    g_object_unref(stream);
+    g_object_unref(output);
 
     if (success) {
         g_free(run->filename);
         run->filename = g_strdup(filename);
+
+        /* The log has it all now */
+        gbb_test_run_discard_journal(run);
     }
 
     return success;
 }
 
+static void
+add_header_double(GbbRunJournal *journal,
+                  const char    *key,
+                  double         value)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    gbb_run_journal_add_header(journal, key, g_ascii_dtostr(buf, sizeof(buf), value));
+}
+
+gboolean
+gbb_test_run_start_journal(GbbTestRun *run,
+                           const char *filename,
+                           GError    **error)
+{
+    g_return_val_if_fail(run->test != NULL, FALSE);
+    g_return_val_if_fail(run->journal == NULL, FALSE);
+
+    GbbRunJournal *journal = gbb_run_journal_create(filename, error);
+    if (journal == NULL)
+        return FALSE;
+
+    gbb_run_journal_add_header(journal, "id", run->id);
+    gbb_run_journal_add_header(journal, "test-id", run->test->id);
+    if (run->duration_type == GBB_DURATION_TIME)
+        add_header_double(journal, "duration-seconds", run->duration.seconds);
+    else
+        add_header_double(journal, "until-percent", run->duration.percent);
+    add_header_double(journal, "screen-brightness", run->screen_brightness);
+    add_header_double(journal, "start-time", run->start_time);
+
+    guint n_states = gbb_power_history_get_length(run->history);
+    guint i;
+    for (i = 0; i < n_states; i++) {
+        GbbPowerState state;
+        gbb_power_history_get_state(run->history, i, &state);
+        gbb_run_journal_add_state(journal, &state);
+    }
+
+    if (!gbb_run_journal_sync(journal, error)) {
+        gbb_run_journal_close(journal, TRUE);
+        return FALSE;
+    }
+
+    run->journal = journal;
+    return TRUE;
+}
+
+void
+gbb_test_run_discard_journal(GbbTestRun *run)
+{
+    if (run->journal) {
+        gbb_run_journal_close(run->journal, TRUE);
+        run->journal = NULL;
+    }
+}
+
+static gboolean
+get_header_double(GHashTable *header,
+                  const char *key,
+                  double     *result)
+{
+    const char *value = g_hash_table_lookup(header, key);
+    char *end;
+
+    if (value == NULL)
+        return FALSE;
+
+    *result = g_ascii_strtod(value, &end);
+    return end != value && *end == '\0';
+}
+
+GbbTestRun *
+gbb_test_run_new_from_journal(const char *filename,
+                              GError    **error)
+{
+    GHashTable *header;
+    GArray *states;
+    GbbTestRun *run = NULL;
+    double v_double;
+
+    if (!gbb_run_journal_read(filename, &header, &states, error))
+        return NULL;
+
+    const char *test_id = g_hash_table_lookup(header, "test-id");
+    GbbBatteryTest *test = test_id ? gbb_battery_test_get_for_id(test_id) : NULL;
+    if (test == NULL) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s: unknown test '%s'", filename, test_id ? test_id : "");
+        goto out;
+    }
+
+    run = gbb_test_run_new(test);
+
+    const char *id = g_hash_table_lookup(header, "id");
+    if (id) {
+        g_free(run->id);
+        run->id = g_strdup(id);
+    }
+
+    if (get_header_double(header, "until-percent", &v_double))
+        gbb_test_run_set_duration_percent(run, v_double);
+    else if (get_header_double(header, "duration-seconds", &v_double))
+        gbb_test_run_set_duration_time(run, v_double);
+    if (get_header_double(header, "screen-brightness", &v_double))
+        gbb_test_run_set_screen_brightness(run, v_double);
+    if (get_header_double(header, "start-time", &v_double))
+        gbb_test_run_set_start_time(run, v_double);
+
+    /* These were accepted before, so they will be again */
+    guint i;
+    for (i = 0; i < states->len; i++)
+        test_run_add_internal(run, &g_array_index(states, GbbPowerState, i));
+
+out:
+    g_hash_table_destroy(header);
+    g_array_unref(states);
+
+    return run;
+}
+
+gboolean
+gbb_test_run_is_log_filename(const char *filename)
+{
+    static const char *suffixes[] = { ".json", BINARY_SUFFIX };
+    /* Without zstd support, .zst logs could only fail to load */
+    static const char *compressed_suffixes[] = {
+        "", GZIP_SUFFIX,
+#ifdef HAVE_ZSTD
+        ZSTD_SUFFIX
+#endif
+    };
+    guint i, j;
+
+    for (j = 0; j < G_N_ELEMENTS(compressed_suffixes); j++) {
+        if (!g_str_has_suffix(filename, compressed_suffixes[j]))
+            continue;
+
+        gsize len = strlen(filename) - strlen(compressed_suffixes[j]);
+        for (i = 0; i < G_N_ELEMENTS(suffixes); i++) {
+            gsize suffix_len = strlen(suffixes[i]);
+            if (len >= suffix_len &&
+                strncmp(filename + len - suffix_len, suffixes[i], suffix_len) == 0)
+                return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
 char *
 gbb_test_run_get_default_path(GbbTestRun *run,
                               GFile      *folder)
@@ -461,289 +1154,481 @@ gbb_test_run_get_default_path(GbbTestRun *run,
     return file_path;
 }
 
-typedef enum {
-    MISSING, ERROR, OK
-} GetResult;
-
-static GetResult
-get_double(JsonObject *object,
-           const char *member_name,
-           double     *v_double,
-           GError    **error)
-{
-    JsonNode *member = json_object_get_member(object, member_name);
-    if (member == NULL)
-        return MISSING;
-
-    GType value_type = json_node_get_value_type(member);
-    if (value_type == G_TYPE_INT64) {
-        *v_double = json_node_get_int(member);
-        return OK;
-    } else if (value_type == G_TYPE_DOUBLE) {
-        *v_double = json_node_get_double(member);
-        return OK;
-    } else {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "value for '%s' is not a double", member_name);
-        return ERROR;
+static void
+read_int_1e6(GbbJsonReader *reader,
+             double        *value)
+{
+    gint64 v_int;
+
+    if (gbb_json_reader_read_int(reader, &v_int))
+        *value = v_int / 1e6;
+}
+
+static void
+read_overhead(GbbJsonReader      *reader,
+              GbbMonitorOverhead *overhead)
+{
+    const char *name;
+    gint64 v_int;
+
+    gbb_json_reader_begin_object(reader);
+    while (gbb_json_reader_next_member(reader, &name)) {
+        if (strcmp(name, "duration-seconds") == 0) {
+            gbb_json_reader_read_double(reader, &overhead->elapsed);
+        } else if (strcmp(name, "cpu-time") == 0) {
+            gbb_json_reader_read_double(reader, &overhead->cpu_time);
+        } else if (strcmp(name, "process-cpu-time") == 0) {
+            gbb_json_reader_read_double(reader, &overhead->process_cpu_time);
+        } else if (strcmp(name, "wakeups") == 0) {
+            if (gbb_json_reader_read_int(reader, &v_int))
+                overhead->n_wakeups = v_int;
+        } else if (strcmp(name, "reads") == 0) {
+            if (gbb_json_reader_read_int(reader, &v_int))
+                overhead->n_reads = v_int;
+        } else if (strcmp(name, "syscalls") == 0) {
+            if (gbb_json_reader_read_int(reader, &v_int))
+                overhead->n_syscalls = v_int;
+        } else if (strcmp(name, "context-switches") == 0) {
+            gbb_json_reader_read_int(reader, &overhead->n_context_switches);
+        } else {
+            /* Derived values */
+            gbb_json_reader_skip_value(reader);
+        }
     }
 }
 
-static GetResult
-get_int(JsonObject *object,
-        const char *member_name,
-        gint64     *v_int,
-        GError    **error)
+static void
+read_histogram(GbbJsonReader   *reader,
+               GbbReplayTiming *timing)
 {
-    JsonNode *member = json_object_get_member(object, member_name);
-    if (member == NULL)
-        return MISSING;
+    gbb_json_reader_begin_array(reader);
+    while (gbb_json_reader_next_element(reader)) {
+        gint64 bucket[2];
+        guint n = 0;
+
+        gbb_json_reader_begin_array(reader);
+        while (gbb_json_reader_next_element(reader)) {
+            if (n < 2)
+                gbb_json_reader_read_int(reader, &bucket[n]);
+            else
+                gbb_json_reader_skip_value(reader);
+            n++;
+        }
 
-    GType value_type = json_node_get_value_type(member);
-    if (value_type == G_TYPE_INT64) {
-        *v_int = json_node_get_int(member);
-        return OK;
-    } else {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "value for '%s' is not a integer", member_name);
-        return ERROR;
+        if (gbb_json_reader_has_error(reader))
+            return;
+
+        if (n != 2) {
+            gbb_json_reader_fail(reader, "replay-timing histogram entry is not a pair");
+            return;
+        }
+
+        timing->buckets[gbb_replay_timing_value_bucket(bucket[0])] += bucket[1];
     }
 }
 
-static GetResult
-get_int_1e6(JsonObject *object,
-            const char *member_name,
-            double     *v_double,
-            GError    **error)
+static void
+read_replay_timing(GbbJsonReader   *reader,
+                   GbbReplayTiming *timing)
 {
-    JsonNode *member = json_object_get_member(object, member_name);
-    if (member == NULL)
-        return MISSING;
+    const char *name;
+    gint64 v_int;
+    double v_double;
 
-    GType value_type = json_node_get_value_type(member);
-    if (value_type == G_TYPE_INT64) {
-        *v_double = json_node_get_int(member) / 1e6;
-        return OK;
-    } else {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "value for '%s' is not a integer", member_name);
-        return ERROR;
+    gbb_json_reader_begin_object(reader);
+    while (gbb_json_reader_next_member(reader, &name)) {
+        if (strcmp(name, "events") == 0) {
+            if (gbb_json_reader_read_int(reader, &v_int))
+                timing->n_events = v_int;
+        } else if (strcmp(name, "late-events") == 0) {
+            if (gbb_json_reader_read_int(reader, &v_int))
+                timing->n_late = v_int;
+        } else if (strcmp(name, "max-ms") == 0) {
+            if (gbb_json_reader_read_double(reader, &v_double))
+                timing->max_lateness = 1000 * v_double;
+        } else if (strcmp(name, "iterations") == 0) {
+            if (gbb_json_reader_read_int(reader, &v_int))
+                timing->n_iterations = v_int;
+        } else if (strcmp(name, "total-drift-ms") == 0) {
+            if (gbb_json_reader_read_double(reader, &v_double))
+                timing->total_drift = 1000 * v_double;
+        } else if (strcmp(name, "max-drift-ms") == 0) {
+            if (gbb_json_reader_read_double(reader, &v_double))
+                timing->max_drift = 1000 * v_double;
+        } else if (strcmp(name, "histogram") == 0) {
+            read_histogram(reader, timing);
+        } else {
+            /* Derived values */
+            gbb_json_reader_skip_value(reader);
+        }
     }
 }
 
-static GetResult
-get_string(JsonObject  *object,
-           const char  *member_name,
-           const char **v_string,
-           GError     **error)
+static void
+read_start_time(GbbTestRun    *run,
+                GbbJsonReader *reader)
 {
-    JsonNode *member = json_object_get_member(object, member_name);
-    if (member == NULL)
-        return MISSING;
+    char *v_string;
 
-    GType value_type = json_node_get_value_type(member);
-    if (value_type == G_TYPE_STRING) {
-        *v_string = json_node_get_string(member);
-        return OK;
-    } else {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "value for '%s' is not a string", member_name);
-        return ERROR;
+    if (!gbb_json_reader_read_string(reader, &v_string))
+        return;
+
+    char *stripped = g_strstrip(v_string);
+
+    struct tm tm;
+    char *result = strptime(stripped, "%F %T", &tm);
+    if (result == NULL || *result != '\0') {
+        gbb_json_reader_fail(reader, "Cannot parse start-time");
+        g_free(v_string);
+        return;
     }
+    g_free(v_string);
+
+    GDateTime *datetime = g_date_time_new_utc(1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday,
+                                              tm.tm_hour, tm.tm_min, tm.tm_sec);
+    if (datetime == NULL) {
+        gbb_json_reader_fail(reader, "Cannot convert start-time to time");
+        return;
+    }
+
+    gbb_test_run_set_start_time(run, g_date_time_to_unix(datetime));
+    g_date_time_unref(datetime);
 }
 
-static GetResult
-get_boolean(JsonObject  *object,
-            const char  *member_name,
-            gboolean    *v_boolean,
-            GError     **error)
+/* Decodes the entries one at a time straight into the history */
+static void
+read_log(GbbTestRun    *run,
+         GbbJsonReader *reader)
 {
-    JsonNode *member = json_object_get_member(object, member_name);
-    if (member == NULL)
-        return MISSING;
+    char *rapl_names[GBB_RAPL_N_DOMAINS];
+    GbbPowerState state;
+    const char *name;
+    gint64 v_int;
+    int d;
+
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++)
+        rapl_names[d] = g_strdup_printf("rapl-%s", gbb_rapl_domain_get_name(d));
+
+    /* Values that are left out are the same as in the previous entry */
+    gbb_power_state_init(&state);
+
+    gbb_json_reader_begin_array(reader);
+    while (gbb_json_reader_next_element(reader)) {
+        gbb_json_reader_begin_object(reader);
+        while (gbb_json_reader_next_member(reader, &name)) {
+            if (strcmp(name, "time-ms") == 0) {
+                if (gbb_json_reader_read_int(reader, &v_int))
+                    state.time_us = v_int * 1000;
+            } else if (strcmp(name, "online") == 0) {
+                gbb_json_reader_read_boolean(reader, &state.online);
+            } else if (strcmp(name, "energy") == 0) {
+                read_int_1e6(reader, &state.energy_now);
+            } else if (strcmp(name, "energy-full") == 0) {
+                read_int_1e6(reader, &state.energy_full);
+            } else if (strcmp(name, "energy-full-design") == 0) {
+                read_int_1e6(reader, &state.energy_full_design);
+            } else {
+                for (d = 0; d < GBB_RAPL_N_DOMAINS; d++) {
+                    if (strcmp(name, rapl_names[d]) == 0)
+                        break;
+                }
+
+                if (d < GBB_RAPL_N_DOMAINS)
+                    read_int_1e6(reader, &state.rapl_energy[d]);
+                else
+                    gbb_json_reader_skip_value(reader);
+            }
+        }
 
-    GType value_type = json_node_get_value_type(member);
-    if (value_type == G_TYPE_BOOLEAN) {
-        *v_boolean = json_node_get_boolean(member);
-        return OK;
-    } else {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "value for '%s' is not a boolean", member_name);
-        return ERROR;
+        if (gbb_json_reader_has_error(reader))
+            break;
+
+        test_run_add_internal(run, &state);
     }
+
+    for (d = 0; d < GBB_RAPL_N_DOMAINS; d++)
+        g_free(rapl_names[d]);
 }
 
-static GetResult
-get_array(JsonObject  *object,
-          const char  *member_name,
-          JsonArray  **v_array,
-          GError     **error)
+/* Reads a member of the root object other than the log */
+static void
+read_header_member(GbbTestRun         *run,
+                   GbbJsonReader      *reader,
+                   const char         *name,
+                   GbbTestRunReadFlags flags)
 {
-    JsonNode *member = json_object_get_member(object, member_name);
-    if (member == NULL)
-        return MISSING;
+    char *v_string;
+    double v_double;
+    gint64 v_int;
 
-    if (JSON_NODE_HOLDS_ARRAY(member)) {
-        *v_array = json_node_get_array(member);
-        return OK;
+    if (strcmp(name, "id") == 0) {
+        if (gbb_json_reader_read_string(reader, &v_string)) {
+            g_free(run->id);
+            run->id = v_string;
+        }
+    } else if (strcmp(name, "test-id") == 0) {
+        if (gbb_json_reader_read_string(reader, &v_string)) {
+            g_free(run->test_id);
+            run->test_id = v_string;
+        }
+    } else if (strcmp(name, "test-name") == 0) {
+        if (gbb_json_reader_read_string(reader, &v_string)) {
+            g_free(run->name);
+            run->name = v_string;
+        }
+    } else if (strcmp(name, "test-description") == 0) {
+        if (gbb_json_reader_read_string(reader, &v_string)) {
+            g_free(run->description);
+            run->description = v_string;
+        }
+    } else if (strcmp(name, "duration-seconds") == 0) {
+        if (gbb_json_reader_read_double(reader, &v_double))
+            gbb_test_run_set_duration_time(run, v_double);
+    } else if (strcmp(name, "until-percent") == 0) {
+        if (gbb_json_reader_read_double(reader, &v_double))
+            gbb_test_run_set_duration_percent(run, v_double);
+    } else if (strcmp(name, "screen-brightness") == 0) {
+        if (gbb_json_reader_read_int(reader, &v_int))
+            gbb_test_run_set_screen_brightness(run, v_int);
+    } else if (strcmp(name, "start-time") == 0) {
+        read_start_time(run, reader);
+    } else if (strcmp(name, "system-info") == 0 && (flags & GBB_TEST_RUN_READ_HEADER_ONLY) == 0) {
+        /* Only kept to write it out again */
+        g_clear_pointer(&run->system_info, json_node_free);
+        run->system_info = gbb_json_reader_read_node(reader);
+    } else if (strcmp(name, "power") == 0) {
+        gbb_json_reader_read_double(reader, &run->file_power);
+    } else if (strcmp(name, "monitor-overhead") == 0) {
+        read_overhead(reader, &run->overhead);
+        run->have_overhead = TRUE;
+    } else if (strcmp(name, "replay-timing") == 0) {
+        read_replay_timing(reader, &run->replay_timing);
+        run->have_replay_timing = TRUE;
     } else {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "value for '%s' is not an array", member_name);
-        return ERROR;
+        gbb_json_reader_skip_value(reader);
     }
 }
 
 static gboolean
-read_from_file(GbbTestRun *run,
-               const char *filename,
-               GError    **error)
+read_json(GbbTestRun         *run,
+          GBytes             *bytes,
+          const char         *filename,
+          GbbTestRunReadFlags flags,
+          GError            **error)
 {
-    JsonParser *parser = json_parser_new();
-    gboolean success = FALSE;
-    GbbPowerState *state = NULL;
-
-    if (!json_parser_load_from_file(parser, filename, error))
-        goto out;
-
-    JsonNode *root = json_parser_get_root(parser);
-    if (!JSON_NODE_HOLDS_OBJECT(root)) {
-        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                    "Root node is not an object");
-        goto out;
+    GbbJsonReader *reader = gbb_json_reader_new(bytes, filename);
+    gboolean header_only = (flags & GBB_TEST_RUN_READ_HEADER_ONLY) != 0;
+    const char *name;
+
+    gbb_json_reader_begin_object(reader);
+    while (gbb_json_reader_next_member(reader, &name)) {
+        if (strcmp(name, "log") == 0) {
+            /* Written last, after everything a listing needs */
+            if (header_only)
+                break;
+            read_log(run, reader);
+        } else {
+            read_header_member(run, reader, name, flags);
+        }
     }
-    JsonObject *root_object = json_node_get_object(root);
 
-    double v_double;
-    gint64 v_int;
-    const char *v_string;
-    gboolean v_boolean;
-    JsonArray *v_array;
+    if (!header_only)
+        gbb_json_reader_end(reader);
 
-    /* We could save it, but it's not really useful for a historical log */
-    run->loop_time = 0.0;
+    gboolean success = gbb_json_reader_finish(reader, error);
+    gbb_json_reader_free(reader);
 
-    switch (get_string(root_object, "test-name", &v_string, error)) {
-    case MISSING: break;
-    case ERROR: goto out;
-    case OK: run->name = g_strdup(v_string); break;
-    }
+    return success;
+}
 
-    switch (get_string(root_object, "test-description", &v_string, error)) {
-    case MISSING: break;
-    case ERROR: goto out;
-    case OK: run->description = g_strdup(v_string); break;
+static gboolean
+read_binary(GbbTestRun         *run,
+            GBytes             *bytes,
+            const char         *filename,
+            GbbTestRunReadFlags flags,
+            GError            **error)
+{
+    gsize size;
+    const guint8 *data = g_bytes_get_data(bytes, &size);
+    const guint8 *p = data + BINARY_MAGIC_LENGTH;
+    const guint8 *end = data + size;
+    const guint8 *columns[N_COLUMNS];
+    const guint8 *column_ends[N_COLUMNS];
+    gint64 values[N_COLUMNS];
+    guint64 version, header_size, n_states, mask, column_size, delta;
+    GbbPowerState state;
+    const char *name;
+    guint64 i;
+    int c;
+
+    if (!get_varint(&p, end, &version))
+        goto corrupt;
+    if (version != BINARY_VERSION) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s: unsupported version %" G_GUINT64_FORMAT " of the binary format",
+                    filename, version);
+        return FALSE;
     }
 
-    switch (get_double(root_object, "duration-seconds", &v_double, error)) {
-    case MISSING: break;
-    case ERROR: goto out;
-    case OK: gbb_test_run_set_duration_time(run, v_double); break;
+    if (!get_varint(&p, end, &header_size) || header_size > (guint64)(end - p))
+        goto corrupt;
+
+    GBytes *header = g_bytes_new_from_bytes(bytes, p - data, header_size);
+    GbbJsonReader *reader = gbb_json_reader_new(header, filename);
+    g_bytes_unref(header);
+
+    gbb_json_reader_begin_object(reader);
+    while (gbb_json_reader_next_member(reader, &name))
+        read_header_member(run, reader, name, flags);
+    gbb_json_reader_end(reader);
+
+    gboolean success = gbb_json_reader_finish(reader, error);
+    gbb_json_reader_free(reader);
+    if (!success)
+        return FALSE;
+
+    p += header_size;
+
+    /* Everything a listing needs is in the header */
+    if (flags & GBB_TEST_RUN_READ_HEADER_ONLY)
+        return TRUE;
+
+    if (!get_varint(&p, end, &n_states) || !get_varint(&p, end, &mask))
+        goto corrupt;
+    if ((mask >> N_COLUMNS) != 0 || (mask & (1 << COLUMN_TIME)) == 0)
+        goto corrupt;
+
+    for (c = 0; c < N_COLUMNS; c++) {
+        columns[c] = column_ends[c] = NULL;
+        values[c] = c < COLUMN_ENERGY ? 0 : -1;
+
+        if (mask & (1 << c)) {
+            if (!get_varint(&p, end, &column_size) || column_size > (guint64)(end - p))
+                goto corrupt;
+            columns[c] = p;
+            column_ends[c] = p + column_size;
+            values[c] = 0;
+            p += column_size;
+        }
     }
 
-    switch (get_double(root_object, "until-percent", &v_double, error)) {
-    case MISSING: break;
-    case ERROR: goto out;
-    case OK: gbb_test_run_set_duration_percent(run, v_double); break;
+    for (i = 0; i < n_states; i++) {
+        gbb_power_state_init(&state);
+
+        for (c = 0; c < N_COLUMNS; c++) {
+            if (columns[c]) {
+                if (!get_varint(&columns[c], column_ends[c], &delta))
+                    goto corrupt;
+                values[c] += zigzag_decode(delta);
+            }
+            set_column_value(&state, c, values[c]);
+        }
+
+        test_run_add_internal(run, &state);
     }
 
-    switch (get_int(root_object, "screen-brightness", &v_int, error)) {
-    case MISSING: break;
-    case ERROR: goto out;
-    case OK: gbb_test_run_set_screen_brightness(run, v_int); break;
+    return TRUE;
+
+corrupt:
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                "%s: truncated or corrupt run log", filename);
+    return FALSE;
+}
+
+/* Takes over bytes, and returns them uncompressed if they were
+ * compressed. Everything is decompressed into memory, even when only
+ * the header is wanted: reading compressed logs is for the I/O saved,
+ * and the log index keeps the headers once read.
+ */
+static GBytes *
+uncompress_bytes(GBytes     *bytes,
+                 const char *filename,
+                 GError    **error)
+{
+    gsize size;
+    const guint8 *data = g_bytes_get_data(bytes, &size);
+    GConverter *decompressor = NULL;
+
+    if (size >= GZIP_MAGIC_LENGTH && memcmp(data, GZIP_MAGIC, GZIP_MAGIC_LENGTH) == 0) {
+        decompressor = G_CONVERTER(g_zlib_decompressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP));
+    } else if (size >= ZSTD_MAGIC_LENGTH && memcmp(data, ZSTD_MAGIC, ZSTD_MAGIC_LENGTH) == 0) {
+#ifdef HAVE_ZSTD
+        decompressor = G_CONVERTER(gbb_zstd_converter_new_decompressor());
+#else
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                    "%s: built without zstd support", filename);
+        g_bytes_unref(bytes);
+        return NULL;
+#endif
     }
 
-    switch (get_string(root_object, "start-time", &v_string, error)) {
-    case MISSING: break;
-    case ERROR: goto out;
-    case OK: {
-        char *stripped = g_strstrip(g_strdup(v_string));
+    if (decompressor == NULL)
+        return bytes;
 
-        struct tm tm;
-        char *result = strptime(stripped, "%F %T", &tm);
-        if (result == NULL || *result != '\0') {
-            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                        "Cannot parse start-time");
-            g_free(stripped);
-            goto out;
-        }
-        g_free(stripped);
-
-        GDateTime *datetime = g_date_time_new_utc(1900 + tm.tm_year, tm.tm_mon + 1, tm.tm_mday,
-                                                  tm.tm_hour, tm.tm_min, tm.tm_sec);
-        if (datetime == NULL) {
-            g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                        "Cannot convert start-time to time");
-            goto out;
-        }
+    GInputStream *input = g_memory_input_stream_new_from_bytes(bytes);
+    GInputStream *converted = g_converter_input_stream_new(input, decompressor);
+    GOutputStream *output = g_memory_output_stream_new_resizable();
+    GError *local_error = NULL;
+    GBytes *result = NULL;
 
-        gbb_test_run_set_start_time(run, g_date_time_to_unix(datetime));
-        g_date_time_unref(datetime);
-    }}
-
-    switch (get_array(root_object, "log", &v_array, error)) {
-    case MISSING: break;
-    case ERROR: goto out;
-    case OK: {
-        int count = json_array_get_length(v_array);
-        GbbPowerState *last_state = NULL;
-
-        int i;
-        for (i = 0; i < count; i++) {
-            state = gbb_power_state_new();
-            if (last_state)
-                *state = *last_state;
-
-            JsonNode *node = json_array_get_element(v_array, i);
-            if (!JSON_NODE_HOLDS_OBJECT(node)) {
-                g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
-                            "Log element isn't an object");
-                goto out;
-            }
+    if (g_output_stream_splice(output, converted,
+                               G_OUTPUT_STREAM_SPLICE_CLOSE_SOURCE |
+                               G_OUTPUT_STREAM_SPLICE_CLOSE_TARGET,
+                               NULL, &local_error) >= 0)
+        result = g_memory_output_stream_steal_as_bytes(G_MEMORY_OUTPUT_STREAM(output));
+    else
+        g_propagate_prefixed_error(error, local_error, "%s: ", filename);
 
-            JsonObject *node_object = json_node_get_object(node);
+    g_object_unref(output);
+    g_object_unref(converted);
+    g_object_unref(input);
+    g_object_unref(decompressor);
+    g_bytes_unref(bytes);
 
-            switch (get_int(node_object, "time-ms", &v_int, error)) {
-            case MISSING: break;
-            case ERROR: goto out;
-            case OK: state->time_us = v_int * 1000; break;
-            }
+    return result;
+}
 
-            switch (get_boolean(node_object, "online", &v_boolean, error)) {
-            case MISSING: break;
-            case ERROR: goto out;
-            case OK: state->online = v_boolean;
-            }
+static gboolean
+read_from_file(GbbTestRun         *run,
+               const char         *filename,
+               GbbTestRunReadFlags flags,
+               GError            **error)
+{
+    GMappedFile *mapped = g_mapped_file_new(filename, FALSE, error);
+    if (mapped == NULL)
+        return FALSE;
 
-            if (get_int_1e6(node_object, "energy", &state->energy_now, error) == ERROR)
-                goto out;
-            if (get_int_1e6(node_object, "energy-full", &state->energy_full, error) == ERROR)
-                goto out;
-            if (get_int_1e6(node_object, "energy-full-design", &state->energy_full_design, error) == ERROR)
-                goto out;
+    GBytes *bytes = g_mapped_file_get_bytes(mapped);
+    g_mapped_file_unref(mapped);
 
-            test_run_add_internal(run, state);
-            last_state = state;
+    bytes = uncompress_bytes(bytes, filename, error);
+    if (bytes == NULL)
+        return FALSE;
 
-            state = NULL;
-        }
-    }}
+    /* We could save it, but it's not really useful for a historical log */
+    run->loop_time = 0.0;
 
-    run->filename = g_strdup(filename);
+    gboolean success;
+    if (g_bytes_get_size(bytes) >= BINARY_MAGIC_LENGTH &&
+        memcmp(g_bytes_get_data(bytes, NULL), BINARY_MAGIC, BINARY_MAGIC_LENGTH) == 0)
+        success = read_binary(run, bytes, filename, flags, error);
+    else
+        success = read_json(run, bytes, filename, flags, error);
+    g_bytes_unref(bytes);
+
+    if (success)
+        run->filename = g_strdup(filename);
 
-    success = TRUE;
-out:
-    if (state)
-        gbb_power_state_free(state);
-    g_object_unref(parser);
     return success;
 }
 
 GbbTestRun *
-gbb_test_run_new_from_file(const char *filename,
-                           GError    **error)
+gbb_test_run_new_from_file(const char         *filename,
+                           GbbTestRunReadFlags flags,
+                           GError            **error)
 {
     GbbTestRun *run = g_object_new(GBB_TYPE_TEST_RUN, NULL);
-    if (read_from_file(run, filename, error)) {
+    if (read_from_file(run, filename, flags, error)) {
         return run;
     } else {
         g_object_unref(run);
@@ -6,6 +6,8 @@
 #include <gio/gio.h>
 
 #include "battery-test.h"
+#include "event-player.h"
+#include "power-history.h"
 #include "power-monitor.h"
 
 typedef struct _GbbTestRun GbbTestRun;
@@ -27,8 +29,16 @@ GType gbb_test_run_get_type(void);
 
 GbbTestRun *gbb_test_run_new(GbbBatteryTest *test);
 
-GbbTestRun *gbb_test_run_new_from_file(const char *filename,
-                                       GError    **error);
+typedef enum {
+    GBB_TEST_RUN_READ_NONE        = 0,
+    /* Stops at the log: the run has no samples, just what's needed
+     * to list it, gbb_test_run_get_average_power() included */
+    GBB_TEST_RUN_READ_HEADER_ONLY = 1 << 0
+} GbbTestRunReadFlags;
+
+GbbTestRun *gbb_test_run_new_from_file(const char         *filename,
+                                       GbbTestRunReadFlags flags,
+                                       GError            **error);
 
 GbbBatteryTest *gbb_test_run_get_test(GbbTestRun *run);
 
@@ -60,20 +70,60 @@ const char     *gbb_test_run_get_filename  (GbbTestRun *run);
 const char     *gbb_test_run_get_name        (GbbTestRun *run);
 const char     *gbb_test_run_get_description (GbbTestRun *run);
 
-GQueue         *gbb_test_run_get_history(GbbTestRun *run);
+const GbbPowerHistory *gbb_test_run_get_history(GbbTestRun *run);
+
+/* Values derived from the history as it is added to; one per entry,
+ * -1 where they can't be computed (e.g. for the first entry) */
+const double   *gbb_test_run_get_power_series   (GbbTestRun *run);
+const double   *gbb_test_run_get_life_series    (GbbTestRun *run);
+const double   *gbb_test_run_get_percent_series (GbbTestRun *run);
 
 const GbbPowerState *gbb_test_run_get_start_state (GbbTestRun *run);
 const GbbPowerState *gbb_test_run_get_last_state  (GbbTestRun *run);
 
+void                      gbb_test_run_set_monitor_overhead (GbbTestRun               *run,
+                                                             const GbbMonitorOverhead *overhead);
+const GbbMonitorOverhead *gbb_test_run_get_monitor_overhead (GbbTestRun               *run);
+
+void                   gbb_test_run_set_replay_timing (GbbTestRun            *run,
+                                                       const GbbReplayTiming *timing);
+const GbbReplayTiming *gbb_test_run_get_replay_timing (GbbTestRun            *run);
+
 double          gbb_test_run_get_max_power        (GbbTestRun *run);
 double          gbb_test_run_get_max_battery_life (GbbTestRun *run);
+/* W over the whole run, -1 if not known */
+double          gbb_test_run_get_average_power    (GbbTestRun *run);
+
+/* Whether the name is that of a log in one of the formats read by
+ * gbb_test_run_new_from_file() */
+gboolean gbb_test_run_is_log_filename(const char *filename);
 
 char *gbb_test_run_get_default_path(GbbTestRun *run,
                                     GFile      *folder);
 
-gboolean gbb_test_run_write_to_file(GbbTestRun *run,
-                                    const char *filename,
-                                    GError    **error);
+typedef enum {
+    GBB_TEST_RUN_WRITE_NONE    = 0,
+    GBB_TEST_RUN_WRITE_COMPACT = 1 << 0, /* no indentation or line breaks */
+    GBB_TEST_RUN_WRITE_BINARY  = 1 << 1  /* see test-run.c; read back just the same */
+} GbbTestRunWriteFlags;
+
+/* A filename ending in .gz or .zst gets the output compressed; that's
+ * undone transparently by gbb_test_run_new_from_file() */
+gboolean gbb_test_run_write_to_file(GbbTestRun          *run,
+                                    const char          *filename,
+                                    GbbTestRunWriteFlags flags,
+                                    GError             **error);
+
+/* Starts writing the samples, from the ones added so far on, to a
+ * journal (see run-journal.h). It's removed once the run has been
+ * written out with gbb_test_run_write_to_file() */
+gboolean    gbb_test_run_start_journal    (GbbTestRun *run,
+                                           const char *filename,
+                                           GError    **error);
+void        gbb_test_run_discard_journal  (GbbTestRun *run);
+/* Turns the journal of a run that never finished back into a run */
+GbbTestRun *gbb_test_run_new_from_journal (const char *filename,
+                                           GError    **error);
 
 #endif /* __TEST_RUN_H__ */
 
@@ -1,20 +1,24 @@
 /* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
 
+#include "power-source.h"
 #include "remote-player.h"
+#include "simulated-player.h"
 #include "system-state.h"
 #include "test-runner.h"
+#include "util-clock.h"
 
 struct _GbbTestRunner {
     GObject parent;
 
     GbbPowerMonitor *monitor;
     GbbEventPlayer *player;
-    GbbSystemState *system_state;
+    GbbSystemState *system_state; /* NULL when simulated */
 
     GbbBatteryTest *test;
     GbbTestRun *run;
 
     GbbTestPhase phase;
+    gboolean playing_loop;
     gboolean stop_requested;
     gboolean force_stop;
 };
@@ -39,6 +43,15 @@ runner_set_phase(GbbTestRunner *runner,
     if (runner->phase == phase)
         return;
 
+    /* Leaving the measured part of the test; remember what the
+     * monitoring itself cost us during it */
+    if (runner->phase == GBB_TEST_PHASE_RUNNING) {
+        GbbMonitorOverhead overhead;
+
+        gbb_power_monitor_get_overhead(runner->monitor, &overhead);
+        gbb_test_run_set_monitor_overhead(runner->run, &overhead);
+    }
+
     runner->phase = phase;
     g_signal_emit(runner, signals[PHASE_CHANGED], 0);
 }
@@ -46,7 +59,8 @@ runner_set_phase(GbbTestRunner *runner,
 static void
 runner_set_stopped(GbbTestRunner *runner)
 {
-    gbb_system_state_restore(runner->system_state);
+    if (runner->system_state)
+        gbb_system_state_restore(runner->system_state);
 
     runner_set_phase(runner, GBB_TEST_PHASE_STOPPED);
 }
@@ -55,17 +69,42 @@ static void
 runner_set_epilogue(GbbTestRunner *runner)
 {
     if (runner->test->epilogue_file) {
-        gbb_event_player_play_file(runner->player, runner->test->epilogue_file);
+        gbb_event_player_start(runner->player, "epilogue", 1);
         runner_set_phase(runner, GBB_TEST_PHASE_EPILOGUE);
     } else {
         runner_set_stopped(runner);
     }
 }
 
+static void
+runner_play_loop(GbbTestRunner *runner)
+{
+    runner->playing_loop = TRUE;
+    gbb_event_player_start(runner->player, "loop", 0);
+}
+
+static void
+on_player_iteration(GbbEventPlayer *player,
+                    GbbTestRunner  *runner)
+{
+    /* Only checked between iterations, so that every run
+     * consists of complete loops of the workload */
+    if (runner->phase == GBB_TEST_PHASE_RUNNING && gbb_test_run_is_done(runner->run))
+        gbb_event_player_stop(player);
+}
+
 static void
 on_player_finished(GbbEventPlayer *player,
                    GbbTestRunner  *runner)
 {
+    /* Whether it ran out or was stopped, keep how faithfully the
+     * loop has been replayed so far */
+    if (runner->playing_loop) {
+        runner->playing_loop = FALSE;
+        gbb_test_run_set_replay_timing(runner->run,
+                                       gbb_event_player_get_replay_timing(player));
+    }
+
     if (runner->force_stop) {
         runner->force_stop = FALSE;
         runner_set_stopped(runner);
@@ -80,10 +119,8 @@ on_player_finished(GbbEventPlayer *player,
             gbb_test_runner_stop(runner);
         }
     } else if (runner->phase == GBB_TEST_PHASE_RUNNING) {
-        if (gbb_test_run_is_done(runner->run))
-            runner_set_epilogue(runner);
-        else
-            gbb_event_player_play_file(player, runner->test->loop_file);
+        /* The loop was stopped because the run is done */
+        runner_set_epilogue(runner);
     } else if (runner->phase == GBB_TEST_PHASE_STOPPING) {
         runner_set_epilogue(runner);
     } else if (runner->phase == GBB_TEST_PHASE_EPILOGUE) {
@@ -100,9 +137,11 @@ on_power_monitor_changed(GbbPowerMonitor *monitor,
     if (runner->phase == GBB_TEST_PHASE_WAITING) {
         if (!current_state->online) {
             gbb_test_run_set_start_time(runner->run, time(NULL));
+            gbb_power_monitor_reset_overhead(monitor);
+            gbb_event_player_reset_replay_timing(runner->player);
             gbb_test_run_add(runner->run, current_state);
             runner_set_phase(runner, GBB_TEST_PHASE_RUNNING);
-            gbb_event_player_play_file(runner->player, runner->test->loop_file);
+            runner_play_loop(runner);
         }
     } else if (runner->phase == GBB_TEST_PHASE_RUNNING) {
         gbb_test_run_add(runner->run, current_state);
@@ -122,16 +161,6 @@ gbb_test_runner_finalize(GObject *object)
 static void
 gbb_test_runner_init(GbbTestRunner *runner)
 {
-    runner->monitor = gbb_power_monitor_new();
-    g_signal_connect(runner->monitor, "changed",
-                     G_CALLBACK(on_power_monitor_changed),
-                     runner);
-
-    runner->system_state = gbb_system_state_new();
-
-    runner->player = GBB_EVENT_PLAYER(gbb_remote_player_new("GNOME Battery Bench"));
-    g_signal_connect(runner->player, "finished",
-                     G_CALLBACK(on_player_finished), runner);
 }
 
 static void
@@ -150,11 +179,54 @@ gbb_test_runner_class_init(GbbTestRunnerClass *run_class)
                       G_TYPE_NONE, 0);
 }
 
+static void
+runner_setup(GbbTestRunner   *runner,
+             GbbPowerMonitor *monitor,
+             GbbEventPlayer  *player)
+{
+    runner->monitor = monitor;
+    g_signal_connect(runner->monitor, "changed",
+                     G_CALLBACK(on_power_monitor_changed),
+                     runner);
+
+    runner->player = player;
+    g_signal_connect(runner->player, "iteration",
+                     G_CALLBACK(on_player_iteration), runner);
+    g_signal_connect(runner->player, "finished",
+                     G_CALLBACK(on_player_finished), runner);
+}
+
 GbbTestRunner *
 gbb_test_runner_new(void)
 {
     GbbTestRunner *runner = g_object_new(GBB_TYPE_TEST_RUNNER, NULL);
 
+    runner->system_state = gbb_system_state_new();
+    runner_setup(runner,
+                 gbb_power_monitor_new(),
+                 GBB_EVENT_PLAYER(gbb_remote_player_new("GNOME Battery Bench")));
+
+    return runner;
+}
+
+GbbTestRunner *
+gbb_test_runner_new_simulated(GbbPowerSource *battery)
+{
+    GbbTestRunner *runner;
+    GList *sources;
+
+    g_return_val_if_fail(gbb_clock_is_virtual(), NULL);
+
+    runner = g_object_new(GBB_TYPE_TEST_RUNNER, NULL);
+    sources = g_list_prepend(NULL, battery);
+
+    /* Nothing is sent to the session; no brightness changes and
+     * no input events */
+    runner_setup(runner,
+                 gbb_power_monitor_new_for_sources(sources),
+                 GBB_EVENT_PLAYER(gbb_simulated_player_new()));
+    g_list_free(sources);
+
     return runner;
 }
 
@@ -206,13 +278,23 @@ gbb_test_runner_start(GbbTestRunner *runner)
     g_return_if_fail(runner->phase == GBB_TEST_PHASE_STOPPED);
     g_return_if_fail(runner->run != NULL);
 
-    gbb_system_state_save(runner->system_state);
-    gbb_system_state_set_brightnesses(runner->system_state,
-                                      gbb_test_run_get_screen_brightness(runner->run),
-                                      0);
+    if (runner->system_state) {
+        gbb_system_state_save(runner->system_state);
+        gbb_system_state_set_brightnesses(runner->system_state,
+                                          gbb_test_run_get_screen_brightness(runner->run),
+                                          0);
+    }
+
+    /* Send all the logs to the player up front, so nothing
+     * but starting and stopping happens during the test */
+    if (runner->test->prologue_file)
+        gbb_event_player_load_file(runner->player, "prologue", runner->test->prologue_file);
+    gbb_event_player_load_file(runner->player, "loop", runner->test->loop_file);
+    if (runner->test->epilogue_file)
+        gbb_event_player_load_file(runner->player, "epilogue", runner->test->epilogue_file);
 
     if (runner->test->prologue_file) {
-        gbb_event_player_play_file(runner->player, runner->test->prologue_file);
+        gbb_event_player_start(runner->player, "prologue", 1);
         runner_set_phase(runner, GBB_TEST_PHASE_PROLOGUE);
     } else {
         runner_set_phase(runner, GBB_TEST_PHASE_WAITING);
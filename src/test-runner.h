@@ -5,6 +5,7 @@
 
 #include "event-player.h"
 #include "power-monitor.h"
+#include "power-source.h"
 #include "test-run.h"
 
 typedef struct _GbbTestRunner GbbTestRunner;
@@ -29,6 +30,9 @@ typedef enum {
 GType gbb_test_runner_get_type(void);
 
 GbbTestRunner *gbb_test_runner_new(void);
+/* Runs the test against a simulated battery in virtual time, see
+ * util-clock.h and simulated-battery.h */
+GbbTestRunner *gbb_test_runner_new_simulated(GbbPowerSource *battery);
 
 GbbPowerMonitor *gbb_test_runner_get_power_monitor(GbbTestRunner *runner);
 GbbEventPlayer  *gbb_test_runner_get_event_player (GbbTestRunner *runner);
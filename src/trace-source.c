@@ -0,0 +1,168 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <gio/gio.h>
+
+#include "power-history.h"
+#include "power-source.h"
+#include "test-run.h"
+#include "trace-source.h"
+#include "util-clock.h"
+
+struct _GbbTraceSource {
+    GObject parent;
+
+    GbbTestRun *run;
+    const GbbPowerHistory *history;
+    gint64 first_time_us; /* time of the first entry in the log */
+
+    gint64 start_time;
+    guint position; /* entry reported by the last read */
+    guint finished_timeout;
+};
+
+enum {
+    FINISHED,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL];
+
+static void trace_source_init (GbbPowerSourceInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GbbTraceSource, gbb_trace_source, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(GBB_TYPE_POWER_SOURCE,
+                                              trace_source_init));
+
+static void
+gbb_trace_source_finalize(GObject *obj)
+{
+    GbbTraceSource *trace = GBB_TRACE_SOURCE(obj);
+
+    if (trace->finished_timeout)
+        gbb_clock_source_remove(trace->finished_timeout);
+
+    g_clear_object(&trace->run);
+
+    G_OBJECT_CLASS(gbb_trace_source_parent_class)->finalize(obj);
+}
+
+static void
+gbb_trace_source_init(GbbTraceSource *trace)
+{
+}
+
+static void
+gbb_trace_source_class_init(GbbTraceSourceClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+    gobject_class->finalize = gbb_trace_source_finalize;
+
+    signals[FINISHED] =
+        g_signal_new ("finished",
+                      GBB_TYPE_TRACE_SOURCE,
+                      G_SIGNAL_RUN_LAST,
+                      0,
+                      NULL, NULL, NULL,
+                      G_TYPE_NONE, 0);
+}
+
+static gboolean
+on_finished_timeout(gpointer data)
+{
+    GbbTraceSource *trace = data;
+
+    trace->finished_timeout = 0;
+    g_signal_emit(trace, signals[FINISHED], 0);
+
+    return G_SOURCE_REMOVE;
+}
+
+GbbTraceSource *
+gbb_trace_source_new_from_file(const char *filename,
+                               GError    **error)
+{
+    GbbTraceSource *trace;
+    GbbTestRun *run;
+
+    run = gbb_test_run_new_from_file(filename, GBB_TEST_RUN_READ_NONE, error);
+    if (run == NULL)
+        return NULL;
+
+    if (gbb_power_history_get_length(gbb_test_run_get_history(run)) == 0) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "%s: no log entries to replay", filename);
+        g_object_unref(run);
+        return NULL;
+    }
+
+    trace = g_object_new(GBB_TYPE_TRACE_SOURCE, NULL);
+    trace->run = run;
+    trace->history = gbb_test_run_get_history(run);
+    trace->first_time_us = gbb_power_history_get_times(trace->history)[0];
+    trace->start_time = gbb_clock_get_time();
+
+    /* Just after the last entry, so that it has been read by then */
+    trace->finished_timeout = gbb_clock_timeout_add(gbb_trace_source_get_duration(trace) * 1000 + 1,
+                                                    on_finished_timeout, trace);
+
+    return trace;
+}
+
+guint
+gbb_trace_source_get_length(GbbTraceSource *trace)
+{
+    return gbb_power_history_get_length(trace->history);
+}
+
+double
+gbb_trace_source_get_duration(GbbTraceSource *trace)
+{
+    const gint64 *times = gbb_power_history_get_times(trace->history);
+    guint length = gbb_power_history_get_length(trace->history);
+
+    return (times[length - 1] - trace->first_time_us) / 1000000.;
+}
+
+static void
+trace_source_read(GbbPowerSource *source,
+                  GbbPowerState  *state)
+{
+    GbbTraceSource *trace = GBB_TRACE_SOURCE(source);
+    const gint64 *times = gbb_power_history_get_times(trace->history);
+    guint length = gbb_power_history_get_length(trace->history);
+    gint64 elapsed = gbb_clock_get_time() - trace->start_time;
+
+    /* Reads only go forward in time, so there's no need to search */
+    while (trace->position + 1 < length &&
+           times[trace->position + 1] - trace->first_time_us <= elapsed)
+        trace->position++;
+
+    gbb_power_history_get_state(trace->history, trace->position, state);
+
+    /* We know exactly when the value was updated */
+    state->time_us = trace->start_time + times[trace->position] - trace->first_time_us;
+}
+
+static double
+trace_source_get_resolution(GbbPowerSource *source)
+{
+    /* Energies are saved in µWh */
+    return 3600 / 1000000.;
+}
+
+static double
+trace_source_get_update_interval(GbbPowerSource *source)
+{
+    /* Recorded logs are already thinned out; the monitor has to
+     * find out when values change just as with a real battery */
+    return GBB_POWER_SOURCE_UPDATE_UNKNOWN;
+}
+
+static void
+trace_source_init(GbbPowerSourceInterface *iface)
+{
+    iface->read = trace_source_read;
+    iface->get_resolution = trace_source_get_resolution;
+    iface->get_update_interval = trace_source_get_update_interval;
+}
@@ -0,0 +1,30 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __TRACE_SOURCE_H__
+#define __TRACE_SOURCE_H__
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+/* A GbbPowerSource that plays back the "log" of a run saved by
+ * gbb_test_run_write_to_file(), on the clock of util-clock.h: each
+ * entry is reported from its recorded time on, measured from when
+ * the source was created. With the virtual clock this goes as fast
+ * as the main loop allows while keeping the recorded timing.
+ *
+ * ::finished is emitted once the clock has passed the last entry.
+ */
+#define GBB_TYPE_TRACE_SOURCE gbb_trace_source_get_type()
+G_DECLARE_FINAL_TYPE(GbbTraceSource, gbb_trace_source, GBB, TRACE_SOURCE, GObject)
+
+GbbTraceSource *gbb_trace_source_new_from_file (const char      *filename,
+                                                GError         **error);
+
+guint           gbb_trace_source_get_length    (GbbTraceSource  *source);
+/* Length of the log (s) */
+double          gbb_trace_source_get_duration  (GbbTraceSource  *source);
+
+G_END_DECLS
+
+#endif /* __TRACE_SOURCE_H__ */
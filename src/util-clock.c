@@ -0,0 +1,158 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include "util-clock.h"
+
+typedef struct {
+    guint id;
+    gint64 deadline;
+    gint64 interval; /* us */
+    GSourceFunc function;
+    gpointer data;
+} VirtualTimeout;
+
+static gboolean is_virtual;
+static gint64 virtual_time;
+
+static GList *timeouts; /* sorted by deadline */
+static guint next_id = 1;
+static guint dispatch_idle;
+/* Off the list while its function runs, and may be removed from it */
+static VirtualTimeout *dispatching;
+static gboolean dispatching_removed;
+
+static gint
+compare_deadlines(gconstpointer a,
+                  gconstpointer b)
+{
+    const VirtualTimeout *timeout_a = a;
+    const VirtualTimeout *timeout_b = b;
+
+    /* Keep timeouts with the same deadline in the order they were added */
+    return timeout_a->deadline < timeout_b->deadline ? -1 : 1;
+}
+
+static gboolean
+on_dispatch_idle(gpointer data)
+{
+    VirtualTimeout *timeout;
+
+    if (timeouts == NULL) {
+        dispatch_idle = 0;
+        return G_SOURCE_REMOVE;
+    }
+
+    timeout = timeouts->data;
+    timeouts = g_list_delete_link(timeouts, timeouts);
+
+    virtual_time = MAX(virtual_time, timeout->deadline);
+
+    dispatching = timeout;
+    dispatching_removed = FALSE;
+    gboolean again = timeout->function(timeout->data);
+    dispatching = NULL;
+
+    if (again && !dispatching_removed) {
+        timeout->deadline += timeout->interval;
+        timeouts = g_list_insert_sorted(timeouts, timeout, compare_deadlines);
+    } else {
+        g_slice_free(VirtualTimeout, timeout);
+    }
+
+    return G_SOURCE_CONTINUE;
+}
+
+void
+gbb_clock_set_virtual(void)
+{
+    if (is_virtual)
+        return;
+
+    is_virtual = TRUE;
+    virtual_time = g_get_monotonic_time();
+}
+
+gboolean
+gbb_clock_is_virtual(void)
+{
+    return is_virtual;
+}
+
+gint64
+gbb_clock_get_time(void)
+{
+    return is_virtual ? virtual_time : g_get_monotonic_time();
+}
+
+static guint
+virtual_timeout_add(gint64      interval,
+                    GSourceFunc function,
+                    gpointer    data)
+{
+    VirtualTimeout *timeout = g_slice_new(VirtualTimeout);
+
+    timeout->id = next_id++;
+    timeout->deadline = virtual_time + interval;
+    timeout->interval = interval;
+    timeout->function = function;
+    timeout->data = data;
+
+    timeouts = g_list_insert_sorted(timeouts, timeout, compare_deadlines);
+
+    /* At low priority, so that anything that is due in real time
+     * happens before the clock moves on */
+    if (dispatch_idle == 0)
+        dispatch_idle = g_idle_add_full(G_PRIORITY_LOW, on_dispatch_idle, NULL, NULL);
+
+    return timeout->id;
+}
+
+guint
+gbb_clock_timeout_add(guint       interval,
+                      GSourceFunc function,
+                      gpointer    data)
+{
+    if (is_virtual)
+        return virtual_timeout_add(interval * 1000LL, function, data);
+    else
+        return g_timeout_add(interval, function, data);
+}
+
+guint
+gbb_clock_timeout_add_seconds(guint       interval,
+                              GSourceFunc function,
+                              gpointer    data)
+{
+    if (is_virtual)
+        return virtual_timeout_add(interval * 1000000LL, function, data);
+    else
+        return g_timeout_add_seconds(interval, function, data);
+}
+
+void
+gbb_clock_source_remove(guint id)
+{
+    GList *l;
+
+    if (!is_virtual) {
+        g_source_remove(id);
+        return;
+    }
+
+    if (dispatching && dispatching->id == id && !dispatching_removed) {
+        /* Freed by on_dispatch_idle() once the function returns */
+        dispatching_removed = TRUE;
+        return;
+    }
+
+    for (l = timeouts; l; l = l->next) {
+        VirtualTimeout *timeout = l->data;
+
+        if (timeout->id == id) {
+            timeouts = g_list_delete_link(timeouts, l);
+            g_slice_free(VirtualTimeout, timeout);
+            return;
+        }
+    }
+
+    g_critical("Virtual timeout %u not found", id);
+}
@@ -0,0 +1,25 @@
+#ifndef __UTIL_CLOCK_H__
+#define __UTIL_CLOCK_H__
+
+#include <glib.h>
+
+/* The monotonic clock that the power monitor, the test run and the
+ * simulated player go by. Normally this is just g_get_monotonic_time()
+ * and the GLib timeouts; once switched to virtual time, the clock
+ * only moves when the main loop is otherwise idle, jumping straight
+ * to the next timeout, so hours of a simulated test go by in seconds.
+ */
+void     gbb_clock_set_virtual         (void);
+gboolean gbb_clock_is_virtual          (void);
+
+gint64   gbb_clock_get_time            (void);
+
+guint    gbb_clock_timeout_add         (guint        interval,
+                                        GSourceFunc  function,
+                                        gpointer     data);
+guint    gbb_clock_timeout_add_seconds (guint        interval,
+                                        GSourceFunc  function,
+                                        gpointer     data);
+void     gbb_clock_source_remove       (guint        id);
+
+#endif /* __UTIL_CLOCK_H__ */
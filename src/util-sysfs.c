@@ -3,6 +3,12 @@
 #define _ISOC99_SOURCE //for NAN
 #include <math.h>
 
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
+
 char *
 sysfs_read_string_cached(GUdevDevice *device, const char *name)
 {
@@ -56,3 +62,131 @@ sysfs_read_double_scaled(GUdevDevice *device, const char *name)
 
     return value / 1000000.;
 }
+
+/* ************************************************************************** */
+
+static guint64 n_syscalls;
+
+struct _SysfsAttr {
+    char *path;
+    int fd;
+
+    /* Only files that live on sysfs are regenerated by the kernel on
+     * every read from offset 0; anything else (e.g. the umockdev test
+     * tree, where attributes are replaced via rename) is reopened for
+     * each read so we never look at a stale inode.
+     */
+    gboolean persistent;
+};
+
+static gboolean
+sysfs_attr_ensure_open(SysfsAttr *attr)
+{
+    struct statfs buf;
+
+    if (attr->fd >= 0) {
+        return TRUE;
+    }
+
+    attr->fd = open(attr->path, O_RDONLY | O_CLOEXEC);
+    n_syscalls++;
+    if (attr->fd < 0) {
+        return FALSE;
+    }
+
+    n_syscalls++;
+    attr->persistent = fstatfs(attr->fd, &buf) == 0 &&
+                       buf.f_type == SYSFS_MAGIC;
+
+    return TRUE;
+}
+
+SysfsAttr *
+sysfs_attr_open(GUdevDevice *device, const char *name)
+{
+    SysfsAttr *attr = g_slice_new0(SysfsAttr);
+    const char *path;
+
+    path = g_udev_device_get_sysfs_path(device);
+    attr->path = g_build_filename(path, name, NULL);
+    attr->fd = -1;
+
+    /* A missing attribute is not fatal here; the open is retried on
+     * the next read and reported as a failed read in the meantime. */
+    sysfs_attr_ensure_open(attr);
+
+    return attr;
+}
+
+void
+sysfs_attr_close(SysfsAttr *attr)
+{
+    if (attr == NULL) {
+        return;
+    }
+
+    if (attr->fd >= 0) {
+        close(attr->fd);
+    }
+
+    g_free(attr->path);
+    g_slice_free(SysfsAttr, attr);
+}
+
+gboolean
+sysfs_attr_read_guint64(SysfsAttr *attr, guint64 *res)
+{
+    char buffer[64];
+    guint64 value;
+    ssize_t count;
+    char *end;
+
+    if (!sysfs_attr_ensure_open(attr)) {
+        return FALSE;
+    }
+
+    do {
+        count = pread(attr->fd, buffer, sizeof(buffer) - 1, 0);
+        n_syscalls++;
+    } while (count < 0 && errno == EINTR);
+
+    if (!attr->persistent || count < 0) {
+        close(attr->fd);
+        n_syscalls++;
+        attr->fd = -1;
+    }
+
+    if (count <= 0) {
+        return FALSE;
+    }
+
+    buffer[count] = '\0';
+
+    value = g_ascii_strtoull(buffer, &end, 0);
+    if (end == buffer) {
+        return FALSE;
+    }
+
+    *res = value;
+    return TRUE;
+}
+
+double
+sysfs_attr_read_double_scaled(SysfsAttr *attr)
+{
+    guint64 value;
+    gboolean ok;
+
+    ok = sysfs_attr_read_guint64(attr, &value);
+    if (!ok) {
+        return NAN;
+    }
+
+    return value / 1000000.;
+}
+
+guint64
+sysfs_attr_get_syscall_count(void)
+{
+    return n_syscalls;
+}
@@ -12,4 +12,20 @@ gboolean sysfs_read_guint64            (GUdevDevice *device,
 double   sysfs_read_double_scaled      (GUdevDevice *device,
 					const char  *name);
 
+/* Handle to an attribute that is read over and over again, e.g.
+ * every time the power monitor polls; the file is kept open and
+ * re-read with pread() instead of open/read/close on every sample.
+ */
+typedef struct _SysfsAttr SysfsAttr;
+
+SysfsAttr * sysfs_attr_open               (GUdevDevice *device,
+					   const char  *name);
+void        sysfs_attr_close              (SysfsAttr   *attr);
+gboolean    sysfs_attr_read_guint64       (SysfsAttr   *attr,
+					   guint64     *res);
+double      sysfs_attr_read_double_scaled (SysfsAttr   *attr);
+
+/* Number of system calls issued by the SysfsAttr functions so far */
+guint64     sysfs_attr_get_syscall_count  (void);
+
 #endif /* __UTIL_SYSFS_H__ */
@@ -0,0 +1,181 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#include <zstd.h>
+
+#include "zstd-converter.h"
+
+struct _GbbZstdConverter {
+    GObject parent;
+
+    ZSTD_CCtx *cctx; /* one or the other */
+    ZSTD_DCtx *dctx;
+};
+
+static void zstd_converter_init (GConverterIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(GbbZstdConverter, gbb_zstd_converter, G_TYPE_OBJECT,
+                        G_IMPLEMENT_INTERFACE(G_TYPE_CONVERTER,
+                                              zstd_converter_init));
+
+static void
+gbb_zstd_converter_finalize(GObject *obj)
+{
+    GbbZstdConverter *converter = GBB_ZSTD_CONVERTER(obj);
+
+    if (converter->cctx)
+        ZSTD_freeCCtx(converter->cctx);
+    if (converter->dctx)
+        ZSTD_freeDCtx(converter->dctx);
+
+    G_OBJECT_CLASS(gbb_zstd_converter_parent_class)->finalize(obj);
+}
+
+static void
+gbb_zstd_converter_init(GbbZstdConverter *converter)
+{
+}
+
+static void
+gbb_zstd_converter_class_init(GbbZstdConverterClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+    gobject_class->finalize = gbb_zstd_converter_finalize;
+}
+
+static GConverterResult
+compress(GbbZstdConverter *converter,
+         ZSTD_inBuffer    *in,
+         ZSTD_outBuffer   *out,
+         GConverterFlags   flags,
+         GError          **error)
+{
+    ZSTD_EndDirective directive;
+
+    if (flags & G_CONVERTER_INPUT_AT_END)
+        directive = ZSTD_e_end;
+    else if (flags & G_CONVERTER_FLUSH)
+        directive = ZSTD_e_flush;
+    else
+        directive = ZSTD_e_continue;
+
+    size_t remaining = ZSTD_compressStream2(converter->cctx, out, in, directive);
+    if (ZSTD_isError(remaining)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_FAILED,
+                    "zstd compression failed: %s", ZSTD_getErrorName(remaining));
+        return G_CONVERTER_ERROR;
+    }
+
+    if (in->pos == 0 && out->pos == 0 && (in->size > 0 || remaining > 0)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                    "Need more output space");
+        return G_CONVERTER_ERROR;
+    }
+
+    if (remaining == 0 && in->pos == in->size) {
+        if (directive == ZSTD_e_end)
+            return G_CONVERTER_FINISHED;
+        else if (directive == ZSTD_e_flush)
+            return G_CONVERTER_FLUSHED;
+    }
+
+    return G_CONVERTER_CONVERTED;
+}
+
+static GConverterResult
+decompress(GbbZstdConverter *converter,
+           ZSTD_inBuffer    *in,
+           ZSTD_outBuffer   *out,
+           GConverterFlags   flags,
+           GError          **error)
+{
+    size_t hint = ZSTD_decompressStream(converter->dctx, out, in);
+    if (ZSTD_isError(hint)) {
+        g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                    "Invalid zstd data: %s", ZSTD_getErrorName(hint));
+        return G_CONVERTER_ERROR;
+    }
+
+    /* A hint of 0 means that a frame just ended; another may follow */
+    if (hint == 0 && in->pos == in->size && (flags & G_CONVERTER_INPUT_AT_END))
+        return G_CONVERTER_FINISHED;
+
+    if (in->pos == 0 && out->pos == 0) {
+        if (in->size > 0)
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                        "Need more output space");
+        else
+            g_set_error(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT,
+                        "Need more input");
+        return G_CONVERTER_ERROR;
+    }
+
+    return G_CONVERTER_CONVERTED;
+}
+
+static GConverterResult
+zstd_converter_convert(GConverter     *converter,
+                       const void     *inbuf,
+                       gsize           inbuf_size,
+                       void           *outbuf,
+                       gsize           outbuf_size,
+                       GConverterFlags flags,
+                       gsize          *bytes_read,
+                       gsize          *bytes_written,
+                       GError        **error)
+{
+    GbbZstdConverter *zstd = GBB_ZSTD_CONVERTER(converter);
+    ZSTD_inBuffer in = { inbuf, inbuf_size, 0 };
+    ZSTD_outBuffer out = { outbuf, outbuf_size, 0 };
+    GConverterResult result;
+
+    if (zstd->cctx)
+        result = compress(zstd, &in, &out, flags, error);
+    else
+        result = decompress(zstd, &in, &out, flags, error);
+
+    *bytes_read = in.pos;
+    *bytes_written = out.pos;
+
+    return result;
+}
+
+static void
+zstd_converter_reset(GConverter *converter)
+{
+    GbbZstdConverter *zstd = GBB_ZSTD_CONVERTER(converter);
+
+    if (zstd->cctx)
+        ZSTD_CCtx_reset(zstd->cctx, ZSTD_reset_session_only);
+    else
+        ZSTD_DCtx_reset(zstd->dctx, ZSTD_reset_session_only);
+}
+
+static void
+zstd_converter_init(GConverterIface *iface)
+{
+    iface->convert = zstd_converter_convert;
+    iface->reset = zstd_converter_reset;
+}
+
+GbbZstdConverter *
+gbb_zstd_converter_new_compressor(int level)
+{
+    GbbZstdConverter *converter = g_object_new(GBB_TYPE_ZSTD_CONVERTER, NULL);
+
+    converter->cctx = ZSTD_createCCtx();
+    ZSTD_CCtx_setParameter(converter->cctx, ZSTD_c_compressionLevel, level);
+    ZSTD_CCtx_setParameter(converter->cctx, ZSTD_c_checksumFlag, 1);
+
+    return converter;
+}
+
+GbbZstdConverter *
+gbb_zstd_converter_new_decompressor(void)
+{
+    GbbZstdConverter *converter = g_object_new(GBB_TYPE_ZSTD_CONVERTER, NULL);
+
+    converter->dctx = ZSTD_createDCtx();
+
+    return converter;
+}
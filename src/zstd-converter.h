@@ -0,0 +1,24 @@
+/* -*- mode: C; c-file-style: "stroustrup"; indent-tabs-mode: nil; -*- */
+
+#ifndef __ZSTD_CONVERTER_H__
+#define __ZSTD_CONVERTER_H__
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+/* A GConverter for the zstd format, to go along with GZlibCompressor
+ * and GZlibDecompressor in a GConverterOutputStream or
+ * GConverterInputStream. The decompressor reads any number of
+ * concatenated frames, like the zstd command line tool does.
+ */
+#define GBB_TYPE_ZSTD_CONVERTER gbb_zstd_converter_get_type()
+G_DECLARE_FINAL_TYPE(GbbZstdConverter, gbb_zstd_converter, GBB, ZSTD_CONVERTER, GObject)
+
+/* level as for the zstd command line tool; 0 for the default */
+GbbZstdConverter *gbb_zstd_converter_new_compressor   (int level);
+GbbZstdConverter *gbb_zstd_converter_new_decompressor (void);
+
+G_END_DECLS
+
+#endif /* __ZSTD_CONVERTER_H__ */